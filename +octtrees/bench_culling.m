@@ -0,0 +1,39 @@
+function results = bench_culling(tree, cell_constraints, repeats)
+%BENCH_CULLING Compares the ways of culling the tree's boxes
+% Runs the same parallel counts with each cull mode of the mocttree
+% queries and reports the boxes checked and the wall time of each
+%
+% tree is a mocttree, cell_constraints is a cell array of 4xN
+% constraints like query_planes_count_par (frusta from
+% frustum_constraints are a good test)
+%
+% repeats is optional, the times are the best of that many runs
+%
+% results is a table with a row per mode, the counts of every mode
+% must be the same
+if nargin < 3
+    repeats = 5;
+end
+
+modes = {'planes'; 'exact'};
+nodes_visited = zeros(numel(modes), 1);
+seconds = inf(numel(modes), 1);
+counts = cell(numel(modes), 1);
+
+for m = 1:numel(modes)
+    for r = 1:repeats
+        start = tic;
+        [counts{m}, visited] = tree.query_planes_count_par(cell_constraints, modes{m});
+        seconds(m) = min(seconds(m), toc(start));
+    end
+    nodes_visited(m) = sum(double(visited(:)));
+end
+
+for m = 2:numel(modes)
+    if ~isequal(counts{1}, counts{m})
+        error('The %s cull mode found different points', modes{m});
+    end
+end
+
+results = table(modes, nodes_visited, seconds, 'VariableNames', {'cull', 'nodes_visited', 'seconds'});
+end
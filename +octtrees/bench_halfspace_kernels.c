@@ -0,0 +1,135 @@
+/*
+    Microbenchmark of the point test kernels in moctsimd.h
+    Times every kernel this machine supports on the same random points, and checks
+    every point of every kernel against satisfies()
+*/
+
+#include <mex.h>
+#include <matrix.h>
+#include <time.h>
+#include "moctsimd.h"
+
+
+/*
+    Uniform in [-1, 1]
+*/
+static inline double bench_random(uint32_t* state){
+    *state = *state*1664525u + 1013904223u;
+    return (double)(*state>>8)/(double)(1<<23) - 1.;
+}
+
+
+/*
+    This is entrypoint for this file
+    in matlab it must be called as
+    [ns_per_point, isa_names] = bench_halfspace_kernels(constraints, num_points, run_length)
+
+    The constraints are a 4xN array of coefficents for planes, like query_count_moct
+    The points are uniform in the cube [-1, 1]^3, so pick constraints that cut through it.
+    Every other point is moved onto one of the planes, where a kernel that rounds even
+    slightly differently (a fused multiply-add) would disagree with satisfies()
+
+    Points are tested in runs of run_length (at most 64) like the leaves of a linear tree
+    (LINEAR_LEAF points)
+
+    ns_per_point is 1 x number of kernels, NaN if the kernel can't run here
+    isa_names is a cell array of the names of the kernels
+*/
+void mexFunction(int nlhs, mxArray *plhs[],
+                 int nrhs, const mxArray *prhs[]){
+    if (nrhs != 3){
+        mexErrMsgIdAndTxt("Mocttree:bench_halfspace_kernels:nrhs", "Bad arguments");
+    }
+
+    double* planearray = mxGetDoubles(prhs[0]);
+    size_t num_planes = mxGetN(prhs[0]);
+    size_t num_points = (size_t)mxGetScalar(prhs[1]);
+    size_t run_length = (size_t)mxGetScalar(prhs[2]);
+
+    if (mxGetM(prhs[0]) != 4){
+        mexErrMsgIdAndTxt("Mocttree:bench_halfspace_kernels:size", "Constraints must be 4xN");
+    }
+    if (run_length < 1 || run_length > HALFSPACE_RUN){
+        mexErrMsgIdAndTxt("Mocttree:bench_halfspace_kernels:run", "run_length must be 1 to 64");
+    }
+
+    constraint* cons = mxMalloc(num_planes*sizeof(plane3) + sizeof(constraint));
+    constraint_init(cons, num_planes);
+    for (int i = 0; i < num_planes; i++){
+        cons->planes[i].norm.pos[0] = planearray[4*i+0];    // a
+        cons->planes[i].norm.pos[1] = planearray[4*i+1];    // b
+        cons->planes[i].norm.pos[2] = planearray[4*i+2];    // c
+        cons->planes[i].dval = planearray[4*i+3];           // d
+    }
+
+    double* x = mxMalloc(num_points*sizeof(double) + 1);
+    double* y = mxMalloc(num_points*sizeof(double) + 1);
+    double* z = mxMalloc(num_points*sizeof(double) + 1);
+    uint32_t state = 1;
+    for (size_t i = 0; i < num_points; i++){
+        x[i] = bench_random(&state);
+        y[i] = bench_random(&state);
+        z[i] = bench_random(&state);
+
+        // Onto a plane, close enough that rounding decides which side it's on
+        if (i%2 == 1 && num_planes > 0){
+            plane3* plane = &cons->planes[(i/2)%num_planes];
+            double* n = plane->norm.pos;
+            double norm2 = n[0]*n[0] + n[1]*n[1] + n[2]*n[2];
+            if (norm2 > 0){
+                double t = (n[0]*x[i] + n[1]*y[i] + n[2]*z[i] - plane->dval)/norm2;
+                x[i] -= t*n[0];
+                y[i] -= t*n[1];
+                z[i] -= t*n[2];
+            }
+        }
+    }
+
+    // Enough repeats to test about 2e7 points per kernel
+    size_t repeats = num_points > 0 ? 20000000/num_points + 1 : 1;
+
+    plhs[0] = mxCreateDoubleMatrix(1, ISA_COUNT, mxREAL);
+    double* ns_per_point = mxGetDoubles(plhs[0]);
+    plhs[1] = mxCreateCellMatrix(1, ISA_COUNT);
+
+    for (int isa = 0; isa < ISA_COUNT; isa++){
+        mxSetCell(plhs[1], isa, mxCreateString(isa_names[isa]));
+
+        halfspace_kernel kernel = isa_kernel((simd_isa)isa);
+        if (kernel == NULL || !isa_supported((simd_isa)isa)){
+            ns_per_point[isa] = mxGetNaN();
+            continue;
+        }
+
+        // Every kernel must find exactly the points satisfies() does
+        for (size_t i = 0; i < num_points; i += run_length){
+            size_t run = num_points - i < run_length ? num_points - i : run_length;
+            uint64_t mask = kernel(cons, ALL_PLANES, x + i, y + i, z + i, run);
+            for (size_t j = 0; j < run; j++){
+                vec3 point = {{x[i+j], y[i+j], z[i+j]}};
+                if (((mask>>j)&1) != (uint64_t)satisfies(cons, point)){
+                    mexErrMsgIdAndTxt("Mocttree:bench_halfspace_kernels:mismatch",
+                                      "The %s kernel disagrees with satisfies() at point %zu", isa_names[isa], i + j + 1);
+                }
+            }
+        }
+
+        size_t found = 0;
+        clock_t start = clock();
+        for (size_t r = 0; r < repeats; r++){
+            for (size_t i = 0; i < num_points; i += run_length){
+                size_t run = num_points - i < run_length ? num_points - i : run_length;
+                found += mask_count(kernel(cons, ALL_PLANES, x + i, y + i, z + i, run));
+            }
+        }
+        clock_t end = clock();
+
+        double seconds = (double)(end - start)/CLOCKS_PER_SEC;
+        ns_per_point[isa] = num_points > 0 ? 1e9*seconds/(double)(repeats*num_points) : 0.;
+    }
+
+    mxFree(x);
+    mxFree(y);
+    mxFree(z);
+    mxFree(cons);
+}
@@ -1,10 +1,61 @@
 % Build all of the MATLAB .mex files
 
+% Compact leaves store points as 32 bit grid offsets and 32 bit indexes,
+% twice as many points fit in a node. Limited to 2^32-1 points.
+% Every file must be built the same way
+compact_leaves = false;
+if compact_leaves
+    defines = {'-DMOCT_COMPACT'};
+else
+    defines = {};
+end
+
+% Leaf capacity (points a leaf holds) and deepest level of the octrees,
+% [] keeps the defaults in mocttree.h and moctlinear.h. Past max_depth
+% (near duplicate points) a leaf just keeps growing. make sweep in cli/
+% times the octrees at several capacities to pick one for your clouds
+bucket_size = [];   % 'insert' and 'bulk' trees, 5 (10 compact) by default
+linear_leaf = [];   % 'linear' and 'tight' trees, 16 by default
+max_depth = [];     % 21 by default
+if ~isempty(bucket_size)
+    defines{end+1} = sprintf('-DMOCT_BUCKET=%d', bucket_size);
+end
+if ~isempty(linear_leaf)
+    defines{end+1} = sprintf('-DLINEAR_LEAF=%d', linear_leaf);
+end
+if ~isempty(max_depth)
+    defines{end+1} = sprintf('-DMOCT_MAX_DEPTH=%d', max_depth);
+end
+
+% MSVC takes its flags in COMPFLAGS, gcc and clang (Linux, macOS) in CFLAGS,
+% and they must link OpenMP too. gcc fuses multiplies and adds wherever the
+% cpu has FMA, which changes which points right on a plane are inside, so
+% that's turned off to keep every point test the same (MSVC doesn't fuse)
+if ispc
+    warnings = {'COMPFLAGS="$COMPFLAGS /Wall"'};
+    openmp = {'COMPFLAGS="$COMPFLAGS /openmp /Wall"'};
+else
+    warnings = {'CFLAGS="$CFLAGS -ffp-contract=off -Wall"'};
+    openmp = {'CFLAGS="$CFLAGS -fopenmp -ffp-contract=off -Wall"', 'LDFLAGS="$LDFLAGS -fopenmp"'};
+end
+
 % mex -v -R2018a -I.\mimalloc\include\ createfreemoct.c ".\mimalloc\out\msvc-x64\Release\mimalloc-static.lib" COMPFLAGS="$COMPFLAGS /Wall"
 % mex -v -R2018a -I.\mimalloc\include\ createmoct.c .\mimalloc\out\msvc-x64\Release\mimalloc-static.lib
 % mex -v -R2018a -I.\mimalloc\include\ freemoct.c .\mimalloc\out\msvc-x64\Release\mimalloc-static.lib
-mex -v -R2018a createfreemoct.c COMPFLAGS="$COMPFLAGS /Wall"
-mex -v -R2018a query_count_moct.c COMPFLAGS="$COMPFLAGS /Wall" 
-mex -v -R2018a query_index_moct.c COMPFLAGS="$COMPFLAGS /Wall" 
-mex -v -R2018a COMPFLAGS="$COMPFLAGS /openmp /Wall"  query_count_moct_par.c
-mex -v -R2018a COMPFLAGS="$COMPFLAGS /openmp /Wall"  query_count_moct_par_lim.c
\ No newline at end of file
+mex('-v', '-R2018a', defines{:}, openmp{:}, 'createfreemoct.c')
+mex('-v', '-R2018a', defines{:}, 'query_count_moct.c', warnings{:})
+mex('-v', '-R2018a', defines{:}, 'query_index_moct.c', warnings{:})
+mex('-v', '-R2018a', defines{:}, 'query_clearance_moct.c', warnings{:})
+mex('-v', '-R2018a', defines{:}, 'frustum_constraints.c', warnings{:})
+mex('-v', '-R2018a', defines{:}, openmp{:}, 'query_count_moct_par.c')
+mex('-v', '-R2018a', defines{:}, openmp{:}, 'query_count_moct_par_lim.c')
+mex('-v', '-R2018a', defines{:}, openmp{:}, 'query_index_moct_par.c')
+mex('-v', '-R2018a', defines{:}, openmp{:}, 'query_clearances_moct_par.c')
+mex('-v', '-R2018a', defines{:}, openmp{:}, 'query_upwards_moct_par.c')
+mex('-v', '-R2018a', defines{:}, openmp{:}, 'trajmoct.c')
+mex('-v', '-R2018a', defines{:}, 'bench_halfspace_kernels.c', warnings{:})
+mex('-v', '-R2018a', defines{:}, openmp{:}, 'filemoct.c')
+mex('-v', '-R2018a', defines{:}, openmp{:}, 'updatemoct.c')
+mex('-v', '-R2018a', openmp{:}, 'readlas.c')
+mex('-v', '-R2018a', openmp{:}, 'tilelas.c')
+mex('-v', '-R2018a', openmp{:}, 'voxelmoct.c')
@@ -6,195 +6,14 @@
     for reference.
 
     Mex function which creates an oct tree and deletes the mocttree.
+    The trees are built by moctbuild.h, this only turns the arguments into its calls.
 */
 
 
 #include <mex.h>
-#include <stdio.h>
 #include <matrix.h>
 #include <string.h>
-#include "mocttree.h"
-
-
-/*
-    ------------------- Memory Allocation code ---------------------
-*/
-
-// 1024
-# define BLOCK_SIZE (1<<10)
-
-// Allocating stuff
-octnode* get_free_node(mocttree* tree){
-    // If we don't have enough space in the chunk array, make some more
-    if(tree->space_chunks <= tree->index_chunks){
-        tree->space_chunks = (tree->space_chunks*3)/2 + 4;
-        tree->memory_chunks = mxRealloc(tree->memory_chunks, tree->space_chunks*sizeof(void*));
-        mexMakeMemoryPersistent(tree->memory_chunks);
-    }
-
-    // This is a new chunk
-    if(tree->index_single == 0){
-        // Allocating an extra octnode to align things properly
-        // Otherwise its chunks of BLOCK_SIZE octnodes
-        tree->memory_chunks[tree->index_chunks] = mxCalloc(BLOCK_SIZE+1, sizeof(octnode));
-        mexMakeMemoryPersistent(tree->memory_chunks[tree->index_chunks]);
-
-        uintptr_t ptr_number = (uintptr_t)tree->memory_chunks[tree->index_chunks];
-        
-        // Realign to 256 byte boundry
-        // We align them fully so that an octnode does not straddle a page boundry
-        // Importantly, this also keeps them aligned to cache line boundries
-        ptr_number = (ptr_number + 255ULL)&(~(255ULL));
-        tree->free_node = (octnode*)ptr_number;
-    }
-
-    // Hot path
-    octnode* ret = tree->free_node++;
-    tree->index_single++;
-
-    //If we are out of space
-    if (tree->index_single == BLOCK_SIZE){
-        tree->index_single = 0;
-        tree->index_chunks = tree->index_chunks+1;
-    }
-
-    return ret;
-}
-
-/*
-    ------------------- Freeing code ---------------------
-*/
-
-// Now its used!
-void free_memory(mocttree* tree){
-
-    int chunks_to_free = tree->index_chunks;
-    if (tree->index_single != 0) chunks_to_free++;
-
-    // Free all the octnode blocks
-    for(int i=0; i<chunks_to_free; i++){
-        mxFree(tree->memory_chunks[i]);
-    }
-    // Free the space to all the octnode blocks
-    mxFree(tree->memory_chunks);
-    // Free the tree itself
-    mxFree(tree);
-}
-
-
-/*
-    ------------------- Construction code ---------------------
-*/
-
-
-/*
-    Creates a node, does using the passed heap
-*/
-octnode* create_node(vec3 midpoint, mocttree* tree){
-    // Allocate a node and fill it with zeros
-    // Already zero filled (nice!)
-    octnode* new_node = get_free_node(tree);
-
-    new_node->midpoint = midpoint;
-    return new_node;
-}
-
-
-/*
-    Ensures every coordinate in point1 is < point2
-*/
-void fix_points(vec3* point1, vec3* point2){
-    double temp;
-    for (int i = 0; i < 3; i++){
-        if(point2->pos[i] < point1->pos[i]){
-            temp = point2->pos[i];
-            point2->pos[i] = point1->pos[i];
-            point1->pos[i] = temp;
-        }
-    }
-}
-
-
-/*
-    Creates the base of the tree
-*/
-mocttree* create_tree(vec3 point1, vec3 point2){
-    // Note: No special requirements on point1 or point2
-
-    // The tree itself is stored under MATLAB's memory manager
-    mocttree* new_tree = mxCalloc(1, sizeof(mocttree));
-    mexMakeMemoryPersistent(new_tree);
-
-    new_tree->space_chunks = 0;
-    new_tree->index_chunks = 0;
-    new_tree->index_single = 0;
-    new_tree->free_node = NULL;
-    new_tree->memory_chunks = NULL;
-
-    fix_points(&point1, &point2);
-    new_tree->point1 = point1;
-    new_tree->point2 = point2;
-    new_tree->num_elements = 0;
-    new_tree->root = create_node(vec3_midpoint(point1, point2), new_tree);
-    return new_tree;
-}
-
-
-/*
-    Insert into a node
-    Requirements:
-    All coordinates in point1 < node.midpoint < point2
-
-*/
-void insert_node(item new_item, octnode* node, vec3 point1, vec3 point2, mocttree* tree){
-    node->num_total_elements++;
-    if (node->num_elements < 5){
-        node->bucket[node->num_elements++] = new_item;
-        return;
-    }
-
-    int which_child = 0;
-    // X Y Z indexing
-    // if X > midpoint X then +1
-    // if Y > midpoint Y then +2
-    // if Z > midpoint Z then +4
-    for (int i = 0; i < 3; i++){
-        if (new_item.point.pos[i] > node->midpoint.pos[i]){
-            which_child += (1<<i);
-            point1.pos[i] = node->midpoint.pos[i];
-        } else {
-            point2.pos[i] = node->midpoint.pos[i];
-        }
-    }
-
-    // Create the child should it not exist
-    if (node->children[which_child] == NULL){
-        node->children[which_child] = create_node(vec3_midpoint(point1, point2), tree);
-    }
-    
-    // Insert it into the appropriate child
-    // point1 and point2 were adjusted to be correct
-    insert_node(new_item, node->children[which_child], point1, point2, tree);
-}
-
-
-/*
-    Insert into a tree
-*/
-bool insert_tree(mocttree* tree, vec3 point){
-
-    item new_item;
-    new_item.index = ++(tree->num_elements);
-    new_item.point = point;
-
-    // Ensure its inside the tree
-    for (int i = 0; i < 3; i++){
-        if(point.pos[i] < tree->point1.pos[i] || point.pos[i] > tree->point2.pos[i]) return false;
-    } // Note, With the current implementation (static trees) this is always true
-
-    insert_node(new_item, tree->root, tree->point1, tree->point2, tree);
-    return true;
-}
+#include "moctbuild.h"
 
 
 /*
@@ -205,16 +24,37 @@ bool insert_tree(mocttree* tree, vec3 point){
 /*
     This is entrypoint for this file
     in matlab it must be called as 
-    createfreemoct(points, point1, point2) OR createfreemoct(treeptr)
+    createfreemoct(points, point1, point2) OR
+    createfreemoct(points, point1, point2, build_mode) OR
+    createfreemoct(points, point1, point2, build_mode, grid) OR createfreemoct(treeptr)
 
     For the first case:
     Points is formatted as a 3xN
     [ x1 x2 x3 ... ]
     [ y1 y2 y3 ... ]
     [ z1 z2 z3 ... ]
+    or a cell {x, y, z} of three double vectors of the same length, used as is
+    (the columns of a cloud don't need to be copied into one array first)
     point1 and point2 are both arrays of 3
     doubles
 
+    build_mode is a string
+    'insert' - (default) every point is inserted one at a time
+    'bulk' - every point is sorted by its morton key in parallel and the
+             tree is made in one pass, the queries give the same results
+    'linear' - sorted like 'bulk', but the tree is a linear oct tree (see moctlinear.h)
+               the queries give the same results, the indexes may be in a different order
+    'tight' - a 'linear' tree that also keeps the tight box of the points under every
+              node (see linbox), the same results with fewer boxes checked
+
+    grid is only used by 'insert' and 'bulk' trees built with MOCT_COMPACT, which store
+    points as 32 bit signed steps k on a grid, each point being (step*k + offset) - shift.
+    It is an array of 3 steps, or 9 doubles [steps offsets shifts]. The scale factors and
+    offsets of a las file, and the offsets again if they were subtracted from the points,
+    store every point read from it exactly. Those trees must be given a grid and every
+    point must be on it, or it is an error (rounding a point could move it across the
+    edge of a region, so the results would change)
+
     The function will return a uint64 which is a pointer to the tree
 
     For the second case it will destroy the tree pointed to by treeptr
@@ -224,9 +64,47 @@ bool insert_tree(mocttree* tree, vec3 point){
 
 void mexFunction(int nlhs, mxArray *plhs[],
                  int nrhs, const mxArray *prhs[]){
-    if (nrhs == 3){
-        double* pointarray = mxGetDoubles(prhs[0]);
-        size_t num_points = mxGetN(prhs[0]);
+    if (nrhs >= 3 && nrhs <= 5){
+        size_t num_points;
+        point_source source = get_point_source(prhs[0], &num_points, "Mocttree:createfreemoct:points");
+
+        bool bulk = false;
+        bool linear = false;
+        bool boxes = false;
+        if (nrhs >= 4){
+            char build_mode[16];
+            if (mxGetString(prhs[3], build_mode, sizeof(build_mode)) != 0){
+                mexErrMsgIdAndTxt("Mocttree:createfreemoct:mode", "Build mode must be 'insert', 'bulk', 'linear' or 'tight'");
+            }
+            if (strcmp(build_mode, "bulk") == 0){
+                bulk = true;
+            } else if (strcmp(build_mode, "linear") == 0){
+                linear = true;
+            } else if (strcmp(build_mode, "tight") == 0){
+                linear = true;
+                boxes = true;
+            } else if (strcmp(build_mode, "insert") != 0){
+                mexErrMsgIdAndTxt("Mocttree:createfreemoct:mode", "Build mode must be 'insert', 'bulk', 'linear' or 'tight'");
+            }
+        }
+
+        if ((bulk || linear) && num_points > UINT32_MAX){
+            mexErrMsgIdAndTxt("Mocttree:createfreemoct:size", "Bulk building supports at most 2^32-1 points");
+        }
+#ifdef MOCT_COMPACT
+        if (num_points > UINT32_MAX){
+            mexErrMsgIdAndTxt("Mocttree:createfreemoct:size", "Compact trees support at most 2^32-1 points");
+        }
+#endif
+
+        if (nrhs == 5 && mxGetNumberOfElements(prhs[4]) != 3 && mxGetNumberOfElements(prhs[4]) != 9){
+            mexErrMsgIdAndTxt("Mocttree:createfreemoct:grid", "grid must have 3 or 9 elements");
+        }
+#ifdef MOCT_COMPACT
+        if (!linear && nrhs != 5){
+            mexErrMsgIdAndTxt("Mocttree:createfreemoct:grid", "Compact trees need a grid, pass the scale factors, offsets and any shift of the las file");
+        }
+#endif
 
         double* point1arr = mxGetDoubles(prhs[1]);
         double* point2arr = mxGetDoubles(prhs[2]);
@@ -240,15 +118,53 @@ void mexFunction(int nlhs, mxArray *plhs[],
             point2.pos[i] = 1.1*point2arr[i] - 0.1*point1arr[i];
         }
 
+        if (linear){
+            linoctree* tree = linear_tree(point1, point2, &source, num_points, boxes);
+
+            size_t one = 1;
+            mxArray* result = mxCreateUninitNumericArray(1, &one, mxUINT64_CLASS, mxREAL);
+            mxGetUint64s(result)[0] = (uint64_t)tree;
+            plhs[0] = result;
+            return;
+        }
+
         mocttree* tree = create_tree(point1, point2);
-        vec3 new_point;
-        
-        for (int i = 0; i<num_points; i++){
-            new_point.pos[0] = pointarray[3*i+0];
-            new_point.pos[1] = pointarray[3*i+1];
-            new_point.pos[2] = pointarray[3*i+2];    
-            insert_tree(tree, new_point);
+
+#ifdef MOCT_COMPACT
+        {
+            vec3 grid_step;
+            vec3 grid_origin = {{0., 0., 0.}};
+            vec3 grid_shift = {{0., 0., 0.}};
+            double* grid_arr = mxGetDoubles(prhs[4]);
+            bool full = mxGetNumberOfElements(prhs[4]) == 9;
+            for (int i = 0; i < 3; i++){
+                grid_step.pos[i] = grid_arr[i];
+                if (full){
+                    grid_origin.pos[i] = grid_arr[3+i];
+                    grid_shift.pos[i] = grid_arr[6+i];
+                }
+            }
+            set_grid(tree, grid_step, grid_origin, grid_shift, true);
+
+            // Rounding any point would change the results
+            for (size_t i = 0; i < num_points; i++){
+                if (!grid_holds(tree, source_point(&source, i))){
+                    free_memory(tree);
+                    mexErrMsgIdAndTxt("Mocttree:createfreemoct:grid", "Point %zu is not on the grid, pass the scale factors, offsets and any shift of its las file", i + 1);
+                }
+            }
+        }
+#endif
+
+        if (bulk){
+            bulk_tree(tree, &source, num_points);
+        } else {
+            for (size_t i = 0; i<num_points; i++){
+                insert_tree(tree, source_point(&source, i));
+            }
         }
+        // The points it was built with can be dropped like any appended (see updatemoct.c)
+        record_batch(tree, 0, 1, num_points, tree->point1, tree->point2);
 
         size_t one = 1;
         mxArray* result = mxCreateUninitNumericArray(1, &one, mxUINT64_CLASS, mxREAL);
@@ -258,9 +174,8 @@ void mexFunction(int nlhs, mxArray *plhs[],
 
         // Freeing
         // Recast the uint64
-        uint64_t* tree_pointer_int = mxGetUint64s(prhs[0])[0];
-        mocttree* tree = (mocttree*)tree_pointer_int;
-        free_memory(tree);
+        void* tree = (void*)(mxGetUint64s(prhs[0])[0]);
+        moct_free_tree(tree);
 
         size_t one = 1;
         mxArray* result = mxCreateUninitNumericArray(1, &one, mxUINT64_CLASS, mxREAL);
@@ -0,0 +1,131 @@
+/*
+    Saves linear oct trees to files and maps them back, see moctfile.h
+*/
+
+#include <mex.h>
+#include <matrix.h>
+#include <string.h>
+#include <omp.h>
+#include "moctfile.h"
+
+
+/*
+    The key argument, a uint64 scalar
+*/
+static uint64_t get_key(const mxArray* arg){
+    if (!mxIsUint64(arg) || mxGetNumberOfElements(arg) != 1){
+        mexErrMsgIdAndTxt("Mocttree:filemoct:key", "The key must be a uint64 scalar");
+    }
+    return mxGetUint64s(arg)[0];
+}
+
+
+/*
+    A filename argument, mxFree it after
+*/
+static char* get_filename(const mxArray* arg){
+    char* filename = mxArrayToString(arg);
+    if (filename == NULL){
+        mexErrMsgIdAndTxt("Mocttree:filemoct:filename", "The filename must be a string");
+    }
+    return filename;
+}
+
+
+/*
+    Hashes points into seed, a double array or a cell of them hashed in turn
+*/
+static uint64_t hash_points(const mxArray* points, uint64_t seed){
+    if (!mxIsCell(points)){
+        if (!mxIsDouble(points)){
+            mexErrMsgIdAndTxt("Mocttree:filemoct:points", "The points must be doubles, or a cell of doubles");
+        }
+        return moct_hash(mxGetDoubles(points), mxGetNumberOfElements(points), seed);
+    }
+
+    for (size_t i = 0; i < mxGetNumberOfElements(points); i++){
+        const mxArray* part = mxGetCell(points, i);
+        if (part == NULL || mxIsCell(part)){
+            mexErrMsgIdAndTxt("Mocttree:filemoct:points", "The points must be doubles, or a cell of doubles");
+        }
+        seed = hash_points(part, seed);
+    }
+    return seed;
+}
+
+
+static mxArray* create_uint64(uint64_t value){
+    size_t one = 1;
+    mxArray* result = mxCreateUninitNumericArray(1, &one, mxUINT64_CLASS, mxREAL);
+    mxGetUint64s(result)[0] = value;
+    return result;
+}
+
+
+/*
+    This is entrypoint for this file
+    in matlab it must be called as one of
+    key = filemoct('key', points, settings)
+    filemoct('save', uint64 to a moct, filename, key)
+    treeptr = filemoct('map', filename, key)
+    filemoct('unmap', treeptr)
+
+    'key' hashes the points (any array of doubles, or a cell of them like {x, y, z}) and
+    settings (another array of doubles, anything else the tree depends on) into a uint64 key
+
+    'save' writes a linear moct (see moctlinear.h) to filename, only linear trees can be saved
+
+    'map' maps the tree in filename read only and returns a pointer to it like createfreemoct,
+    every query works on it. 0 is returned if the file is missing, from another version,
+    or was saved with another key
+
+    'unmap' releases a tree from 'map', never pass one to createfreemoct to free
+*/
+void mexFunction(int nlhs, mxArray *plhs[],
+                 int nrhs, const mxArray *prhs[]){
+    char command[8];
+    if (nrhs < 1 || mxGetString(prhs[0], command, sizeof(command)) != 0){
+        mexErrMsgIdAndTxt("Mocttree:filemoct:command", "The first argument must be 'key', 'save', 'map' or 'unmap'");
+    }
+
+    if (strcmp(command, "key") == 0){
+        if (nrhs != 3 || !mxIsDouble(prhs[2])){
+            mexErrMsgIdAndTxt("Mocttree:filemoct:nrhs", "Bad arguments");
+        }
+        uint64_t seed = moct_hash(mxGetDoubles(prhs[2]), mxGetNumberOfElements(prhs[2]), MOCT_FILE_VERSION);
+        plhs[0] = create_uint64(hash_points(prhs[1], seed));
+    } else if (strcmp(command, "save") == 0){
+        if (nrhs != 4){
+            mexErrMsgIdAndTxt("Mocttree:filemoct:nrhs", "Bad arguments");
+        }
+        void* tree = (void*)(mxGetUint64s(prhs[1])[0]);
+        if (tree_kind(tree) != MOCT_LINEAR){
+            mexErrMsgIdAndTxt("Mocttree:filemoct:kind", "Only linear trees can be saved, build with 'linear' or 'tight'");
+        }
+
+        uint64_t key = get_key(prhs[3]);
+        char* filename = get_filename(prhs[2]);
+        bool ok = moct_file_save((linoctree*)tree, filename, key);
+        mxFree(filename);
+        if (!ok){
+            mexErrMsgIdAndTxt("Mocttree:filemoct:save", "Could not write the tree file");
+        }
+    } else if (strcmp(command, "map") == 0){
+        if (nrhs != 3){
+            mexErrMsgIdAndTxt("Mocttree:filemoct:nrhs", "Bad arguments");
+        }
+        uint64_t key = get_key(prhs[2]);
+        char* filename = get_filename(prhs[1]);
+        linoctree* tree = moct_file_map(filename, key);
+        mxFree(filename);
+        plhs[0] = create_uint64((uint64_t)tree);
+    } else if (strcmp(command, "unmap") == 0){
+        if (nrhs != 2){
+            mexErrMsgIdAndTxt("Mocttree:filemoct:nrhs", "Bad arguments");
+        }
+        linoctree* tree = (linoctree*)(mxGetUint64s(prhs[1])[0]);
+        if (tree != NULL) moct_file_unmap(tree);
+    } else {
+        mexErrMsgIdAndTxt("Mocttree:filemoct:command", "The first argument must be 'key', 'save', 'map' or 'unmap'");
+    }
+}
@@ -0,0 +1,123 @@
+/*
+    Build the constraints of scan frusta directly from their observer and target corners
+    Replaces giftwrap3d_mex + convert_hull_to_constraints for these pyramids
+*/
+
+#include <mex.h>
+#include <matrix.h>
+#include "moctfrustum.h"
+
+
+/*
+    Copies a 5 plane constraint into a 4x5 column major block
+*/
+void write_constraint(constraint* cons, double* out){
+    for (int i = 0; i < cons->num_planes; i++){
+        out[4*i+0] = cons->planes[i].norm.pos[0];   // a
+        out[4*i+1] = cons->planes[i].norm.pos[1];   // b
+        out[4*i+2] = cons->planes[i].norm.pos[2];   // c
+        out[4*i+3] = cons->planes[i].dval;          // d
+    }
+}
+
+
+/*
+    This is entrypoint for this file
+    in matlab it must be called as
+    frustum_constraints(apexes, corners) OR
+    frustum_constraints(observers, forward, leftward, dir, params)
+
+    For the first case:
+    apexes is a 3xM array of the pyramid apexes (the observers)
+    corners is a 3x4xM array, the 4 target corners (in order around the target) of each pyramid
+
+    For the second case the corners are made like get_target_plane_corners.m:
+    observers is a 3xM array
+    forward and leftward are arrays of 3 doubles
+    dir is a double, 0 for "up", 1 for "right" and 2 for "left"
+    params is an array of 3 doubles [ target_plane_width, max_top, max_side ]
+
+    In both cases it returns a 4x5xM array, every 4x5 page is a constraint
+    [ a0 a1 a2 a3 a4 ]
+    [ b0 b1 b2 b3 b4 ]
+    [ c0 c1 c2 c3 c4 ]
+    [ d0 d1 d2 d3 d4 ]
+    where the region each plane considers is
+    ax + by + cz >= d
+    The first 4 planes are the sides and the last one is the target
+*/
+void mexFunction(int nlhs, mxArray *plhs[],
+                 int nrhs, const mxArray *prhs[]){
+    if (nrhs != 2 && nrhs != 5){
+        mexErrMsgIdAndTxt("Mocttree:frustum_constraints:nrhs", "Bad arguments");
+    }
+
+    double* apex_arr = mxGetDoubles(prhs[0]);
+    size_t num_frusta = mxGetN(prhs[0]);
+
+    if (mxGetM(prhs[0]) != 3){
+        mexErrMsgIdAndTxt("Mocttree:frustum_constraints:size", "Apexes must be 3xM");
+    }
+
+    union {
+        uint8_t block_mem[5*sizeof(plane3) + sizeof(constraint)];
+        constraint c;
+    } cons;
+
+    size_t dims[3] = {4, 5, num_frusta};
+    mxArray* result = mxCreateUninitNumericArray(3, dims, mxDOUBLE_CLASS, mxREAL);
+    double* out = mxGetDoubles(result);
+
+    vec3 apex;
+    vec3 corners[4];
+
+    if (nrhs == 2){
+        double* corner_arr = mxGetDoubles(prhs[1]);
+        if (mxGetNumberOfElements(prhs[1]) != 12*num_frusta){
+            mexErrMsgIdAndTxt("Mocttree:frustum_constraints:size", "Corners must be 3x4xM");
+        }
+
+        for (int i = 0; i < num_frusta; i++){
+            for (int j = 0; j < 3; j++){
+                apex.pos[j] = apex_arr[3*i+j];
+                for (int k = 0; k < 4; k++){
+                    corners[k].pos[j] = corner_arr[12*i + 3*k + j];
+                }
+            }
+            frustum_constraint(apex, corners, &cons.c);
+            write_constraint(&cons.c, out + 20*i);
+        }
+    } else {
+        double* forward_arr = mxGetDoubles(prhs[1]);
+        double* leftward_arr = mxGetDoubles(prhs[2]);
+        scan_direction dir = (scan_direction)mxGetScalar(prhs[3]);
+        double* param_arr = mxGetDoubles(prhs[4]);
+
+        if (mxGetNumberOfElements(prhs[3]) != 1 || (dir != SCAN_UP && dir != SCAN_RIGHT && dir != SCAN_LEFT)){
+            mexErrMsgIdAndTxt("Mocttree:frustum_constraints:dir", "dir must be 0 (up), 1 (right) or 2 (left)");
+        }
+        if (mxGetNumberOfElements(prhs[1]) != 3 || mxGetNumberOfElements(prhs[2]) != 3){
+            mexErrMsgIdAndTxt("Mocttree:frustum_constraints:size", "forward and leftward must have 3 elements");
+        }
+        if (mxGetNumberOfElements(prhs[4]) != 3){
+            mexErrMsgIdAndTxt("Mocttree:frustum_constraints:params", "params must have 3 elements");
+        }
+
+        vec3 forward, leftward;
+        for (int j = 0; j < 3; j++){
+            forward.pos[j] = forward_arr[j];
+            leftward.pos[j] = leftward_arr[j];
+        }
+
+        for (int i = 0; i < num_frusta; i++){
+            for (int j = 0; j < 3; j++){
+                apex.pos[j] = apex_arr[3*i+j];
+            }
+            scan_target_corners(apex, forward, leftward, param_arr[0], dir, param_arr[1], param_arr[2], corners);
+            frustum_constraint(apex, corners, &cons.c);
+            write_constraint(&cons.c, out + 20*i);
+        }
+    }
+
+    plhs[0] = result;
+}
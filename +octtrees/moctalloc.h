@@ -0,0 +1,43 @@
+/*
+    Memory for the trees and everything built with them
+
+    Inside a MEX file (mex defines MATLAB_MEX_FILE) it is MATLAB's memory manager, so
+    whatever isn't made persistent is freed when a call ends or errors. Anywhere else
+    (see cli/) it is the C library, and running out of memory ends the program, the
+    same as it ends a MEX call, so the callers never check for NULL.
+*/
+
+#pragma once
+#include <stdlib.h>
+#include <stddef.h>
+
+#ifdef MATLAB_MEX_FILE
+# include <mex.h>
+
+# define moct_malloc(bytes) mxMalloc(bytes)
+# define moct_calloc(count, bytes) mxCalloc(count, bytes)
+# define moct_realloc(ptr, bytes) mxRealloc(ptr, bytes)
+# define moct_free(ptr) mxFree(ptr)
+
+// Keeps memory past the end of the call, trees live between calls
+# define moct_persist(ptr) mexMakeMemoryPersistent(ptr)
+
+#else
+# include <stdio.h>
+
+static inline void* moct_checked(void* ptr){
+    if (ptr == NULL){
+        fputs("Out of memory\n", stderr);
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+// At least a byte, malloc(0) may give NULL
+# define moct_malloc(bytes) moct_checked(malloc((bytes) + 1))
+# define moct_calloc(count, bytes) moct_checked(calloc((count) + 1, bytes))
+# define moct_realloc(ptr, bytes) moct_checked(realloc(ptr, (bytes) + 1))
+# define moct_free(ptr) free(ptr)
+# define moct_persist(ptr) ((void)(ptr))
+
+#endif
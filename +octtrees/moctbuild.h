@@ -0,0 +1,1049 @@
+/*
+    Building and freeing oct trees
+    Every way a tree is made (inserting, bulk and linear) without anything from MATLAB,
+    createfreemoct.c wraps these for MATLAB and cli/ uses them directly (only
+    get_point_source, for the points argument of the MEX files, needs MATLAB)
+
+    The memory is from moctalloc.h and is kept past the call that made it
+*/
+
+#pragma once
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <omp.h>
+#include "mocttree.h"
+#include "moctlinear.h"
+#include "moctsort.h"
+#include "moctalloc.h"
+
+
+/*
+    ------------------- Memory Allocation code ---------------------
+*/
+
+// 1024
+# define BLOCK_SIZE (1<<10)
+
+/*
+    First node of a chunk of memory_chunks
+    Realign to 256 byte boundry
+    We align them fully so that an octnode does not straddle a page boundry
+    Importantly, this also keeps them aligned to cache line boundries
+*/
+static inline octnode* chunk_nodes(void* chunk){
+    uintptr_t ptr_number = (uintptr_t)chunk;
+    ptr_number = (ptr_number + 255ULL)&(~(255ULL));
+    return (octnode*)ptr_number;
+}
+
+
+// Allocating stuff
+octnode* get_free_node(mocttree* tree){
+    // If we don't have enough space in the chunk array, make some more
+    if(tree->space_chunks <= tree->index_chunks){
+        tree->space_chunks = (tree->space_chunks*3)/2 + 4;
+        tree->memory_chunks = moct_realloc(tree->memory_chunks, tree->space_chunks*sizeof(void*));
+        moct_persist(tree->memory_chunks);
+    }
+
+    // This is a new chunk
+    if(tree->index_single == 0){
+        // Allocating an extra octnode to align things properly
+        // Otherwise its chunks of BLOCK_SIZE octnodes
+        tree->memory_chunks[tree->index_chunks] = moct_calloc(BLOCK_SIZE+1, sizeof(octnode));
+        moct_persist(tree->memory_chunks[tree->index_chunks]);
+        tree->free_node = chunk_nodes(tree->memory_chunks[tree->index_chunks]);
+    }
+
+    // Hot path
+    octnode* ret = tree->free_node++;
+    tree->index_single++;
+
+    //If we are out of space
+    if (tree->index_single == BLOCK_SIZE){
+        tree->index_single = 0;
+        tree->index_chunks = tree->index_chunks+1;
+    }
+
+    return ret;
+}
+
+/*
+    ------------------- Freeing code ---------------------
+*/
+
+// Now its used!
+void free_memory(mocttree* tree){
+
+    int chunks_to_free = tree->index_chunks;
+    if (tree->index_single != 0) chunks_to_free++;
+
+    // Free all the octnode blocks, and the overflow of any node in them
+    for(int i=0; i<chunks_to_free; i++){
+        octnode* nodes = chunk_nodes(tree->memory_chunks[i]);
+        size_t used = (size_t)i == tree->index_chunks ? tree->index_single : BLOCK_SIZE;
+        for (size_t j = 0; j < used; j++){
+            if (nodes[j].num_elements > MOCT_BUCKET) moct_free(nodes[j].overflow.items);
+        }
+        moct_free(tree->memory_chunks[i]);
+    }
+    // Free the space to all the octnode blocks
+    moct_free(tree->memory_chunks);
+    if (tree->batches != NULL) moct_free(tree->batches);
+    // Free the tree itself
+    moct_free(tree);
+}
+
+
+/*
+    ------------------- Construction code ---------------------
+*/
+
+
+/*
+    The points a tree is built from
+    Either a 3xN array (stride 3) or separate x, y and z columns (stride 1)
+*/
+typedef struct point_source{
+    const double* coords[3];
+    size_t stride;
+} point_source;
+
+
+/*
+    Point i (0 based) of a source
+*/
+static inline vec3 source_point(const point_source* source, size_t i){
+    vec3 point;
+    for (int j = 0; j < 3; j++){
+        point.pos[j] = source->coords[j][source->stride*i];
+    }
+    return point;
+}
+
+
+#ifdef MATLAB_MEX_FILE
+/*
+    The points argument of createfreemoct and updatemoct, a 3xN array or a cell of x, y
+    and z (the columns of a cloud are used as they are, without copying them)
+    error_id is the MEX file's id for a bad argument
+*/
+static point_source get_point_source(const mxArray* points, size_t* num_points, const char* error_id){
+    point_source source;
+    if (!mxIsCell(points)){
+        if (!mxIsDouble(points) || mxGetM(points) != 3){
+            mexErrMsgIdAndTxt(error_id, "Points must be 3xN doubles, or a cell of x, y and z");
+        }
+        double* pointarray = mxGetDoubles(points);
+        for (int j = 0; j < 3; j++){
+            source.coords[j] = pointarray + j;
+        }
+        source.stride = 3;
+        *num_points = mxGetN(points);
+        return source;
+    }
+
+    if (mxGetNumberOfElements(points) != 3){
+        mexErrMsgIdAndTxt(error_id, "Points must be 3xN doubles, or a cell of x, y and z");
+    }
+    for (int j = 0; j < 3; j++){
+        const mxArray* column = mxGetCell(points, j);
+        if (column == NULL || !mxIsDouble(column) || mxIsComplex(column) ||
+            mxGetNumberOfElements(column) != mxGetNumberOfElements(mxGetCell(points, 0))){
+            mexErrMsgIdAndTxt(error_id, "x, y and z must be double vectors of the same length");
+        }
+        source.coords[j] = mxGetDoubles(column);
+    }
+    source.stride = 1;
+    *num_points = mxGetNumberOfElements(mxGetCell(points, 0));
+    return source;
+}
+#endif
+
+
+/*
+    Creates a node, does using the passed heap
+*/
+octnode* create_node(vec3 midpoint, mocttree* tree){
+    // Allocate a node and fill it with zeros
+    // Already zero filled (nice!)
+    octnode* new_node = get_free_node(tree);
+
+    new_node->midpoint = midpoint;
+    return new_node;
+}
+
+
+/*
+    Ensures every coordinate in point1 is < point2
+*/
+void fix_points(vec3* point1, vec3* point2){
+    double temp;
+    for (int i = 0; i < 3; i++){
+        if(point2->pos[i] < point1->pos[i]){
+            temp = point2->pos[i];
+            point2->pos[i] = point1->pos[i];
+            point1->pos[i] = temp;
+        }
+    }
+}
+
+
+/*
+    Sets the grid compact items are stored on
+    Points are (step*k + origin) - shift for 32 bit signed k, so the scale factors and
+    offsets of a las file (and the offsets again if they were taken off the points)
+    store every point read from it exactly, see grid_holds
+
+    If exact, points that aren't on the grid can't be appended rather than being rounded
+*/
+void set_grid(mocttree* tree, vec3 grid_step, vec3 grid_origin, vec3 grid_shift, bool exact){
+    tree->grid_exact = exact;
+    for (int i = 0; i < 3; i++){
+        double step = grid_step.pos[i];
+        // A flat tree still needs a usable step
+        if (!(step > 0.)) step = 1.;
+
+        tree->grid_step.pos[i] = step;
+        tree->grid_origin.pos[i] = grid_origin.pos[i];
+        tree->grid_shift.pos[i] = grid_shift.pos[i];
+    }
+}
+
+
+/*
+    Creates the base of the tree
+*/
+mocttree* create_tree(vec3 point1, vec3 point2){
+    // Note: No special requirements on point1 or point2
+
+    // The tree itself is stored under the moct allocator (see moctalloc.h)
+    mocttree* new_tree = moct_calloc(1, sizeof(mocttree));
+    moct_persist(new_tree);
+
+    new_tree->space_chunks = 0;
+    new_tree->index_chunks = 0;
+    new_tree->index_single = 0;
+    new_tree->free_node = NULL;
+    new_tree->memory_chunks = NULL;
+
+    fix_points(&point1, &point2);
+    new_tree->point1 = point1;
+    new_tree->point2 = point2;
+    new_tree->num_elements = 0;
+    new_tree->root = create_node(vec3_midpoint(point1, point2), new_tree);
+
+    // Default grid, from the middle of the tree out to twice its width each way, so it
+    // can grow to hold appended points up to 1.5 times its width outside it (the points
+    // are rounded to it, createfreemoct always sets the las grid instead)
+    vec3 grid_step;
+    vec3 zero = {{0., 0., 0.}};
+    for (int i = 0; i < 3; i++){
+        grid_step.pos[i] = (point2.pos[i] - point1.pos[i])/(GRID_BIAS/2.);
+    }
+    set_grid(new_tree, grid_step, vec3_midpoint(point1, point2), zero, false);
+    return new_tree;
+}
+
+
+/*
+    Adds an item to a node at MOCT_MAX_DEPTH with a full bucket
+    The first time the bucket moves to the start of a new overflow array
+*/
+void overflow_add(octnode* node, item new_item){
+    if (node->num_elements == MOCT_BUCKET){
+        size_t space = 4*MOCT_BUCKET;
+        item* items = moct_malloc(space*sizeof(item));
+        moct_persist(items);
+        // The bucket shares its memory with the overflow, so it is copied out first
+        memcpy(items, node->bucket, MOCT_BUCKET*sizeof(item));
+        node->overflow.items = items;
+        node->overflow.space = space;
+    } else if (node->num_elements == node->overflow.space){
+        // Expand by 1.5*s + 4
+        node->overflow.space = (node->overflow.space*3)/2 + 4;
+        node->overflow.items = moct_realloc(node->overflow.items, node->overflow.space*sizeof(item));
+        moct_persist(node->overflow.items);
+    }
+    node->overflow.items[node->num_elements++] = new_item;
+}
+
+
+/*
+    Insert into a node
+    point is where new_item is, see item_point
+    depth is the level of node, the root is 0
+    Requirements:
+    All coordinates in point1 < node.midpoint < point2
+
+*/
+void insert_node(item new_item, vec3 point, octnode* node, vec3 point1, vec3 point2, int depth, mocttree* tree){
+    node->num_total_elements++;
+    if (node->num_elements < MOCT_BUCKET){
+        node->bucket[node->num_elements++] = new_item;
+        return;
+    }
+
+    // Too deep to split, the node's items just keep growing
+    if (depth >= MOCT_MAX_DEPTH){
+        overflow_add(node, new_item);
+        return;
+    }
+
+    int which_child = 0;
+    // X Y Z indexing
+    // if X > midpoint X then +1
+    // if Y > midpoint Y then +2
+    // if Z > midpoint Z then +4
+    for (int i = 0; i < 3; i++){
+        if (point.pos[i] > node->midpoint.pos[i]){
+            which_child += (1<<i);
+            point1.pos[i] = node->midpoint.pos[i];
+        } else {
+            point2.pos[i] = node->midpoint.pos[i];
+        }
+    }
+
+    // Create the child should it not exist
+    if (node->children[which_child] == NULL){
+        node->children[which_child] = create_node(vec3_midpoint(point1, point2), tree);
+    }
+    
+    // Insert it into the appropriate child
+    // point1 and point2 were adjusted to be correct
+    insert_node(new_item, point, node->children[which_child], point1, point2, depth+1, tree);
+}
+
+
+/*
+    Insert into a tree
+*/
+bool insert_tree(mocttree* tree, vec3 point){
+
+    item new_item = make_item(tree, ++(tree->num_elements), point);
+
+    // Compact items are placed by where they are stored, not where they came from
+    point = item_point(tree, &new_item);
+
+    // Ensure its inside the tree
+    for (int i = 0; i < 3; i++){
+        if(point.pos[i] < tree->point1.pos[i] || point.pos[i] > tree->point2.pos[i]) return false;
+    } // Note, createfreemoct sizes the tree to its points so this is always true, append_tree grows it instead
+
+    insert_node(new_item, point, tree->root, tree->point1, tree->point2, 0, tree);
+    return true;
+}
+
+
+/*
+    ------------------- Incremental code ---------------------
+*/
+
+
+/*
+    Remembers the points with indexes [first, first + count) as a batch of source_id,
+    low and high must bound all of them (see drop_source)
+*/
+void record_batch(mocttree* tree, uint32_t source_id, size_t first, size_t count, vec3 low, vec3 high){
+    tree->batches = moct_realloc(tree->batches, (tree->num_batches + 1)*sizeof(tree_batch));
+    moct_persist(tree->batches);
+
+    tree_batch* batch = &tree->batches[tree->num_batches++];
+    batch->source_id = source_id;
+    batch->first = first;
+    batch->count = count;
+    batch->low = low;
+    batch->high = high;
+}
+
+
+/*
+    True if point can be stored in the tree once it has grown around it
+    Points must be finite, and compact items must still reach the point from the grid
+    origin, which stays where it is (and be on the grid if it is exact)
+*/
+bool tree_can_hold(const mocttree* tree, vec3 point){
+    for (int i = 0; i < 3; i++){
+        if (!isfinite(point.pos[i])) return false;
+#ifdef MOCT_COMPACT
+        double step = floor(((point.pos[i] + tree->grid_shift.pos[i]) - tree->grid_origin.pos[i])/tree->grid_step.pos[i] + 0.5);
+        if (!(step >= -GRID_BIAS) || step > GRID_BIAS - 1.) return false;
+        if (tree->grid_exact && grid_coord(tree, i, grid_nearest(tree, i, point.pos[i])) != point.pos[i]) return false;
+#else
+        (void)tree;
+#endif
+    }
+    return true;
+}
+
+
+/*
+    Doubles the tree until point is inside it
+    Each time a new root is made with the old one as one of its octants, so nothing
+    already in the tree moves. The new root is split exactly at the corner of the old
+    one, which is only its midpoint up to rounding, so the walks split pointer trees at
+    node midpoints (octnode_child_box)
+
+    Requirements:
+    tree_can_hold(tree, point)
+*/
+void grow_tree(mocttree* tree, vec3 point){
+    for (;;){
+        bool inside = true;
+        for (int i = 0; i < 3; i++){
+            if (point.pos[i] < tree->point1.pos[i] || point.pos[i] > tree->point2.pos[i]) inside = false;
+        }
+        if (inside) return;
+
+        vec3 midpoint;
+        int which_child = 0;
+        for (int i = 0; i < 3; i++){
+            double low = tree->point1.pos[i];
+            double high = tree->point2.pos[i];
+            double width = high - low;
+            // A flat tree has nothing to double
+            if (!(width > 0.)) width = fmax(fabs(point.pos[i] - low), 1.);
+
+            // Towards the point, the old root is the other half
+            if (2.*point.pos[i] > low + high){
+                midpoint.pos[i] = high;
+                tree->point2.pos[i] = high + width;
+            } else {
+                midpoint.pos[i] = low;
+                tree->point1.pos[i] = low - width;
+                which_child += (1<<i);
+            }
+        }
+
+        octnode* root = create_node(midpoint, tree);
+        root->num_total_elements = tree->root->num_total_elements;
+        root->children[which_child] = tree->root;
+        tree->root = root;
+    }
+}
+
+
+/*
+    Adds num_points more points to a tree that is already built, in time proportional
+    to num_points (and the depth of the tree), the tree grows to hold any outside it
+    (compact trees only as far as their grid reaches, see create_tree)
+    They are numbered after every point the tree was given before, dropped ones too,
+    so their indexes are into all the points given in order
+
+    Returns how many were added, points that can't be held (see tree_can_hold) are not
+*/
+size_t append_tree(mocttree* tree, uint32_t source_id, const point_source* source, size_t num_points){
+    size_t first = tree->num_elements + 1;
+    vec3 low = {{INFINITY, INFINITY, INFINITY}};
+    vec3 high = {{-INFINITY, -INFINITY, -INFINITY}};
+
+    size_t added = 0;
+    for (size_t i = 0; i < num_points; i++){
+        vec3 point = source_point(source, i);
+        size_t index = ++(tree->num_elements);
+        if (!tree_can_hold(tree, point)) continue;
+
+        grow_tree(tree, point);
+        item new_item = make_item(tree, index, point);
+        point = item_point(tree, &new_item);
+        // Compact items may snap just outside
+        grow_tree(tree, point);
+        insert_node(new_item, point, tree->root, tree->point1, tree->point2, 0, tree);
+        added++;
+
+        for (int j = 0; j < 3; j++){
+            low.pos[j] = fmin(low.pos[j], point.pos[j]);
+            high.pos[j] = fmax(high.pos[j], point.pos[j]);
+        }
+    }
+
+    record_batch(tree, source_id, first, num_points, low, high);
+    return added;
+}
+
+
+/*
+    Removes the items of node (recursively) with indexes in [first, last] that are in the
+    box low high, returns how many
+    Children left empty are unlinked, their memory stays with the tree until it is freed
+*/
+size_t drop_node(mocttree* tree, octnode* node, vec3 point1, vec3 point2, vec3 low, vec3 high,
+                 size_t first, size_t last){
+    if (node->num_total_elements == 0) return 0;
+    for (int i = 0; i < 3; i++){
+        if (high.pos[i] < point1.pos[i] || low.pos[i] > point2.pos[i]) return 0;
+    }
+
+    uint32_t num_elements = node->num_elements;
+    item* items = node_items(node);
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < num_elements; i++){
+        if (items[i].index < first || items[i].index > last) items[kept++] = items[i];
+    }
+    // Back into the bucket once it fits, the bucket shares its memory with the overflow
+    if (num_elements > MOCT_BUCKET && kept <= MOCT_BUCKET){
+        memcpy(node->bucket, items, kept*sizeof(item));
+        moct_free(items);
+    }
+    node->num_elements = kept;
+    size_t dropped = num_elements - kept;
+
+    for (int i = 0; i < 8; i++){
+        if (node->children[i] != NULL){
+            vec3 temp1;
+            vec3 temp2;
+            octnode_child_box(node, i, point1, point2, &temp1, &temp2);
+            dropped += drop_node(tree, node->children[i], temp1, temp2, low, high, first, last);
+            if (node->children[i]->num_total_elements == 0) node->children[i] = NULL;
+        }
+    }
+
+    node->num_total_elements -= (uint32_t)dropped;
+    return dropped;
+}
+
+
+/*
+    Removes every point added with source_id (see append_tree and record_batch)
+    Only the part of the tree around each batch is visited, the other points keep
+    their indexes
+
+    Returns how many were removed
+*/
+size_t drop_source(mocttree* tree, uint32_t source_id){
+    size_t dropped = 0;
+    size_t kept = 0;
+    for (size_t b = 0; b < tree->num_batches; b++){
+        tree_batch batch = tree->batches[b];
+        if (batch.source_id != source_id){
+            tree->batches[kept++] = batch;
+            continue;
+        }
+        if (batch.count > 0){
+            dropped += drop_node(tree, tree->root, tree->point1, tree->point2, batch.low, batch.high,
+                                 batch.first, batch.first + batch.count - 1);
+        }
+    }
+    tree->num_batches = kept;
+    return dropped;
+}
+
+
+/*
+    ------------------- Bulk construction code ---------------------
+*/
+
+// Levels of the octree encoded in a morton key, 3 bits each
+# define MORTON_LEVELS 21
+
+
+/*
+    Halves [low, high] around its midpoint and keeps the half pos is in
+    Returns 1 for the upper half, same rule as insert_node (pos > midpoint)
+*/
+static inline int split_axis(double pos, double* low, double* high){
+    // Written without branches, which side a point is on is a coin toss
+    double mid = (*low + *high)/2;
+    int above = pos > mid;
+    *low = above ? mid : *low;
+    *high = above ? *high : mid;
+    return above;
+}
+
+
+/*
+    Morton key of a point
+    Walks the same midpoints insert_node would, so a point always lands in the
+    exact same octant it would have been inserted into
+*/
+uint64_t morton_key(vec3 point, vec3 point1, vec3 point2){
+    // Kept as scalars so they stay in registers
+    double x1 = point1.pos[0], y1 = point1.pos[1], z1 = point1.pos[2];
+    double x2 = point2.pos[0], y2 = point2.pos[1], z2 = point2.pos[2];
+
+    uint64_t key = 0;
+    for (int level = 0; level < MORTON_LEVELS; level++){
+        // X Y Z indexing
+        int which_child = split_axis(point.pos[0], &x1, &x2);
+        which_child |= split_axis(point.pos[1], &y1, &y2)<<1;
+        which_child |= split_axis(point.pos[2], &z1, &z2)<<2;
+        key = (key<<3) | which_child;
+    }
+    return key;
+}
+
+
+/*
+    The item for the point at index (0 based) of source
+*/
+static inline item bulk_item(mocttree* tree, const point_source* source, uint32_t index){
+    return make_item(tree, (size_t)index + 1, source_point(source, index));
+}
+
+
+/*
+    A subtree bulk_tree leaves to be filled later, on any thread
+    Its nodes come from the run of nodes first_node to first_node + num_nodes - 1, in the
+    order they were given out by get_free_node (see tree_node_at)
+*/
+typedef struct bulk_job{
+    octnode* node;
+    size_t lo;
+    size_t hi;
+    int level;
+    vec3 point1;
+    vec3 point2;
+    size_t first_node;
+    size_t num_nodes;   // SIZE_MAX if it has to be filled on the main thread
+} bulk_job;
+
+
+/*
+    The subtrees bulk_node leaves as jobs, and those small enough to be one
+*/
+typedef struct bulk_jobs{
+    bulk_job* jobs;
+    size_t num_jobs;
+    size_t space;
+    size_t job_points;
+} bulk_jobs;
+
+
+/*
+    The k-th node get_free_node gave out (0 based)
+*/
+static inline octnode* tree_node_at(const mocttree* tree, size_t k){
+    return chunk_nodes(tree->memory_chunks[k/BLOCK_SIZE]) + k%BLOCK_SIZE;
+}
+
+
+/*
+    How many nodes bulk_node makes under a node of the points in sorted[lo, hi), or
+    SIZE_MAX if it would insert some one at a time (which can make nodes and overflow
+    as it goes), see bulk_node
+*/
+size_t bulk_count(const uint64_t* keys, size_t lo, size_t hi, int level){
+    if (hi - lo <= MOCT_BUCKET) return 0;
+    if (level == MORTON_LEVELS || level >= MOCT_MAX_DEPTH) return SIZE_MAX;
+
+    int shift = 3*(MORTON_LEVELS - 1 - level);
+    size_t count = 0;
+    size_t start = lo + MOCT_BUCKET;
+    while (start < hi){
+        int which_child = (keys[start]>>shift)&7;
+        size_t end = start + 1;
+        while (end < hi && ((keys[end]>>shift)&7) == which_child) end++;
+
+        size_t below = bulk_count(keys, start, end, level+1);
+        if (below == SIZE_MAX) return SIZE_MAX;
+        count += 1 + below;
+        start = end;
+    }
+    return count;
+}
+
+
+/*
+    Fills node with the points in sorted[lo, hi), level is the depth of node
+    With jobs, children of at most jobs->job_points points are made but left empty as
+    jobs. With next_node, nodes are taken from the run of nodes given out before (see
+    bulk_job) instead of made, so any thread can fill a job
+    Requirements:
+    All coordinates in point1 < node.midpoint < point2
+    The keys in [lo, hi) all share their first level digits (3 bits per level)
+    Not both jobs and next_node
+*/
+void bulk_node(octnode* node, uint64_t* keys, uint32_t* index, size_t lo, size_t hi, int level,
+               vec3 point1, vec3 point2, const point_source* source, mocttree* tree,
+               bulk_jobs* jobs, size_t* next_node){
+    // Small enough to be a leaf
+    if (hi - lo <= MOCT_BUCKET){
+        node->num_total_elements = (uint32_t)(hi - lo);
+        for (size_t i = lo; i < hi; i++){
+            node->bucket[node->num_elements++] = bulk_item(tree, source, index[i]);
+        }
+        return;
+    }
+
+    // The keys ran out (lots of duplicate points), or the node is as deep as it goes,
+    // insert the rest one at a time
+    if (level == MORTON_LEVELS || level >= MOCT_MAX_DEPTH){
+        for (size_t i = lo; i < hi; i++){
+            item new_item = bulk_item(tree, source, index[i]);
+            insert_node(new_item, item_point(tree, &new_item), node, point1, point2, level, tree);
+        }
+        return;
+    }
+
+    node->num_total_elements = (uint32_t)(hi - lo);
+
+    // Like insert_node the bucket is filled before any children are made,
+    // the rest are still sorted so the children are consecutive runs of the next digit
+    for (size_t i = lo; i < lo + MOCT_BUCKET; i++){
+        node->bucket[node->num_elements++] = bulk_item(tree, source, index[i]);
+    }
+
+    int shift = 3*(MORTON_LEVELS - 1 - level);
+    size_t start = lo + MOCT_BUCKET;
+    while (start < hi){
+        int which_child = (keys[start]>>shift)&7;
+        size_t end = start + 1;
+        while (end < hi && ((keys[end]>>shift)&7) == which_child) end++;
+
+        // X Y Z reverse indexing
+        vec3 temp1;
+        vec3 temp2;
+        for (int j = 0; j < 3; j++){
+            if (which_child&(1<<j)){
+                temp1.pos[j] = node->midpoint.pos[j];
+                temp2.pos[j] = point2.pos[j];
+            } else {
+                temp1.pos[j] = point1.pos[j];
+                temp2.pos[j] = node->midpoint.pos[j];
+            }
+        }
+
+        octnode* child;
+        if (next_node != NULL){
+            child = tree_node_at(tree, (*next_node)++);
+            child->midpoint = vec3_midpoint(temp1, temp2);
+        } else {
+            child = create_node(vec3_midpoint(temp1, temp2), tree);
+        }
+        node->children[which_child] = child;
+
+        if (jobs != NULL && end - start <= jobs->job_points){
+            if (jobs->num_jobs == jobs->space){
+                jobs->space = (jobs->space*3)/2 + 4;
+                jobs->jobs = moct_realloc(jobs->jobs, jobs->space*sizeof(bulk_job));
+            }
+            bulk_job job = {child, start, end, level+1, temp1, temp2, 0, 0};
+            jobs->jobs[jobs->num_jobs++] = job;
+        } else {
+            bulk_node(child, keys, index, start, end, level+1, temp1, temp2, source, tree, jobs, next_node);
+        }
+        start = end;
+    }
+}
+
+
+/*
+    Fills an empty tree at once
+    Morton keys are computed and sorted in parallel, then the nodes are made in a
+    single pass over the sorted points. The top of the tree is made first, the subtrees
+    below it are counted, given their nodes, and filled in parallel (nodes and overflow
+    can only be allocated on the main thread, see moctalloc.h)
+
+    Gives the same query results as inserting every point with insert_tree,
+    the point indexes are the same too
+*/
+void bulk_tree(mocttree* tree, const point_source* source, size_t num_points){
+    vec3 point1 = tree->point1;
+    vec3 point2 = tree->point2;
+
+    uint64_t* keys = moct_malloc(2*num_points*sizeof(uint64_t) + 1);
+    uint32_t* index = moct_malloc(2*num_points*sizeof(uint32_t) + 1);
+
+    // Points outside the tree are dropped, the same as insert_tree
+    size_t num_inside = 0;
+    for (size_t i = 0; i < num_points; i++){
+        item new_item = bulk_item(tree, source, (uint32_t)i);
+        vec3 point = item_point(tree, &new_item);
+        bool inside = true;
+        for (int j = 0; j < 3; j++){
+            if (point.pos[j] < point1.pos[j] || point.pos[j] > point2.pos[j]) inside = false;
+        }
+        if (inside) index[num_inside++] = (uint32_t)i;
+    }
+
+    ptrdiff_t i;
+    #pragma omp parallel for schedule(static)
+    for (i = 0; i < (ptrdiff_t)num_inside; i++){
+        item new_item = bulk_item(tree, source, index[i]);
+        keys[i] = morton_key(item_point(tree, &new_item), point1, point2);
+    }
+
+    radix_sort_keys(keys, index, keys + num_points, index + num_points, num_inside);
+
+    // Enough jobs to keep every thread busy, but none so small they aren't worth it
+    bulk_jobs jobs = {NULL, 0, 0, 0};
+    int num_threads = omp_get_max_threads();
+    jobs.job_points = num_inside/(16*(size_t)num_threads);
+    if (jobs.job_points < 4096) jobs.job_points = 4096;
+    bulk_node(tree->root, keys, index, 0, num_inside, 0, point1, point2, source, tree,
+              num_threads > 1 ? &jobs : NULL, NULL);
+
+    ptrdiff_t j;
+    #pragma omp parallel for schedule(dynamic)
+    for (j = 0; j < (ptrdiff_t)jobs.num_jobs; j++){
+        bulk_job* job = &jobs.jobs[j];
+        job->num_nodes = bulk_count(keys, job->lo, job->hi, job->level);
+    }
+
+    // The nodes of each job, in one run
+    for (size_t k = 0; k < jobs.num_jobs; k++){
+        bulk_job* job = &jobs.jobs[k];
+        if (job->num_nodes == SIZE_MAX) continue;
+        job->first_node = tree->index_chunks*BLOCK_SIZE + tree->index_single;
+        for (size_t n = 0; n < job->num_nodes; n++) get_free_node(tree);
+    }
+
+    #pragma omp parallel for schedule(dynamic)
+    for (j = 0; j < (ptrdiff_t)jobs.num_jobs; j++){
+        bulk_job* job = &jobs.jobs[j];
+        if (job->num_nodes == SIZE_MAX) continue;
+        size_t next_node = job->first_node;
+        bulk_node(job->node, keys, index, job->lo, job->hi, job->level, job->point1, job->point2,
+                  source, tree, NULL, &next_node);
+    }
+
+    // Those that insert points one at a time
+    for (size_t k = 0; k < jobs.num_jobs; k++){
+        bulk_job* job = &jobs.jobs[k];
+        if (job->num_nodes != SIZE_MAX) continue;
+        bulk_node(job->node, keys, index, job->lo, job->hi, job->level, job->point1, job->point2,
+                  source, tree, NULL, NULL);
+    }
+    if (jobs.jobs != NULL) moct_free(jobs.jobs);
+    tree->num_elements = num_points;
+
+    moct_free(keys);
+    moct_free(index);
+}
+
+
+/*
+    ------------------- Linear construction code ---------------------
+*/
+
+
+/*
+    The nodes of a linear tree while they are made, they are copied into the tree at the end
+*/
+typedef struct linear_build{
+    linnode* nodes;
+    size_t num_nodes;
+    size_t space;
+    uint64_t* keys;     // Sorted morton keys of the points
+} linear_build;
+
+
+/*
+    Adds count zeroed nodes (siblings) and returns the index of the first one
+    The nodes may move, so hold on to indexes and not pointers
+*/
+uint32_t linear_new_nodes(linear_build* build, int count){
+    if (build->num_nodes + count > build->space){
+        while (build->num_nodes + count > build->space){
+            // Expand by 1.5*s + 4
+            build->space = (build->space*3)/2 + 4;
+        }
+        build->nodes = moct_realloc(build->nodes, build->space*sizeof(linnode));
+    }
+
+    uint32_t first = (uint32_t)build->num_nodes;
+    memset(build->nodes + first, 0, count*sizeof(linnode));
+    build->num_nodes += count;
+    return first;
+}
+
+
+/*
+    Makes node_id cover the sorted points [lo, hi), level is the depth of the node
+    Requirements:
+    The keys in [lo, hi) all share their first level digits (3 bits per level)
+*/
+void linear_node(linear_build* build, uint32_t node_id, size_t lo, size_t hi, int level){
+    build->nodes[node_id].first = (uint32_t)lo;
+    build->nodes[node_id].count = (uint32_t)(hi - lo);
+
+    // Small enough to be a leaf, or the keys ran out (lots of duplicate points),
+    // or it is as deep as a node goes (see MOCT_MAX_DEPTH)
+    if (hi - lo <= LINEAR_LEAF || level == MORTON_LEVELS || level >= MOCT_MAX_DEPTH) return;
+
+    // The children are the runs of the next digit
+    int octants[8];
+    size_t starts[9];
+    int num_children = 0;
+    int shift = 3*(MORTON_LEVELS - 1 - level);
+    size_t start = lo;
+    while (start < hi){
+        int which_child = (build->keys[start]>>shift)&7;
+        octants[num_children] = which_child;
+        starts[num_children++] = start;
+        while (start < hi && ((build->keys[start]>>shift)&7) == which_child) start++;
+    }
+    starts[num_children] = hi;
+
+    uint32_t first_child = linear_new_nodes(build, num_children);
+    build->nodes[node_id].first_child = first_child;
+    for (int i = 0; i < num_children; i++){
+        build->nodes[node_id].child_mask |= 1<<octants[i];
+    }
+
+    for (int i = 0; i < num_children; i++){
+        linear_node(build, first_child + i, starts[i], starts[i+1], level+1);
+    }
+}
+
+
+/*
+    Fills the tight box of every node of a linear tree (see linbox)
+    The leaves are made from their points, then the rest from their children, which
+    always come after their parent
+*/
+void linear_boxes_fill(linoctree* tree){
+    linnode* nodes = linear_nodes(tree);
+    linbox* boxes = linear_boxes(tree);
+
+    ptrdiff_t i;
+    #pragma omp parallel for schedule(dynamic, 256)
+    for (i = 0; i < (ptrdiff_t)tree->num_nodes; i++){
+        if (nodes[i].child_mask != 0) continue;
+        for (int j = 0; j < 3; j++){
+            double* coords = linear_coords(tree, j);
+            double low = INFINITY;
+            double high = -INFINITY;
+            for (size_t k = nodes[i].first; k < (size_t)nodes[i].first + nodes[i].count; k++){
+                if (coords[k] < low) low = coords[k];
+                if (coords[k] > high) high = coords[k];
+            }
+            boxes[i].low.pos[j] = low;
+            boxes[i].high.pos[j] = high;
+        }
+    }
+
+    for (i = (ptrdiff_t)tree->num_nodes - 1; i >= 0; i--){
+        if (nodes[i].child_mask == 0) continue;
+        int num_children = 0;
+        for (int k = 0; k < 8; k++){
+            if (nodes[i].child_mask&(1<<k)) num_children++;
+        }
+        boxes[i] = boxes[nodes[i].first_child];
+        for (int k = 1; k < num_children; k++){
+            linbox* child = &boxes[nodes[i].first_child + k];
+            for (int j = 0; j < 3; j++){
+                if (child->low.pos[j] < boxes[i].low.pos[j]) boxes[i].low.pos[j] = child->low.pos[j];
+                if (child->high.pos[j] > boxes[i].high.pos[j]) boxes[i].high.pos[j] = child->high.pos[j];
+            }
+        }
+    }
+
+    // Only the root of a tree without points is empty, it keeps the corners of the tree
+    if (tree->num_points == 0){
+        boxes[0].low = tree->point1;
+        boxes[0].high = tree->point2;
+    }
+}
+
+
+/*
+    Builds a linear tree, the points are sorted the same way as bulk_tree
+    The tree is a single buffer, moct_free it to free it all (or moct_free_tree)
+    With boxes it also keeps the tight box of every node (48 bytes a node, see linbox)
+
+    Gives the same query results as a mocttree of the same points, with or without boxes
+*/
+linoctree* linear_tree(vec3 point1, vec3 point2, const point_source* source, size_t num_points, bool boxes){
+    fix_points(&point1, &point2);
+
+    uint64_t* keys = moct_malloc(2*num_points*sizeof(uint64_t) + 1);
+    uint32_t* index = moct_malloc(2*num_points*sizeof(uint32_t) + 1);
+
+    // Points outside the tree are dropped, the same as insert_tree
+    size_t num_inside = 0;
+    for (size_t i = 0; i < num_points; i++){
+        vec3 point = source_point(source, i);
+        bool inside = true;
+        for (int j = 0; j < 3; j++){
+            if (point.pos[j] < point1.pos[j] || point.pos[j] > point2.pos[j]) inside = false;
+        }
+        if (inside) index[num_inside++] = (uint32_t)i;
+    }
+
+    ptrdiff_t i;
+    #pragma omp parallel for schedule(static)
+    for (i = 0; i < (ptrdiff_t)num_inside; i++){
+        keys[i] = morton_key(source_point(source, index[i]), point1, point2);
+    }
+
+    radix_sort_keys(keys, index, keys + num_points, index + num_points, num_inside);
+
+    linear_build build;
+    build.nodes = NULL;
+    build.num_nodes = 0;
+    build.space = 0;
+    build.keys = keys;
+    linear_new_nodes(&build, 1);
+    linear_node(&build, 0, 0, num_inside, 0);
+
+    // Lay out the buffer
+    size_t offset = linear_align(sizeof(linoctree));
+    size_t nodes_offset = offset;
+    offset = linear_align(offset + build.num_nodes*sizeof(linnode));
+    size_t coords_offset[3];
+    for (int j = 0; j < 3; j++){
+        coords_offset[j] = offset;
+        offset = linear_align(offset + num_inside*sizeof(double));
+    }
+    size_t index_offset = offset;
+    offset = linear_align(offset + num_inside*sizeof(uint64_t));
+    size_t boxes_offset = 0;
+    if (boxes){
+        boxes_offset = offset;
+        offset = linear_align(offset + build.num_nodes*sizeof(linbox));
+    }
+
+    linoctree* tree = moct_calloc(offset, 1);
+    moct_persist(tree);
+    tree->kind = MOCT_LINEAR;
+    tree->point1 = point1;
+    tree->point2 = point2;
+    tree->num_elements = num_points;
+    tree->num_points = num_inside;
+    tree->num_nodes = build.num_nodes;
+    tree->bytes = offset;
+    tree->nodes_offset = nodes_offset;
+    for (int j = 0; j < 3; j++){
+        tree->coords_offset[j] = coords_offset[j];
+    }
+    tree->index_offset = index_offset;
+    tree->boxes_offset = boxes_offset;
+
+    memcpy(linear_nodes(tree), build.nodes, build.num_nodes*sizeof(linnode));
+    moct_free(build.nodes);
+
+    double* x = linear_coords(tree, 0);
+    double* y = linear_coords(tree, 1);
+    double* z = linear_coords(tree, 2);
+    uint64_t* tree_index = linear_index(tree);
+
+    #pragma omp parallel for schedule(static)
+    for (i = 0; i < (ptrdiff_t)num_inside; i++){
+        vec3 point = source_point(source, index[i]);
+        x[i] = point.pos[0];
+        y[i] = point.pos[1];
+        z[i] = point.pos[2];
+        tree_index[i] = (uint64_t)index[i] + 1;
+    }
+
+    if (boxes) linear_boxes_fill(tree);
+
+    moct_free(keys);
+    moct_free(index);
+    return tree;
+}
+
+
+/*
+    Frees a tree of either kind, made by any of the above
+*/
+void moct_free_tree(void* tree){
+    if (tree_kind(tree) == MOCT_LINEAR){
+        // Linear trees are a single buffer
+        moct_free(tree);
+    } else {
+        free_memory((mocttree*)tree);
+    }
+}
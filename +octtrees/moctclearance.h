@@ -0,0 +1,373 @@
+/*
+    Clearance queries
+    Instead of returning the points inside a region these reduce them on the fly
+    to the one number the clearance scripts want (lowest z, or closest distance)
+*/
+
+#pragma once
+#include <math.h>
+#include "moctsimd.h"
+
+
+/*
+    What is measured for every point inside the region
+*/
+typedef enum clearance_mode{
+    CLEARANCE_LOWEST_Z = 0,     // Lowest z of the points found (top clearance)
+    CLEARANCE_NEAREST = 1       // Closest distance to the observer (side clearance)
+} clearance_mode;
+
+
+// Largest k for the k-th best point of a query
+# define CLEARANCE_MAX_K 16
+
+
+/*
+    State of a single clearance query
+    Values are stored as squared distances for CLEARANCE_NEAREST
+
+    The tree is walked front to back (lowest bound first), and once min_pts points
+    have been found any box that can't hold a better point than the k-th best is skipped
+*/
+typedef struct clearance_query{
+    mocttree* tree;
+    constraint* cons;
+    clearance_mode mode;
+    vec3 observer;
+    size_t kth;         // The clearance is the k-th best point, 1 for the best
+    size_t min_pts;     // Fewer points than this is noise
+    size_t count;       // Number of points found inside the region (so far, boxes skipped aren't counted)
+    size_t found;       // Number of values in kbest
+    double best;        // k-th best value found so far, INFINITY until there are k
+    double kbest[CLEARANCE_MAX_K];  // Best values found so far, lowest first
+} clearance_query;
+
+
+/*
+    The value a point contributes to the query, lower is better
+*/
+static inline double clearance_value(clearance_query* query, vec3 point){
+    if (query->mode == CLEARANCE_LOWEST_Z) return point.pos[2];
+
+    double dist = 0.;
+    for (int i = 0; i < 3; i++){
+        double diff = point.pos[i] - query->observer.pos[i];
+        dist += diff*diff;
+    }
+    return dist;
+}
+
+
+/*
+    Lowest value any point in the box point1 point2 could have
+    Rounds the same way as clearance_value, so it is never above the value of a point inside
+*/
+static inline double clearance_box_bound(clearance_query* query, vec3 point1, vec3 point2){
+    if (query->mode == CLEARANCE_LOWEST_Z) return point1.pos[2];
+
+    double dist = 0.;
+    for (int i = 0; i < 3; i++){
+        double diff = 0.;
+        if (query->observer.pos[i] < point1.pos[i]){
+            diff = point1.pos[i] - query->observer.pos[i];
+        } else if (query->observer.pos[i] > point2.pos[i]){
+            diff = query->observer.pos[i] - point2.pos[i];
+        }
+        dist += diff*diff;
+    }
+    return dist;
+}
+
+
+/*
+    True if nothing in the box point1 point2 can change the result any more
+    Boxes are only skipped once min_pts points have been counted, so the count stays right
+*/
+static inline bool clearance_prunes(clearance_query* query, vec3 point1, vec3 point2){
+    if (query->count < query->min_pts || query->found < query->kth) return false;
+    return clearance_box_bound(query, point1, point2) >= query->best;
+}
+
+
+/*
+    Adds the value of a point inside the region
+*/
+static inline void clearance_add(clearance_query* query, double value){
+    if (!(value < query->best)) return;
+
+    // Insertion into the sorted best values, the k-th falls off the end
+    size_t i = query->found < query->kth ? query->found++ : query->kth - 1;
+    while (i > 0 && query->kbest[i-1] > value){
+        query->kbest[i] = query->kbest[i-1];
+        i--;
+    }
+    query->kbest[i] = value;
+    if (query->found == query->kth) query->best = query->kbest[query->kth - 1];
+}
+
+
+/*
+    Sets up a query with nothing found yet
+    tree is only used for a pointer tree, pass NULL for a linear tree
+
+    Requirements:
+    1 <= kth <= CLEARANCE_MAX_K
+*/
+static inline void clearance_start(clearance_query* query, constraint* cons, mocttree* tree, clearance_mode mode,
+                                   vec3 observer, size_t kth, size_t min_pts){
+    query->tree = tree;
+    query->cons = cons;
+    query->mode = mode;
+    query->observer = observer;
+    query->kth = kth;
+    query->min_pts = min_pts;
+    query->count = 0;
+    query->found = 0;
+    query->best = INFINITY;
+}
+
+
+/*
+    The clearance of a finished query, the k-th best value
+
+    Fewer than min_pts (or k) points is treated as noise, and INFINITY is returned
+    (so nothing was in the way)
+*/
+static inline double clearance_finish(clearance_query* query){
+    if (query->count < query->min_pts || query->found < query->kth) return INFINITY;
+    if (query->mode == CLEARANCE_NEAREST) return sqrt(query->best);
+    return query->best;
+}
+
+
+/*
+    Orders the octants in child_mask front to back, by the lower bound of their boxes
+    Fills their octants and boxes, returns how many there are
+    Pass the octnode, or for a node of a linear tree NULL, the tree and its first_child
+    (the children get their boxes from linear_child_box)
+*/
+static inline int clearance_order(clearance_query* query, unsigned child_mask, vec3 point1, vec3 point2,
+                                  const octnode* node, const linoctree* linear, uint32_t first_child,
+                                  int octants[8], vec3 child1[8], vec3 child2[8]){
+    double bounds[8];
+    int num = 0;
+    for (int i = 0; i < 8; i++){
+        if (!(child_mask&(1u<<i))) continue;
+
+        vec3 temp1;
+        vec3 temp2;
+        if (linear != NULL){
+            linear_child_box(linear, first_child + (uint32_t)mask_count(child_mask&((1u<<i) - 1)), i, point1, point2,
+                             &temp1, &temp2);
+        } else {
+            octnode_child_box(node, i, point1, point2, &temp1, &temp2);
+        }
+        double bound = clearance_box_bound(query, temp1, temp2);
+
+        // Insertion sort, there are at most 8
+        int j = num++;
+        while (j > 0 && bounds[j-1] > bound){
+            bounds[j] = bounds[j-1];
+            octants[j] = octants[j-1];
+            child1[j] = child1[j-1];
+            child2[j] = child2[j-1];
+            j--;
+        }
+        bounds[j] = bound;
+        octants[j] = i;
+        child1[j] = temp1;
+        child2[j] = temp2;
+    }
+    return num;
+}
+
+
+/*
+    Which children an octnode has, bit i for children[i]
+*/
+static inline unsigned octnode_child_mask(octnode* node){
+    unsigned child_mask = 0;
+    for (int i = 0; i < 8; i++){
+        if (node->children[i] != NULL) child_mask |= 1u<<i;
+    }
+    return child_mask;
+}
+
+
+/*
+    Everything in this node is included, so just reduce over it
+*/
+void clearance_quickly_node(clearance_query* query, octnode* node, vec3 point1, vec3 point2){
+    item* items = node_items(node);
+    for (uint32_t i = 0; i < node->num_elements; i++){
+        clearance_add(query, clearance_value(query, item_point(query->tree, &items[i])));
+    }
+
+    int octants[8];
+    vec3 child1[8];
+    vec3 child2[8];
+    int num = clearance_order(query, octnode_child_mask(node), point1, point2, node, NULL, 0, octants, child1, child2);
+    for (int i = 0; i < num; i++){
+        if (clearance_prunes(query, child1[i], child2[i])) break;
+        clearance_quickly_node(query, node->children[octants[i]], child1[i], child2[i]);
+    }
+}
+
+
+/*
+    Reduces every point satisfying the constraint in an octnode (recursively)
+
+    Requirements:
+    All coordinates in point1 < node.midpoint < point2
+*/
+void clearance_node(clearance_query* query, plane_mask active, octnode* node, vec3 point1, vec3 point2){
+    cube_side side = cube_classify(query->cons, point1, point2, &active);
+    if (side == CUBE_OUTSIDE){
+        return;
+    }
+
+    if (side == CUBE_INSIDE){
+        query->count += node->num_total_elements;
+        clearance_quickly_node(query, node, point1, point2);
+        return;
+    }
+
+    item* items = node_items(node);
+    for (uint32_t i = 0; i < node->num_elements; i++){
+        vec3 point = item_point(query->tree, &items[i]);
+        if (satisfies_active(query->cons, active, point)){
+            clearance_add(query, clearance_value(query, point));
+            query->count++;
+        }
+    }
+
+    // Children are sorted by their bound, once one is skipped so are the rest
+    int octants[8];
+    vec3 child1[8];
+    vec3 child2[8];
+    int num = clearance_order(query, octnode_child_mask(node), point1, point2, node, NULL, 0, octants, child1, child2);
+    for (int i = 0; i < num; i++){
+        if (clearance_prunes(query, child1[i], child2[i])) break;
+        clearance_node(query, active, node->children[octants[i]], child1[i], child2[i]);
+    }
+}
+
+
+/*
+    Lowest z (or closest distance to observer) of the points satisfying a constraint,
+    or the k-th lowest (closest) with kth above 1
+
+    Fewer than min_pts points is treated as noise, and INFINITY is returned
+    (so nothing was in the way)
+*/
+double clearance_tree(constraint* cons, mocttree* tree, clearance_mode mode, vec3 observer, size_t kth, size_t min_pts){
+    clearance_query query;
+    clearance_start(&query, cons, tree, mode, observer, kth, min_pts);
+    clearance_node(&query, ALL_PLANES, tree->root, tree->point1, tree->point2);
+    return clearance_finish(&query);
+}
+
+
+/*
+    Node node_id of a linear tree is fully inside, so just reduce over it
+    With boxes the lowest point of the node is known, so the lowest z is found without
+    visiting any of its points
+*/
+void clearance_linear_quickly(clearance_query* query, linoctree* tree, uint32_t node_id, vec3 point1, vec3 point2){
+    linbox* boxes = linear_boxes(tree);
+    if (boxes != NULL && query->mode == CLEARANCE_LOWEST_Z && query->kth == 1){
+        clearance_add(query, boxes[node_id].low.pos[2]);
+        return;
+    }
+
+    linnode* node = &linear_nodes(tree)[node_id];
+    if (node->child_mask == 0){
+        for (size_t i = node->first; i < node->first + node->count; i++){
+            clearance_add(query, clearance_value(query, linear_point(tree, i)));
+        }
+        return;
+    }
+
+    int octants[8];
+    vec3 child1[8];
+    vec3 child2[8];
+    int num = clearance_order(query, node->child_mask, point1, point2, NULL, tree, node->first_child, octants, child1, child2);
+    for (int i = 0; i < num; i++){
+        if (clearance_prunes(query, child1[i], child2[i])) break;
+        uint32_t child = node->first_child + (uint32_t)mask_count(node->child_mask&((1u<<octants[i]) - 1));
+        clearance_linear_quickly(query, tree, child, child1[i], child2[i]);
+    }
+}
+
+
+/*
+    Same as clearance_node for a linear tree, node_id is the index of the node
+    point1 point2 is the box of the node, see linear_child_box
+    query->tree is not used
+*/
+void clearance_linear_node(clearance_query* query, plane_mask active, linoctree* tree, uint32_t node_id, vec3 point1, vec3 point2){
+    cube_side side = cube_classify(query->cons, point1, point2, &active);
+    if (side == CUBE_OUTSIDE){
+        return;
+    }
+
+    linnode* node = &linear_nodes(tree)[node_id];
+
+    // Every point of a node fully inside counts, without visiting the children
+    if (side == CUBE_INSIDE){
+        query->count += node->count;
+        clearance_linear_quickly(query, tree, node_id, point1, point2);
+        return;
+    }
+
+    // Only leaves have points of their own, they are tested a run at a time
+    if (node->child_mask == 0){
+        size_t end = (size_t)node->first + node->count;
+        for (size_t i = node->first; i < end; i += HALFSPACE_RUN){
+            size_t run = end - i < HALFSPACE_RUN ? end - i : HALFSPACE_RUN;
+            uint64_t mask = linear_mask(query->cons, active, tree, i, run);
+            query->count += mask_count(mask);
+
+            for (size_t j = 0; mask != 0; j++, mask >>= 1){
+                if (mask&1){
+                    clearance_add(query, clearance_value(query, linear_point(tree, i + j)));
+                }
+            }
+        }
+        return;
+    }
+
+    // Children are sorted by their bound, once one is skipped so are the rest
+    int octants[8];
+    vec3 child1[8];
+    vec3 child2[8];
+    int num = clearance_order(query, node->child_mask, point1, point2, NULL, tree, node->first_child, octants, child1, child2);
+    for (int i = 0; i < num; i++){
+        if (clearance_prunes(query, child1[i], child2[i])) break;
+        uint32_t child = node->first_child + (uint32_t)mask_count(node->child_mask&((1u<<octants[i]) - 1));
+        clearance_linear_node(query, active, tree, child, child1[i], child2[i]);
+    }
+}
+
+
+/*
+    Same as clearance_tree for a linear tree
+*/
+double clearance_linear(constraint* cons, linoctree* tree, clearance_mode mode, vec3 observer, size_t kth, size_t min_pts){
+    clearance_query query;
+    clearance_start(&query, cons, NULL, mode, observer, kth, min_pts);
+    vec3 point1;
+    vec3 point2;
+    linear_root_box(tree, &point1, &point2);
+    clearance_linear_node(&query, ALL_PLANES, tree, 0, point1, point2);
+    return clearance_finish(&query);
+}
+
+
+/*
+    Either kind of tree
+*/
+double clearance_any(constraint* cons, void* tree, clearance_mode mode, vec3 observer, size_t kth, size_t min_pts){
+    if (tree_kind(tree) == MOCT_LINEAR) return clearance_linear(cons, (linoctree*)tree, mode, observer, kth, min_pts);
+    return clearance_tree(cons, (mocttree*)tree, mode, observer, kth, min_pts);
+}
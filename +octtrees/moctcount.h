@@ -0,0 +1,139 @@
+/*
+    Counting the points satisfying a constraint, for either kind of tree
+    Used by the query_count_moct* files and the benchmark (cli/bench.c)
+
+    A count can stop early once it reaches a limit (query_count_moct_par_lim), the
+    count returned is then at least the limit but not the full count. Everything a
+    count needs is passed in (the limit included), so any number of counts can run at
+    once on any threads.
+*/
+
+#pragma once
+#include "moctsimd.h"
+
+
+// The limit of a count that always runs to the end
+# define COUNT_NO_LIMIT UINT64_MAX
+
+
+/*
+    Returns the total number of points satisfying a constraint in an octnode (resursively)
+
+    Requirements:
+    All coordinates in point1 < node.midpoint < point2
+*/
+size_t query_count_node(mocttree* tree, constraint* cons, plane_mask active, octnode* node, vec3 point1, vec3 point2,
+                        uint64_t limit){
+    cube_side side = cube_classify(cons, point1, point2, &active);
+    if (side == CUBE_OUTSIDE){
+        return 0;
+    }
+
+    if (side == CUBE_INSIDE){
+        return node->num_total_elements;
+    }
+
+    size_t count = 0;
+
+    // Add any in our bucket that satisfy
+    item* items = node_items(node);
+    for (uint32_t i = 0; i < node->num_elements; i++){
+        if (satisfies_active(cons, active, item_point(tree, &items[i]))) count++;
+    }
+
+
+    // Add any in our children's bucket that satisfy
+    for (int i = 0; i < 8; i++){
+        if (node->children[i] != NULL){
+            // X Y Z reverse indexing
+            vec3 temp1;
+            vec3 temp2;
+            for (int j = 0; j < 3; j++){
+                if (i&(1<<j)){
+                    temp1.pos[j] = node->midpoint.pos[j];
+                    temp2.pos[j] = point2.pos[j];
+                } else {
+                    temp1.pos[j] = point1.pos[j];
+                    temp2.pos[j] = node->midpoint.pos[j];
+                }
+            }
+            count += query_count_node(tree, cons, active, node->children[i], temp1, temp2, limit);
+            // Breakout
+            if (count >= limit) return count;
+        }
+    }
+    return count;
+}
+
+
+/*
+    Returns the total number of points satisfying a constrain in a tree
+*/
+size_t query_count_tree(constraint* cons, mocttree* tree, uint64_t limit){
+    return query_count_node(tree, cons, ALL_PLANES, tree->root, tree->point1, tree->point2, limit);
+}
+
+
+/*
+    Same as query_count_node for a linear tree, node_id is the index of the node
+    point1 point2 is the box of the node, see linear_child_box
+*/
+size_t query_count_linear_node(linoctree* tree, constraint* cons, plane_mask active, uint32_t node_id, vec3 point1, vec3 point2,
+                               uint64_t limit){
+    cube_side side = cube_classify(cons, point1, point2, &active);
+    if (side == CUBE_OUTSIDE){
+        return 0;
+    }
+
+    linnode* node = &linear_nodes(tree)[node_id];
+    if (side == CUBE_INSIDE){
+        return node->count;
+    }
+
+    size_t count = 0;
+
+    // Only leaves have points of their own, they are tested a run at a time
+    if (node->child_mask == 0){
+        size_t end = (size_t)node->first + node->count;
+        for (size_t i = node->first; i < end; i += HALFSPACE_RUN){
+            size_t run = end - i < HALFSPACE_RUN ? end - i : HALFSPACE_RUN;
+            count += mask_count(linear_mask(cons, active, tree, i, run));
+            // Breakout, leaves are long enough to be worth it
+            if (count >= limit) return count;
+        }
+        return count;
+    }
+
+    uint32_t child = node->first_child;
+    for (int i = 0; i < 8; i++){
+        if (node->child_mask&(1<<i)){
+            vec3 temp1;
+            vec3 temp2;
+            linear_child_box(tree, child, i, point1, point2, &temp1, &temp2);
+            count += query_count_linear_node(tree, cons, active, child++, temp1, temp2, limit);
+            // Breakout
+            if (count >= limit) return count;
+        }
+    }
+    return count;
+}
+
+
+/*
+    Returns the total number of points satisfying a constrain in a linear tree
+*/
+size_t query_count_linear(constraint* cons, linoctree* tree, uint64_t limit){
+    vec3 point1;
+    vec3 point2;
+    linear_root_box(tree, &point1, &point2);
+    return query_count_linear_node(tree, cons, ALL_PLANES, 0, point1, point2, limit);
+}
+
+
+/*
+    Either kind of tree, limit is COUNT_NO_LIMIT for the full count
+*/
+size_t query_count_any(constraint* cons, void* tree, uint64_t limit){
+    if (tree_kind(tree) == MOCT_LINEAR) return query_count_linear(cons, (linoctree*)tree, limit);
+    return query_count_tree(cons, (mocttree*)tree, limit);
+}
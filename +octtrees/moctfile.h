@@ -0,0 +1,241 @@
+/*
+    Oct tree files
+    A linear tree (see moctlinear.h) is one flat buffer without pointers, so it is saved
+    as is after a small header, and mapped straight back into memory read only.
+    Mapping takes no time at all, the pages are read as the queries touch them.
+
+    A file is keyed by a hash of whatever the tree was built from, a file with
+    another key, version, or layout is stale and is never mapped.
+
+    Bump MOCT_FILE_VERSION whenever linoctree, linnode or linbox change.
+*/
+
+#pragma once
+#include <stdio.h>
+#include <string.h>
+#include "moctalloc.h"
+#include "moctlinear.h"
+
+#if defined(_WIN32)
+# define WIN32_LEAN_AND_MEAN
+# include <windows.h>
+#else
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+# define MOCT_FILE_VERSION 2
+
+// Written as a number, reads back differently on the other byte order
+# define MOCT_FILE_ENDIAN 0x01020304u
+
+
+/*
+    Start of a file, the tree follows at header_bytes
+*/
+typedef struct moct_file_header{ // 64 bytes large
+    char magic[8];          // "MOCTLIN" and a zero
+    uint32_t version;       // MOCT_FILE_VERSION
+    uint32_t header_bytes;  // Offset of the tree, keeps it aligned like linear_align
+    uint64_t key;           // Hash of what the tree was built from, see moct_hash
+    uint64_t tree_bytes;    // Size of the tree's buffer
+    uint32_t size_bytes;    // sizeof(size_t) when written, the tree is made of them
+    uint32_t endian;        // MOCT_FILE_ENDIAN when written
+    uint8_t pad[24];
+} moct_file_header;
+
+static const char moct_file_magic[8] = "MOCTLIN";
+
+
+/*
+    Mixes one word into a hash (the splitmix64 finaliser)
+*/
+static inline uint64_t moct_hash_mix(uint64_t hash, uint64_t word){
+    hash ^= word + 0x9E3779B97F4A7C15ULL + (hash<<6) + (hash>>2);
+    hash ^= hash>>30;
+    hash *= 0xBF58476D1CE4E5B9ULL;
+    hash ^= hash>>27;
+    hash *= 0x94D049BB133111EBULL;
+    hash ^= hash>>31;
+    return hash;
+}
+
+
+// Words hashed together before they are combined, fixed so the hash doesn't depend on threads
+# define MOCT_HASH_CHUNK ((size_t)1<<20)
+
+
+/*
+    Hash of an array of doubles, by their bits
+    Not cryptographic, just enough to tell the inputs of two trees apart
+*/
+uint64_t moct_hash(const double* values, size_t num_values, uint64_t seed){
+    size_t num_chunks = (num_values + MOCT_HASH_CHUNK - 1)/MOCT_HASH_CHUNK;
+    uint64_t* chunk_hash = moct_malloc(num_chunks*sizeof(uint64_t));
+
+    ptrdiff_t c;
+    #pragma omp parallel for schedule(static)
+    for (c = 0; c < (ptrdiff_t)num_chunks; c++){
+        size_t first = (size_t)c*MOCT_HASH_CHUNK;
+        size_t end = first + MOCT_HASH_CHUNK < num_values ? first + MOCT_HASH_CHUNK : num_values;
+        uint64_t hash = (uint64_t)c;
+        for (size_t i = first; i < end; i++){
+            uint64_t word;
+            memcpy(&word, values + i, sizeof(word));
+            hash = moct_hash_mix(hash, word);
+        }
+        chunk_hash[c] = hash;
+    }
+
+    uint64_t hash = moct_hash_mix(seed, (uint64_t)num_values);
+    for (size_t i = 0; i < num_chunks; i++){
+        hash = moct_hash_mix(hash, chunk_hash[i]);
+    }
+    moct_free(chunk_hash);
+    return hash;
+}
+
+
+/*
+    Replaces to with from, in one step, so no one ever sees half a file
+    Anyone who mapped to before keeps the old file until they unmap it
+*/
+static bool moct_file_replace(const char* from, const char* to){
+#if defined(_WIN32)
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(from, to) == 0;
+#endif
+}
+
+
+/*
+    Writes a linear tree to filename under key
+    Returns false if the file can't be written
+
+    The tree is written to a temporary file next to filename, then moved over it, so a
+    process that has the old file mapped is never left with pages that change or vanish
+*/
+bool moct_file_save(const linoctree* tree, const char* filename, uint64_t key){
+    moct_file_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, moct_file_magic, sizeof(header.magic));
+    header.version = MOCT_FILE_VERSION;
+    header.header_bytes = (uint32_t)linear_align(sizeof(moct_file_header));
+    header.key = key;
+    header.tree_bytes = tree->bytes;
+    header.size_bytes = sizeof(size_t);
+    header.endian = MOCT_FILE_ENDIAN;
+
+    // Unique to this process, in the same folder so the move never copies
+    char* temporary = moct_malloc(strlen(filename) + 32);
+#if defined(_WIN32)
+    sprintf(temporary, "%s.%lu.tmp", filename, (unsigned long)GetCurrentProcessId());
+#else
+    sprintf(temporary, "%s.%lu.tmp", filename, (unsigned long)getpid());
+#endif
+
+    FILE* file = fopen(temporary, "wb");
+    if (file == NULL){
+        moct_free(temporary);
+        return false;
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (size_t i = sizeof(header); i < header.header_bytes && ok; i++){
+        ok = fputc(0, file) != EOF;
+    }
+    ok = ok && fwrite(tree, 1, tree->bytes, file) == tree->bytes;
+    ok = fclose(file) == 0 && ok;
+    ok = ok && moct_file_replace(temporary, filename);
+    if (!ok) remove(temporary);
+    moct_free(temporary);
+    return ok;
+}
+
+
+/*
+    True if a mapping of file_bytes starting with header is a good tree for key
+*/
+static bool moct_file_valid(const moct_file_header* header, uint64_t file_bytes, uint64_t key){
+    if (file_bytes < sizeof(moct_file_header)) return false;
+    if (memcmp(header->magic, moct_file_magic, sizeof(header->magic)) != 0) return false;
+    if (header->version != MOCT_FILE_VERSION || header->endian != MOCT_FILE_ENDIAN) return false;
+    if (header->size_bytes != sizeof(size_t) || header->key != key) return false;
+    if (header->header_bytes != linear_align(sizeof(moct_file_header))) return false;
+    if (file_bytes != header->header_bytes + header->tree_bytes) return false;
+
+    const linoctree* tree = (const linoctree*)((const uint8_t*)header + header->header_bytes);
+    return header->tree_bytes >= sizeof(linoctree) && tree->kind == MOCT_LINEAR && tree->bytes == header->tree_bytes;
+}
+
+
+/*
+    Maps the tree in filename read only
+    Returns NULL if the file is missing, or it isn't a tree for key
+    The tree must be freed with moct_file_unmap, and never written to
+*/
+linoctree* moct_file_map(const char* filename, uint64_t key){
+    uint8_t* base = NULL;
+    uint64_t file_bytes = 0;
+
+#if defined(_WIN32)
+    // Others may delete it while it is mapped (see mocttree.saveobj), it goes once unmapped
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return NULL;
+
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0){
+        file_bytes = (uint64_t)size.QuadPart;
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping != NULL){
+            // The view keeps the mapping alive after its handle is closed
+            base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+    if (base == NULL) return NULL;
+
+    if (!moct_file_valid((moct_file_header*)base, file_bytes, key)){
+        UnmapViewOfFile(base);
+        return NULL;
+    }
+#else
+    int file = open(filename, O_RDONLY);
+    if (file < 0) return NULL;
+
+    struct stat info;
+    if (fstat(file, &info) == 0 && info.st_size > 0){
+        file_bytes = (uint64_t)info.st_size;
+        void* mapped = mmap(NULL, (size_t)file_bytes, PROT_READ, MAP_SHARED, file, 0);
+        if (mapped != MAP_FAILED) base = mapped;
+    }
+    close(file);
+    if (base == NULL) return NULL;
+
+    if (!moct_file_valid((moct_file_header*)base, file_bytes, key)){
+        munmap(base, (size_t)file_bytes);
+        return NULL;
+    }
+#endif
+
+    return (linoctree*)(base + ((moct_file_header*)base)->header_bytes);
+}
+
+
+/*
+    Unmaps a tree from moct_file_map
+*/
+void moct_file_unmap(linoctree* tree){
+    uint8_t* base = (uint8_t*)tree - linear_align(sizeof(moct_file_header));
+#if defined(_WIN32)
+    UnmapViewOfFile(base);
+#else
+    moct_file_header* header = (moct_file_header*)base;
+    munmap(base, (size_t)(header->header_bytes + header->tree_bytes));
+#endif
+}
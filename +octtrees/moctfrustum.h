@@ -0,0 +1,117 @@
+/*
+    Frustum construction for the clearance scans
+    The frusta are pyramids from an observer to a square target plane,
+    so their faces are known directly and no hull has to be computed
+*/
+
+#pragma once
+#include "moctquery.h"
+
+
+/*
+    Which way a scan target faces from its observer
+    Matches the "up", "right" and "left" of get_target_plane_corners.m
+*/
+typedef enum scan_direction{
+    SCAN_UP = 0,
+    SCAN_RIGHT = 1,
+    SCAN_LEFT = 2
+} scan_direction;
+
+
+/*
+    Point plus a scaled vector
+*/
+static inline vec3 vec3_add_scaled(vec3 point, vec3 dir, double scale){
+    vec3 ret;
+    for (int i = 0; i < 3; i++){
+        ret.pos[i] = point.pos[i] + dir.pos[i]*scale;
+    }
+    return ret;
+}
+
+
+/*
+    Corners of a scan target, same as get_target_plane_corners.m
+    The corners go around the target in order
+
+    forward and leftward are flattened onto the xy plane like the MATLAB version
+*/
+void scan_target_corners(vec3 observer, vec3 forward, vec3 leftward, double width,
+                         scan_direction dir, double max_top, double max_side, vec3 corners[4]){
+    vec3 flat_forward = {{forward.pos[0], forward.pos[1], 0.}};
+    vec3 flat_leftward = {{leftward.pos[0], leftward.pos[1], 0.}};
+    vec3 up = {{0., 0., 1.}};
+
+    // The target is twice the plane width in each direction
+    double half = width*2;
+
+    // For every corner the sign of the two in-plane axes
+    static const double sign_a[4] = {1., 1., -1., -1.};
+    static const double sign_b[4] = {1., -1., -1., 1.};
+
+    vec3 axis_a, axis_b, far_dir;
+    double far;
+    if (dir == SCAN_UP){
+        axis_a = flat_leftward;
+        axis_b = flat_forward;
+        far_dir = up;
+        far = max_top;
+    } else {
+        axis_a = flat_forward;
+        axis_b = up;
+        far_dir = flat_leftward;
+        far = dir == SCAN_LEFT ? max_side : -max_side;
+    }
+
+    for (int i = 0; i < 4; i++){
+        vec3 corner = vec3_add_scaled(observer, axis_a, sign_a[i]*half);
+        corner = vec3_add_scaled(corner, axis_b, sign_b[i]*half);
+        corners[i] = vec3_add_scaled(corner, far_dir, far);
+    }
+}
+
+
+/*
+    Fills a plane through three points, facing towards inside
+*/
+static inline void plane_through(plane3* plane, vec3 point1, vec3 point2, vec3 point3, vec3 inside){
+    plane->norm = vec3_cross(vec3_sub(point2, point1), vec3_sub(point3, point1));
+    plane->dval = vec3_dot(plane->norm, point1);
+
+    if (vec3_dot(plane->norm, inside) < plane->dval){
+        for (int i = 0; i < 3; i++){
+            plane->norm.pos[i] = -plane->norm.pos[i];
+        }
+        plane->dval = -plane->dval;
+    }
+}
+
+
+/*
+    The constraint for the pyramid with apex and a base of 4 corners (in order around the base)
+    cons must have space for 5 planes
+
+    4 sides and the base
+
+    Nothing here can fail the way a hull can, a degenerate face (zero area) just gives
+    a zero normal which every point satisfies
+*/
+void frustum_constraint(vec3 apex, const vec3 corners[4], constraint* cons){
+    // Centroid of the pyramid is inside of every face
+    vec3 inside = apex;
+    for (int i = 0; i < 4; i++){
+        for (int j = 0; j < 3; j++){
+            inside.pos[j] += corners[i].pos[j];
+        }
+    }
+    for (int j = 0; j < 3; j++){
+        inside.pos[j] /= 5;
+    }
+
+    constraint_init(cons, 5);
+    for (int i = 0; i < 4; i++){
+        plane_through(&cons->planes[i], apex, corners[i], corners[(i+1)%4], inside);
+    }
+    plane_through(&cons->planes[4], corners[0], corners[1], corners[2], inside);
+}
@@ -0,0 +1,165 @@
+/*
+    Finding the indexes of the points satisfying a constraint, for either kind of tree
+    Used by query_index_moct.c, query_index_moct_par.c and the benchmark (cli/bench.c)
+
+    The points are counted first (see moctcount.h, a box fully inside is counted without
+    visiting it), then the indexes are written into an array of exactly that size, so
+    the array is never grown or copied however many points there are.
+    Both walks make the same choices, so the fill writes exactly the count.
+*/
+
+#pragma once
+#include <string.h>
+#include "moctalloc.h"
+#include "moctcount.h"
+
+
+/*
+    Bypass slow searches and add quickly if everything is confirmed to be included
+    Assumes we have enough space
+*/
+size_t add_quickly_node(octnode* node, size_t filled, size_t* index_array){
+    size_t count = node->num_elements;
+    item* items = node_items(node);
+    for (size_t i = 0; i < count; i++){
+        index_array[filled + i] = items[i].index;
+    }
+
+    for (int i = 0; i < 8; i++){
+        if(node->children[i] != NULL){
+            count += add_quickly_node(node->children[i], filled+count, index_array);
+        }
+    }
+
+    return count;
+}
+
+
+/*
+    Writes the indexes of the points satisfying a constraint in an octnode (resursively)
+    from filled on, returns how many
+
+    Requirements:
+    All coordinates in point1 < node.midpoint < point2
+    index_array has room for all of them, see query_index_any
+*/
+size_t query_index_node(mocttree* tree, constraint* cons, plane_mask active, octnode* node, vec3 point1, vec3 point2,
+                        size_t filled, size_t* index_array){
+    cube_side side = cube_classify(cons, point1, point2, &active);
+    if (side == CUBE_OUTSIDE){
+        return 0;
+    }
+
+    if (side == CUBE_INSIDE){
+        return add_quickly_node(node, filled, index_array);
+    }
+
+    size_t count = 0;
+
+    // Add any in our bucket that satisfy
+    item* items = node_items(node);
+    for (uint32_t i = 0; i < node->num_elements; i++){
+        if (satisfies_active(cons, active, item_point(tree, &items[i]))){
+            index_array[filled+count] = items[i].index;
+            count++;
+        }
+    }
+
+    // Add any in our children's bucket that satisfy
+    for (int i = 0; i < 8; i++){
+        if (node->children[i] != NULL){
+            // X Y Z reverse indexing
+            vec3 temp1;
+            vec3 temp2;
+            for (int j = 0; j < 3; j++){
+                if (i&(1<<j)){
+                    temp1.pos[j] = node->midpoint.pos[j];
+                    temp2.pos[j] = point2.pos[j];
+                } else {
+                    temp1.pos[j] = point1.pos[j];
+                    temp2.pos[j] = node->midpoint.pos[j];
+                }
+            }
+            count += query_index_node(tree, cons, active, node->children[i], temp1, temp2, filled+count, index_array);
+        }
+    }
+    return count;
+}
+
+
+/*
+    Same as query_index_node for a linear tree, node_id is the index of the node
+    The points of a node are contiguous, so a node that is fully inside is copied at once
+*/
+size_t query_index_linear_node(linoctree* tree, constraint* cons, plane_mask active, uint32_t node_id, vec3 point1, vec3 point2,
+                               size_t filled, size_t* index_array){
+    cube_side side = cube_classify(cons, point1, point2, &active);
+    if (side == CUBE_OUTSIDE){
+        return 0;
+    }
+
+    linnode* node = &linear_nodes(tree)[node_id];
+    if (side == CUBE_INSIDE){
+        memcpy(index_array + filled, linear_index(tree) + node->first, node->count*sizeof(size_t));
+        return node->count;
+    }
+
+    size_t count = 0;
+
+    // Only leaves have points of their own, they are tested a run at a time
+    if (node->child_mask == 0){
+        uint64_t* index = linear_index(tree);
+        size_t end = (size_t)node->first + node->count;
+        for (size_t i = node->first; i < end; i += HALFSPACE_RUN){
+            size_t run = end - i < HALFSPACE_RUN ? end - i : HALFSPACE_RUN;
+            uint64_t mask = linear_mask(cons, active, tree, i, run);
+            for (size_t j = 0; mask != 0; j++, mask >>= 1){
+                if (mask&1) index_array[filled + count++] = index[i + j];
+            }
+        }
+        return count;
+    }
+
+    uint32_t child = node->first_child;
+    for (int i = 0; i < 8; i++){
+        if (node->child_mask&(1<<i)){
+            vec3 temp1;
+            vec3 temp2;
+            linear_child_box(tree, child, i, point1, point2, &temp1, &temp2);
+            count += query_index_linear_node(tree, cons, active, child++, temp1, temp2, filled+count, index_array);
+        }
+    }
+    return count;
+}
+
+
+/*
+    Writes the indexes of the points satisfying a constraint in either kind of tree,
+    returns how many
+    index_array must have room for query_count_any(cons, tree, COUNT_NO_LIMIT) of them
+*/
+size_t query_index_fill(constraint* cons, void* tree, size_t* index_array){
+    if (tree_kind(tree) == MOCT_LINEAR){
+        vec3 point1;
+        vec3 point2;
+        linear_root_box((linoctree*)tree, &point1, &point2);
+        return query_index_linear_node((linoctree*)tree, cons, ALL_PLANES, 0, point1, point2, 0, index_array);
+    }
+    mocttree* pointer = (mocttree*)tree;
+    return query_index_node(pointer, cons, ALL_PLANES, pointer->root, pointer->point1, pointer->point2, 0, index_array);
+}
+
+
+/*
+    Returns the number of points satisfying a constraint in either kind of tree
+    index_array is a return parameter which gets set to a pointer to an array of exactly
+    that many indexes
+
+    cleanup of the array is the callers responsibility (or no ones if it gets returned)
+*/
+size_t query_index_any(constraint* cons, void* tree, size_t** index_array){
+    size_t count = query_count_any(cons, tree, COUNT_NO_LIMIT);
+    *index_array = moct_malloc((count > 0 ? count : 1)*sizeof(size_t));
+    query_index_fill(cons, tree, *index_array);
+    return count;
+}
@@ -0,0 +1,320 @@
+/*
+    LAS point clouds
+    Reads the header and the few fields of the point records the clearance tool uses
+    (x, y, z, gps_time, scan_angle_rank and point_source_ID) straight from the file,
+    LAS 1.0 to 1.4 and point formats 0 to 10. Compressed (LAZ) files aren't supported.
+
+    Fields are read little endian byte by byte, so any host can read them.
+*/
+
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include "moctalloc.h"
+
+// Bytes of the header every version has, 1.3 and 1.4 add to the end
+# define LAS_HEADER_MIN 227
+
+// Bytes of the 1.4 header, which has the 64 bit point count
+# define LAS_HEADER_14 375
+
+
+/*
+    What is needed from the public header block
+*/
+typedef struct las_header{
+    uint8_t version_major;
+    uint8_t version_minor;
+    uint16_t header_size;
+    uint32_t offset_to_points;  // Start of the point records
+    uint8_t point_format;
+    uint16_t record_length;     // Bytes of each point record, formats may have extra bytes
+    uint64_t num_points;
+    double scale[3];            // x y z
+    double offset[3];
+    double max[3];
+    double min[3];
+} las_header;
+
+
+static inline uint16_t las_u16(const uint8_t* bytes){
+    return (uint16_t)(bytes[0] | bytes[1]<<8);
+}
+
+static inline uint32_t las_u32(const uint8_t* bytes){
+    return (uint32_t)bytes[0] | (uint32_t)bytes[1]<<8 | (uint32_t)bytes[2]<<16 | (uint32_t)bytes[3]<<24;
+}
+
+static inline uint64_t las_u64(const uint8_t* bytes){
+    return (uint64_t)las_u32(bytes) | (uint64_t)las_u32(bytes + 4)<<32;
+}
+
+static inline double las_f64(const uint8_t* bytes){
+    uint64_t bits = las_u64(bytes);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+
+/*
+    Moves to byte offset of a file, which may be past 2GB (long is 32 bits on Windows)
+*/
+static inline bool las_seek(FILE* file, uint64_t offset){
+#if defined(_WIN32)
+    return _fseeki64(file, (__int64)offset, SEEK_SET) == 0;
+#else
+    return fseek(file, (long)offset, SEEK_SET) == 0;
+#endif
+}
+
+
+/*
+    Bytes of a point record the fields are read from, the record may be longer
+*/
+static inline size_t las_record_min(uint8_t point_format){
+    if (point_format >= 6) return 30;
+    // Formats 1, 3, 4 and 5 have the gps time after the 20 bytes of format 0
+    return point_format == 0 || point_format == 2 ? 20 : 28;
+}
+
+
+/*
+    True if the records of a format have a gps time
+*/
+static inline bool las_has_time(uint8_t point_format){
+    return point_format != 0 && point_format != 2;
+}
+
+
+/*
+    Reads the header of an open LAS file
+    Returns NULL, or why the file can't be read
+*/
+const char* las_read_header(FILE* file, las_header* header){
+    uint8_t bytes[LAS_HEADER_14];
+    memset(bytes, 0, sizeof(bytes));
+
+    size_t got = fread(bytes, 1, sizeof(bytes), file);
+    if (got < LAS_HEADER_MIN || memcmp(bytes, "LASF", 4) != 0) return "Not a LAS file";
+
+    header->version_major = bytes[24];
+    header->version_minor = bytes[25];
+    header->header_size = las_u16(bytes + 94);
+    header->offset_to_points = las_u32(bytes + 96);
+    header->point_format = bytes[104];
+    header->record_length = las_u16(bytes + 105);
+    header->num_points = las_u32(bytes + 107);
+    for (int i = 0; i < 3; i++){
+        header->scale[i] = las_f64(bytes + 131 + 8*i);
+        header->offset[i] = las_f64(bytes + 155 + 8*i);
+        header->max[i] = las_f64(bytes + 179 + 16*i);
+        header->min[i] = las_f64(bytes + 187 + 16*i);
+    }
+
+    // 1.4 keeps the real count here, the legacy one is 0 past 2^32-1 points or for formats 6 and up
+    if (header->version_minor >= 4 && header->header_size >= LAS_HEADER_14 && got >= LAS_HEADER_14){
+        header->num_points = las_u64(bytes + 247);
+    }
+
+    if (header->version_major != 1 || header->version_minor > 4) return "Only LAS 1.0 to 1.4 can be read";
+    // LAZ sets the top bits of the format
+    if (header->point_format & 0xC0) return "The file is compressed (LAZ), decompress it to LAS first";
+    if (header->point_format > 10) return "Unknown point format";
+    if (header->record_length < las_record_min(header->point_format)) return "Point records are too short for their format";
+    if (header->offset_to_points < header->header_size) return "Bad offset to the point records";
+    return NULL;
+}
+
+
+/*
+    Opens a LAS file and reads its header, the file is left at the first point record
+    Returns NULL and sets error if it can't be read
+*/
+FILE* las_open(const char* filename, las_header* header, const char** error){
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL){
+        *error = "Could not open the file";
+        return NULL;
+    }
+
+    *error = las_read_header(file, header);
+    if (*error == NULL && !las_seek(file, header->offset_to_points)){
+        *error = "Could not find the point records";
+    }
+    if (*error != NULL){
+        fclose(file);
+        return NULL;
+    }
+    return file;
+}
+
+
+/*
+    The fields of the points kept, each a column of the same length
+*/
+typedef struct las_columns{
+    double* coords[3];          // x y z, scaled and offset
+    double* gps_time;           // 0 if the format has none
+    int16_t* scan_angle_rank;   // Degrees, formats 6 and up are rounded from their finer angle
+    uint16_t* point_source_ID;
+} las_columns;
+
+
+/*
+    Columns of num_rows rows, for a chunk at a time
+    Free them with las_columns_free
+*/
+las_columns las_columns_alloc(size_t num_rows){
+    las_columns columns;
+    for (int j = 0; j < 3; j++){
+        columns.coords[j] = moct_malloc(num_rows*sizeof(double));
+    }
+    columns.gps_time = moct_malloc(num_rows*sizeof(double));
+    columns.scan_angle_rank = moct_malloc(num_rows*sizeof(int16_t));
+    columns.point_source_ID = moct_malloc(num_rows*sizeof(uint16_t));
+    return columns;
+}
+
+
+void las_columns_free(las_columns* columns){
+    for (int j = 0; j < 3; j++){
+        moct_free(columns->coords[j]);
+    }
+    moct_free(columns->gps_time);
+    moct_free(columns->scan_angle_rank);
+    moct_free(columns->point_source_ID);
+}
+
+
+/*
+    The row the first record of a chunk starting at first_record is decoded to, see las_decode
+*/
+static inline uint64_t las_first_kept(uint64_t first_record, uint64_t step){
+    return (first_record + step - 1)/step;
+}
+
+
+/*
+    Decodes the records of a chunk into columns
+    The chunk holds records [first_record, first_record + num_records) of the file,
+    only every step-th record of the file is kept (0, step, 2 step, ...), record
+    k*step goes to row k - first_row of the columns (pass 0 to fill columns for the whole file)
+
+    shift is subtracted after scaling and offsetting each coordinate (the offsets,
+    to bring the points near the origin, or 0)
+*/
+void las_decode(const las_header* header, const uint8_t* records, uint64_t first_record, size_t num_records,
+                uint64_t step, const double shift[3], las_columns* columns, uint64_t first_row){
+    uint64_t first_kept = las_first_kept(first_record, step);
+    uint64_t end_kept = las_first_kept(first_record + num_records, step);
+    bool extended = header->point_format >= 6;
+    bool has_time = las_has_time(header->point_format);
+
+    ptrdiff_t k;
+    #pragma omp parallel for schedule(static)
+    for (k = (ptrdiff_t)first_kept; k < (ptrdiff_t)end_kept; k++){
+        const uint8_t* record = records + ((uint64_t)k*step - first_record)*header->record_length;
+        size_t row = (size_t)((uint64_t)k - first_row);
+
+        // Same arithmetic as the usual readers, then shifted
+        for (int j = 0; j < 3; j++){
+            double pos = (double)(int32_t)las_u32(record + 4*j)*header->scale[j] + header->offset[j];
+            columns->coords[j][row] = pos - shift[j];
+        }
+
+        if (extended){
+            columns->scan_angle_rank[row] = (int16_t)lround((int16_t)las_u16(record + 18)*0.006);
+            columns->point_source_ID[row] = las_u16(record + 20);
+            columns->gps_time[row] = las_f64(record + 22);
+        } else {
+            columns->scan_angle_rank[row] = (int8_t)record[16];
+            columns->point_source_ID[row] = las_u16(record + 18);
+            columns->gps_time[row] = has_time ? las_f64(record + 20) : 0.;
+        }
+    }
+}
+
+
+// Point records read at a time
+# define LAS_CHUNK ((size_t)1<<16)
+
+
+/*
+    Reads every kept point (every step-th, see las_decode) from an open file at its first
+    point record, into columns with room for las_first_kept(num_points, step) rows
+    Returns false if the file ends early
+*/
+bool las_read_rows(FILE* file, const las_header* header, uint64_t step, const double shift[3],
+                   las_columns* columns){
+    uint8_t* records = moct_malloc(LAS_CHUNK*header->record_length);
+    bool ok = true;
+    for (uint64_t first = 0; first < header->num_points && ok; first += LAS_CHUNK){
+        size_t num = header->num_points - first < LAS_CHUNK ? (size_t)(header->num_points - first) : LAS_CHUNK;
+        ok = fread(records, header->record_length, num, file) == num;
+        if (ok) las_decode(header, records, first, num, step, shift, columns, 0);
+    }
+    moct_free(records);
+    return ok;
+}
+
+
+/*
+    Reads only the kept points with one scan angle rank (the points straight down
+    from the scanners, which the trajectory is made from), a chunk at a time
+    kept is set to columns of just those, free them with las_columns_free
+    Returns the number kept, or -1 if the file ends early (kept is freed)
+*/
+ptrdiff_t las_read_scan_angle(FILE* file, const las_header* header, uint64_t step, const double shift[3],
+                              int16_t scan_angle, las_columns* kept){
+    las_columns chunk = las_columns_alloc(LAS_CHUNK);
+    memset(kept, 0, sizeof(*kept));
+    size_t num_kept = 0;
+    size_t space = 0;
+
+    uint8_t* records = moct_malloc(LAS_CHUNK*header->record_length);
+    bool ok = true;
+    for (uint64_t first = 0; first < header->num_points && ok; first += LAS_CHUNK){
+        size_t num = header->num_points - first < LAS_CHUNK ? (size_t)(header->num_points - first) : LAS_CHUNK;
+        ok = fread(records, header->record_length, num, file) == num;
+        if (!ok) break;
+
+        uint64_t first_row = las_first_kept(first, step);
+        las_decode(header, records, first, num, step, shift, &chunk, first_row);
+
+        size_t num_rows = (size_t)(las_first_kept(first + num, step) - first_row);
+        for (size_t r = 0; r < num_rows; r++){
+            if (chunk.scan_angle_rank[r] != scan_angle) continue;
+
+            if (num_kept == space){
+                // Expand by 1.5*s + 1024
+                space = (space*3)/2 + 1024;
+                for (int j = 0; j < 3; j++){
+                    kept->coords[j] = moct_realloc(kept->coords[j], space*sizeof(double));
+                }
+                kept->gps_time = moct_realloc(kept->gps_time, space*sizeof(double));
+                kept->scan_angle_rank = moct_realloc(kept->scan_angle_rank, space*sizeof(int16_t));
+                kept->point_source_ID = moct_realloc(kept->point_source_ID, space*sizeof(uint16_t));
+            }
+            for (int j = 0; j < 3; j++){
+                kept->coords[j][num_kept] = chunk.coords[j][r];
+            }
+            kept->gps_time[num_kept] = chunk.gps_time[r];
+            kept->scan_angle_rank[num_kept] = chunk.scan_angle_rank[r];
+            kept->point_source_ID[num_kept] = chunk.point_source_ID[r];
+            num_kept++;
+        }
+    }
+    moct_free(records);
+    las_columns_free(&chunk);
+
+    if (!ok){
+        las_columns_free(kept);
+        return -1;
+    }
+    return (ptrdiff_t)num_kept;
+}
@@ -0,0 +1,167 @@
+/*
+    Linear oct trees
+    The same tree as mocttree, but without any pointers
+
+    The nodes are in one array in morton order, the children of a node are next to each other
+    and found with a mask and the index of the first one. Every node covers a contiguous
+    range of the points, which are sorted by their morton key, so a whole subtree is one slice.
+
+    The tree, its nodes and points are a single flat buffer, everything inside of it
+    is found by offsets from the start. It can be copied, saved or shared as is.
+*/
+
+#pragma once
+#include "mocttree.h"
+
+// Most points a leaf holds, leaves only get more if the points can't be split (duplicates,
+// or MOCT_MAX_DEPTH), can be set when building like MOCT_BUCKET
+#ifndef LINEAR_LEAF
+# define LINEAR_LEAF 16
+#endif
+
+
+/*
+    A node of a linear tree
+    Its points are [first, first + count), all the points of its children
+    Only leaves (no children) test their points directly
+*/
+typedef struct linnode{ // 16 bytes large
+    uint32_t first_child;   // Index of the first child node, the rest follow in octant order
+    uint32_t first;         // First point
+    uint32_t count;         // Number of points, including all children
+    uint8_t child_mask;     // Bit i is set if octant i has a child (same indexing as octnode.children)
+    uint8_t pad[3];
+} linnode;
+
+
+/*
+    Tight box of the points under a node, low and high are the smallest and largest
+    coordinates of them (so low.pos[2] is the lowest point of the whole subtree)
+
+    Near the edges of the cloud, and wherever the points are a thin surface, it is much
+    smaller than the octant of the node, so the queries rule out or accept boxes sooner
+*/
+typedef struct linbox{ // 48 bytes large
+    struct vec3 low;
+    struct vec3 high;
+} linbox;
+
+
+/*
+    Start of the buffer of a linear tree
+    Followed by (at the offsets)
+    num_nodes linnodes, nodes[0] is the root
+    num_points doubles for each of x, y and z
+    num_points uint64 indexes, same numbering as mocttree (1 based, in the order given)
+    num_nodes linboxes, only if the tree was built with them (boxes_offset is 0 otherwise)
+*/
+typedef struct linoctree{
+    moct_kind kind;         // Always MOCT_LINEAR
+
+    // Corners, same as mocttree
+    struct vec3 point1;
+    struct vec3 point2;
+    size_t num_elements;    // Points given to build the tree
+    size_t num_points;      // Points inside the tree, the ones stored
+    size_t num_nodes;
+    size_t bytes;           // Size of the whole buffer
+
+    size_t nodes_offset;
+    size_t coords_offset[3];
+    size_t index_offset;
+    size_t boxes_offset;
+} linoctree;
+
+
+/*
+    Offsets into the buffer are kept at this alignment
+*/
+static inline size_t linear_align(size_t offset){
+    return (offset + 63)&(~(size_t)63);
+}
+
+
+static inline linnode* linear_nodes(const linoctree* tree){
+    return (linnode*)((uint8_t*)tree + tree->nodes_offset);
+}
+
+
+static inline double* linear_coords(const linoctree* tree, int axis){
+    return (double*)((uint8_t*)tree + tree->coords_offset[axis]);
+}
+
+
+static inline uint64_t* linear_index(const linoctree* tree){
+    return (uint64_t*)((uint8_t*)tree + tree->index_offset);
+}
+
+
+/*
+    NULL if the tree has no boxes
+*/
+static inline linbox* linear_boxes(const linoctree* tree){
+    if (tree->boxes_offset == 0) return NULL;
+    return (linbox*)((uint8_t*)tree + tree->boxes_offset);
+}
+
+
+/*
+    Point i (in sorted order) of the tree
+*/
+static inline vec3 linear_point(const linoctree* tree, size_t i){
+    vec3 ret;
+    for (int j = 0; j < 3; j++){
+        ret.pos[j] = linear_coords(tree, j)[i];
+    }
+    return ret;
+}
+
+
+/*
+    Corners of an octant of the box point1 to point2
+    X Y Z reverse indexing, like octnode.children
+*/
+static inline void octant_box(int octant, vec3 point1, vec3 point2, vec3* child1, vec3* child2){
+    vec3 midpoint = vec3_midpoint(point1, point2);
+    for (int j = 0; j < 3; j++){
+        if (octant&(1<<j)){
+            child1->pos[j] = midpoint.pos[j];
+            child2->pos[j] = point2.pos[j];
+        } else {
+            child1->pos[j] = point1.pos[j];
+            child2->pos[j] = midpoint.pos[j];
+        }
+    }
+}
+
+
+/*
+    Box the walks use for the root of a linear tree
+    The tight box if the tree has them, otherwise the corners of the tree
+*/
+static inline void linear_root_box(const linoctree* tree, vec3* point1, vec3* point2){
+    linbox* boxes = linear_boxes(tree);
+    if (boxes != NULL){
+        *point1 = boxes[0].low;
+        *point2 = boxes[0].high;
+    } else {
+        *point1 = tree->point1;
+        *point2 = tree->point2;
+    }
+}
+
+
+/*
+    Box the walks use for node child_id, which is in octant of its parent's box point1 point2
+    The tight box if the tree has them, otherwise the octant
+*/
+static inline void linear_child_box(const linoctree* tree, uint32_t child_id, int octant, vec3 point1, vec3 point2,
+                                    vec3* child1, vec3* child2){
+    linbox* boxes = linear_boxes(tree);
+    if (boxes != NULL){
+        *child1 = boxes[child_id].low;
+        *child2 = boxes[child_id].high;
+    } else {
+        octant_box(octant, point1, point2, child1, child2);
+    }
+}
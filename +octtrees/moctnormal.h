@@ -0,0 +1,190 @@
+/*
+    Moments of the points in a box, for either kind of tree
+    Used by traj_upwards (mocttraj.h) to fit the road's plane under every road point
+
+    The points are never gathered, each one found is added to a running count, sum and
+    sum of products, which is all a plane fit needs (see moments_scatter). A box of the
+    tree fully inside the query box is added without testing its points, in a linear tree
+    that is a straight run over its coordinates.
+*/
+
+#pragma once
+#include <string.h>
+#include "moctlinear.h"
+
+
+/*
+    Running moments of points, taken about origin so they stay small
+    Only the upper triangle of products is kept, see moments_scatter
+*/
+typedef struct box_moments{
+    vec3 origin;
+    size_t count;
+    double sum[3];
+    double products[3][3];
+} box_moments;
+
+
+static inline void moments_init(box_moments* moments, vec3 origin){
+    memset(moments, 0, sizeof(box_moments));
+    moments->origin = origin;
+}
+
+
+static inline void moments_add(box_moments* moments, vec3 point){
+    double r[3];
+    for (int j = 0; j < 3; j++){
+        r[j] = point.pos[j] - moments->origin.pos[j];
+        moments->sum[j] += r[j];
+    }
+    for (int p = 0; p < 3; p++){
+        for (int q = p; q < 3; q++){
+            moments->products[p][q] += r[p]*r[q];
+        }
+    }
+}
+
+
+/*
+    Scatter matrix of the points about their mean (the sum of r*r' of affine_fit.m)
+    Needs at least one point
+*/
+static inline void moments_scatter(const box_moments* moments, double scatter[3][3]){
+    double n = (double)moments->count;
+    for (int p = 0; p < 3; p++){
+        for (int q = p; q < 3; q++){
+            scatter[p][q] = moments->products[p][q] - moments->sum[p]*moments->sum[q]/n;
+            scatter[q][p] = scatter[p][q];
+        }
+    }
+}
+
+
+/*
+    Whether the box point1 point2 overlaps low high, is inside it, and whether a point is
+*/
+static inline bool box_overlaps(vec3 point1, vec3 point2, vec3 low, vec3 high){
+    for (int j = 0; j < 3; j++){
+        if (point2.pos[j] < low.pos[j] || point1.pos[j] > high.pos[j]) return false;
+    }
+    return true;
+}
+
+
+static inline bool box_inside(vec3 point1, vec3 point2, vec3 low, vec3 high){
+    for (int j = 0; j < 3; j++){
+        if (point1.pos[j] < low.pos[j] || point2.pos[j] > high.pos[j]) return false;
+    }
+    return true;
+}
+
+
+static inline bool point_in_box(vec3 point, vec3 low, vec3 high){
+    for (int j = 0; j < 3; j++){
+        if (point.pos[j] < low.pos[j] || point.pos[j] > high.pos[j]) return false;
+    }
+    return true;
+}
+
+
+/*
+    Adds every point of an octnode and its children
+*/
+void moments_all_node(const mocttree* tree, octnode* node, box_moments* moments){
+    item* items = node_items(node);
+    for (uint32_t i = 0; i < node->num_elements; i++){
+        moments_add(moments, item_point(tree, &items[i]));
+    }
+    moments->count += node->num_elements;
+
+    for (int i = 0; i < 8; i++){
+        if (node->children[i] != NULL) moments_all_node(tree, node->children[i], moments);
+    }
+}
+
+
+/*
+    Adds the points of an octnode (resursively) inside the box low high
+
+    Requirements:
+    All coordinates in point1 < node.midpoint < point2
+*/
+void moments_node(const mocttree* tree, octnode* node, vec3 point1, vec3 point2, vec3 low, vec3 high,
+                  box_moments* moments){
+    if (!box_overlaps(point1, point2, low, high)) return;
+    if (box_inside(point1, point2, low, high)){
+        moments_all_node(tree, node, moments);
+        return;
+    }
+
+    item* items = node_items(node);
+    for (uint32_t i = 0; i < node->num_elements; i++){
+        vec3 point = item_point(tree, &items[i]);
+        if (point_in_box(point, low, high)){
+            moments_add(moments, point);
+            moments->count++;
+        }
+    }
+
+    for (int i = 0; i < 8; i++){
+        if (node->children[i] != NULL){
+            vec3 temp1;
+            vec3 temp2;
+            octnode_child_box(node, i, point1, point2, &temp1, &temp2);
+            moments_node(tree, node->children[i], temp1, temp2, low, high, moments);
+        }
+    }
+}
+
+
+/*
+    Same as moments_node for a linear tree, node_id is the index of the node
+    The points of a node are contiguous, so a node fully inside is one run
+*/
+void moments_linear_node(const linoctree* tree, uint32_t node_id, vec3 point1, vec3 point2, vec3 low, vec3 high,
+                         box_moments* moments){
+    if (!box_overlaps(point1, point2, low, high)) return;
+
+    linnode* node = &linear_nodes(tree)[node_id];
+    bool inside = box_inside(point1, point2, low, high);
+    if (inside || node->child_mask == 0){
+        size_t end = (size_t)node->first + node->count;
+        for (size_t i = node->first; i < end; i++){
+            vec3 point = linear_point(tree, i);
+            if (inside || point_in_box(point, low, high)){
+                moments_add(moments, point);
+                moments->count++;
+            }
+        }
+        return;
+    }
+
+    uint32_t child = node->first_child;
+    for (int i = 0; i < 8; i++){
+        if (node->child_mask&(1<<i)){
+            vec3 temp1;
+            vec3 temp2;
+            linear_child_box(tree, child, i, point1, point2, &temp1, &temp2);
+            moments_linear_node(tree, child++, temp1, temp2, low, high, moments);
+        }
+    }
+}
+
+
+/*
+    Moments of the points of either kind of tree inside the box low high (edges included),
+    taken about origin
+*/
+void box_moments_any(const void* tree, vec3 low, vec3 high, vec3 origin, box_moments* moments){
+    moments_init(moments, origin);
+    if (tree_kind(tree) == MOCT_LINEAR){
+        const linoctree* linear = (const linoctree*)tree;
+        vec3 point1;
+        vec3 point2;
+        linear_root_box(linear, &point1, &point2);
+        moments_linear_node(linear, 0, point1, point2, low, high, moments);
+        return;
+    }
+    const mocttree* pointer = (const mocttree*)tree;
+    moments_node(pointer, pointer->root, pointer->point1, pointer->point2, low, high, moments);
+}
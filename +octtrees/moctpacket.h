@@ -0,0 +1,346 @@
+/*
+    Packet clearance queries
+    Many clearance queries close to each other (the frusta of one road point) share
+    a single walk of the tree. Each node is classified against the queries still live
+    there, so the nodes near the root, and their cache misses, are paid for once
+    instead of once per query.
+
+    The results are exactly the same as running each query on its own.
+*/
+
+#pragma once
+#include "moctclearance.h"
+
+// Most queries in a packet, one bit each
+# define PACKET_MAX 64
+
+
+/*
+    Bit q is set if query q of the packet is included
+*/
+typedef uint64_t packet_mask;
+
+
+/*
+    Index of the lowest set bit
+    Requirements:
+    mask != 0
+*/
+static inline size_t packet_lowest(packet_mask mask){
+#if defined(__GNUC__)
+    return (size_t)__builtin_ctzll(mask);
+#elif defined(_MSC_VER) && defined(MOCT_X86)
+    unsigned long index;
+    _BitScanForward64(&index, mask);
+    return (size_t)index;
+#else
+    size_t index = 0;
+    while (!(mask&1)){
+        mask >>= 1;
+        index++;
+    }
+    return index;
+#endif
+}
+
+
+/*
+    The shared part of a packet walk
+    low and high bound the regions of every query, anything outside is outside all of them
+*/
+typedef struct packet_walk{
+    clearance_query* queries;
+    size_t num_queries;
+    vec3 low;
+    vec3 high;
+} packet_walk;
+
+
+/*
+    False if the box point1 point2 misses the bounds of the packet
+*/
+static inline bool packet_overlaps(packet_walk* walk, vec3 point1, vec3 point2){
+    for (int j = 0; j < 3; j++){
+        if (point2.pos[j] < walk->low.pos[j] || point1.pos[j] > walk->high.pos[j]) return false;
+    }
+    return true;
+}
+
+
+/*
+    Classifies a box against every live query of a packet, updating each one's active
+    planes like cube_classify
+    Returns the queries the box is partly inside, fully holds the ones it is fully inside
+    Queries the box can't improve any more (see clearance_prunes) are in neither
+*/
+static inline packet_mask packet_classify(packet_walk* walk, packet_mask live, plane_mask* active,
+                                          vec3 point1, vec3 point2, packet_mask* fully){
+    packet_mask partial = 0;
+    *fully = 0;
+    for (; live != 0; live &= live - 1){
+        size_t q = packet_lowest(live);
+        packet_mask bit = (packet_mask)1<<q;
+        if (clearance_prunes(&walk->queries[q], point1, point2)) continue;
+
+        cube_side side = cube_classify(walk->queries[q].cons, point1, point2, &active[q]);
+        if (side == CUBE_INSIDE){
+            *fully |= bit;
+        } else if (side == CUBE_PARTIAL){
+            partial |= bit;
+        }
+    }
+    return partial;
+}
+
+
+/*
+    Reduces a point into the included queries
+*/
+static inline void packet_reduce(clearance_query* queries, packet_mask included, vec3 point){
+    for (; included != 0; included &= included - 1){
+        clearance_query* query = &queries[packet_lowest(included)];
+        clearance_add(query, clearance_value(query, point));
+    }
+}
+
+
+/*
+    The included queries that could still be improved by something in the box point1 point2
+*/
+static inline packet_mask packet_unpruned(clearance_query* queries, packet_mask included, vec3 point1, vec3 point2){
+    for (packet_mask m = included; m != 0; m &= m - 1){
+        size_t q = packet_lowest(m);
+        if (clearance_prunes(&queries[q], point1, point2)) included &= ~((packet_mask)1<<q);
+    }
+    return included;
+}
+
+
+/*
+    Everything in this node is inside the included queries, so just reduce over it
+*/
+void packet_quickly_node(clearance_query* queries, packet_mask included, mocttree* tree, octnode* node,
+                         vec3 point1, vec3 point2){
+    included = packet_unpruned(queries, included, point1, point2);
+    if (included == 0){
+        return;
+    }
+
+    item* items = node_items(node);
+    for (uint32_t i = 0; i < node->num_elements; i++){
+        packet_reduce(queries, included, item_point(tree, &items[i]));
+    }
+
+    for (int i = 0; i < 8; i++){
+        if (node->children[i] != NULL){
+            vec3 temp1;
+            vec3 temp2;
+            octnode_child_box(node, i, point1, point2, &temp1, &temp2);
+            packet_quickly_node(queries, included, tree, node->children[i], temp1, temp2);
+        }
+    }
+}
+
+
+/*
+    Same as packet_quickly_node for node node_id of a linear tree
+    Like clearance_linear_quickly the lowest z queries take the lowest point of the box
+*/
+void packet_linear_quickly(clearance_query* queries, packet_mask included, linoctree* tree, uint32_t node_id,
+                           vec3 point1, vec3 point2){
+    included = packet_unpruned(queries, included, point1, point2);
+
+    linbox* boxes = linear_boxes(tree);
+    if (boxes != NULL){
+        for (packet_mask m = included; m != 0; m &= m - 1){
+            size_t q = packet_lowest(m);
+            if (queries[q].mode == CLEARANCE_LOWEST_Z && queries[q].kth == 1){
+                clearance_add(&queries[q], boxes[node_id].low.pos[2]);
+                included &= ~((packet_mask)1<<q);
+            }
+        }
+    }
+    if (included == 0){
+        return;
+    }
+
+    linnode* node = &linear_nodes(tree)[node_id];
+    if (node->child_mask == 0){
+        for (size_t i = node->first; i < node->first + node->count; i++){
+            packet_reduce(queries, included, linear_point(tree, i));
+        }
+        return;
+    }
+
+    uint32_t child = node->first_child;
+    for (int i = 0; i < 8; i++){
+        if (node->child_mask&(1<<i)){
+            vec3 temp1;
+            vec3 temp2;
+            linear_child_box(tree, child, i, point1, point2, &temp1, &temp2);
+            packet_linear_quickly(queries, included, tree, child++, temp1, temp2);
+        }
+    }
+}
+
+
+/*
+    Same as clearance_node for every live query of a packet at once
+    active is the plane mask of each query, it is copied before the children change it
+
+    Requirements:
+    All coordinates in point1 < node.midpoint < point2
+*/
+void packet_node(packet_walk* walk, packet_mask live, const plane_mask* parent_active,
+                 mocttree* tree, octnode* node, vec3 point1, vec3 point2){
+    // One test for the whole packet first
+    if (!packet_overlaps(walk, point1, point2)){
+        return;
+    }
+
+    clearance_query* queries = walk->queries;
+    plane_mask active[PACKET_MAX];
+    for (size_t q = 0; q < walk->num_queries; q++){
+        active[q] = parent_active[q];
+    }
+
+    packet_mask fully;
+    packet_mask partial = packet_classify(walk, live, active, point1, point2, &fully);
+
+    if (fully != 0){
+        for (packet_mask m = fully; m != 0; m &= m - 1){
+            queries[packet_lowest(m)].count += node->num_total_elements;
+        }
+        packet_quickly_node(queries, fully, tree, node, point1, point2);
+    }
+
+    if (partial == 0){
+        return;
+    }
+
+    item* items = node_items(node);
+    for (uint32_t i = 0; i < node->num_elements; i++){
+        vec3 point = item_point(tree, &items[i]);
+        for (packet_mask m = partial; m != 0; m &= m - 1){
+            size_t q = packet_lowest(m);
+            if (satisfies_active(queries[q].cons, active[q], point)){
+                clearance_add(&queries[q], clearance_value(&queries[q], point));
+                queries[q].count++;
+            }
+        }
+    }
+
+    // Front to back for the first query, the frusta of a packet mostly agree
+    int octants[8];
+    vec3 child1[8];
+    vec3 child2[8];
+    int num = clearance_order(&queries[packet_lowest(partial)], octnode_child_mask(node), point1, point2,
+                              node, NULL, 0, octants, child1, child2);
+    for (int i = 0; i < num; i++){
+        packet_node(walk, partial, active, tree, node->children[octants[i]], child1[i], child2[i]);
+    }
+}
+
+
+/*
+    Same as packet_node for a linear tree, node_id is the index of the node
+*/
+void packet_linear_node(packet_walk* walk, packet_mask live, const plane_mask* parent_active,
+                        linoctree* tree, uint32_t node_id, vec3 point1, vec3 point2){
+    // One test for the whole packet first
+    if (!packet_overlaps(walk, point1, point2)){
+        return;
+    }
+
+    clearance_query* queries = walk->queries;
+    plane_mask active[PACKET_MAX];
+    for (size_t q = 0; q < walk->num_queries; q++){
+        active[q] = parent_active[q];
+    }
+
+    packet_mask fully;
+    packet_mask partial = packet_classify(walk, live, active, point1, point2, &fully);
+    linnode* node = &linear_nodes(tree)[node_id];
+
+    // Every point of a node fully inside counts, one pass over them serves all those queries
+    if (fully != 0){
+        for (packet_mask m = fully; m != 0; m &= m - 1){
+            queries[packet_lowest(m)].count += node->count;
+        }
+        packet_linear_quickly(queries, fully, tree, node_id, point1, point2);
+    }
+
+    if (partial == 0){
+        return;
+    }
+
+    // Only leaves have points of their own, each query tests them a run at a time
+    if (node->child_mask == 0){
+        size_t end = (size_t)node->first + node->count;
+        for (packet_mask m = partial; m != 0; m &= m - 1){
+            size_t q = packet_lowest(m);
+            clearance_query* query = &queries[q];
+
+            for (size_t i = node->first; i < end; i += HALFSPACE_RUN){
+                size_t run = end - i < HALFSPACE_RUN ? end - i : HALFSPACE_RUN;
+                uint64_t mask = linear_mask(query->cons, active[q], tree, i, run);
+                query->count += mask_count(mask);
+
+                for (size_t j = 0; mask != 0; j++, mask >>= 1){
+                    if (mask&1){
+                        clearance_add(query, clearance_value(query, linear_point(tree, i + j)));
+                    }
+                }
+            }
+        }
+        return;
+    }
+
+    // Front to back for the first query, the frusta of a packet mostly agree
+    int octants[8];
+    vec3 child1[8];
+    vec3 child2[8];
+    int num = clearance_order(&queries[packet_lowest(partial)], node->child_mask, point1, point2,
+                              NULL, tree, node->first_child, octants, child1, child2);
+    for (int i = 0; i < num; i++){
+        uint32_t child = node->first_child + (uint32_t)mask_count(node->child_mask&((1u<<octants[i]) - 1));
+        packet_linear_node(walk, partial, active, tree, child, child1[i], child2[i]);
+    }
+}
+
+
+/*
+    Runs a packet of clearance queries in one walk of either kind of tree
+    Each query is set up with clearance_start, and read with clearance_finish after
+
+    low and high must bound the regions of every query (the corners of the frusta),
+    pass the bounds of the tree if they aren't known
+
+    Requirements:
+    num_queries <= PACKET_MAX
+*/
+void packet_clearance_any(clearance_query* queries, size_t num_queries, void* tree, vec3 low, vec3 high){
+    if (num_queries == 0) return;
+
+    packet_walk walk;
+    walk.queries = queries;
+    walk.num_queries = num_queries;
+    walk.low = low;
+    walk.high = high;
+
+    plane_mask active[PACKET_MAX];
+    for (size_t q = 0; q < num_queries; q++){
+        active[q] = ALL_PLANES;
+    }
+    packet_mask live = num_queries == PACKET_MAX ? ~(packet_mask)0 : ((packet_mask)1<<num_queries) - 1;
+
+    if (tree_kind(tree) == MOCT_LINEAR){
+        vec3 point1;
+        vec3 point2;
+        linear_root_box((linoctree*)tree, &point1, &point2);
+        packet_linear_node(&walk, live, active, (linoctree*)tree, 0, point1, point2);
+    } else {
+        mocttree* pointer = (mocttree*)tree;
+        packet_node(&walk, live, active, pointer, pointer->root, pointer->point1, pointer->point2);
+    }
+}
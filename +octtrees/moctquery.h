@@ -3,7 +3,9 @@
 */
 
 #pragma once
+#include <math.h>
 #include "mocttree.h"
+#include "moctlinear.h"
 
 
 /*
@@ -17,6 +19,43 @@ typedef struct plane3{
 } plane3;
 
 
+// Most extra axes exact culling keeps, any more are skipped (which only makes it looser)
+# define CULL_MAX_AXES 48
+
+// Most corners of a region exact culling handles
+# define CULL_MAX_CORNERS 64
+
+
+/*
+    How boxes are culled against a region
+*/
+typedef enum cull_mode{
+    CULL_PLANES = 0,    // Only the planes, definitely false, probably true (see cube_satisfies)
+    CULL_EXACT = 1      // The planes, then separating axes (see exact_cull)
+} cull_mode;
+
+
+/*
+    Tighter culling of boxes against a region
+
+    The region is clipped to the tree, which always makes it a bounded polytope. Its corners
+    are projected onto the axes that can separate it from a box: x, y and z, and the cross of
+    every edge with x, y and z (its face normals are its planes, which are already checked).
+    A box whose projection misses the region's on any of them holds nothing inside.
+
+    With every axis this is exact (separating axis theorem), missing axes only make it looser
+*/
+typedef struct exact_cull{
+    vec3 low;           // Bounds of the corners
+    vec3 high;
+    double tolerance;   // Slack for rounding, a box has to miss by more than this
+    size_t num_axes;
+    vec3 axes[CULL_MAX_AXES];
+    double axis_min[CULL_MAX_AXES];
+    double axis_max[CULL_MAX_AXES];
+} exact_cull;
+
+
 /*
     Abstract region
     A point <x,y,z> is considered "inside" iff
@@ -24,10 +63,42 @@ typedef struct plane3{
 */
 typedef struct constraint{
     size_t num_planes;
+    struct exact_cull* exact;   // Tighter culling, NULL to only use the planes
+    size_t nodes_visited;       // Boxes checked by the queries so far, to compare culling
     struct plane3 planes[];
 } constraint;
 
 
+/*
+    Sets up a constraint with space for num_planes, the planes are left to be filled
+*/
+static inline void constraint_init(constraint* cons, size_t num_planes){
+    cons->num_planes = num_planes;
+    cons->exact = NULL;
+    cons->nodes_visited = 0;
+}
+
+
+/*
+    Which planes of a constraint still have to be checked, bit p for plane p
+    A box that fully satisfies a plane has all of its children and points satisfy it too,
+    so a traversal drops that plane for the whole subtree
+
+    Only the first 64 planes can be dropped, any planes after that are always checked
+*/
+typedef uint64_t plane_mask;
+
+# define ALL_PLANES (~(plane_mask)0)
+
+
+/*
+    True if plane p is still checked
+*/
+static inline bool plane_active(plane_mask active, size_t p){
+    return p >= 64 || ((active>>p)&1);
+}
+
+
 /*
     Checks if a point is inside a constraint
 */
@@ -39,6 +110,277 @@ bool satisfies(constraint* cons, vec3 point){
 }
 
 
+/*
+    Same as satisfies, but only checks the active planes
+*/
+bool satisfies_active(constraint* cons, plane_mask active, vec3 point){
+    for (int i = 0; i < cons->num_planes; i++){
+        if (!plane_active(active, i)) continue;
+        if (vec3_dot(cons->planes[i].norm, point) < cons->planes[i].dval) return false;
+    }
+    return true;
+}
+
+
+/*
+    The corners of the cube with corners point1 and point2 furthest along (inner)
+    and against (outer) the normal of a plane
+
+    The dot of every other corner (and every point in the cube) is between theirs, this holds
+    after rounding too, so testing them gives exactly the same answer as testing all 8
+*/
+static inline void cube_extremes(plane3* plane, vec3 point1, vec3 point2, vec3* inner, vec3* outer){
+    for (int j = 0; j < 3; j++){
+        if (plane->norm.pos[j] >= 0){
+            inner->pos[j] = point2.pos[j];
+            outer->pos[j] = point1.pos[j];
+        } else {
+            inner->pos[j] = point1.pos[j];
+            outer->pos[j] = point2.pos[j];
+        }
+    }
+}
+
+
+/*
+    Where a cube is compared to a constraint
+*/
+typedef enum cube_side{
+    CUBE_OUTSIDE = 0,   // Definitely nothing inside (see cube_satisfies)
+    CUBE_PARTIAL = 1,   // Probably some inside
+    CUBE_INSIDE = 2     // Everything inside
+} cube_side;
+
+
+/*
+    False if the box with corners point1 and point2 is separated from the region of exact
+*/
+static inline bool exact_cull_overlaps(exact_cull* exact, vec3 point1, vec3 point2){
+    double tolerance = exact->tolerance;
+    vec3 center;
+    vec3 half;
+    for (int j = 0; j < 3; j++){
+        if (point2.pos[j] < exact->low.pos[j] - tolerance || point1.pos[j] > exact->high.pos[j] + tolerance) return false;
+        center.pos[j] = (point1.pos[j] + point2.pos[j])/2;
+        half.pos[j] = (point2.pos[j] - point1.pos[j])/2;
+    }
+
+    for (size_t a = 0; a < exact->num_axes; a++){
+        vec3 axis = exact->axes[a];
+        double mid = vec3_dot(axis, center);
+        double radius = fabs(axis.pos[0])*half.pos[0] + fabs(axis.pos[1])*half.pos[1] + fabs(axis.pos[2])*half.pos[2];
+        if (mid + radius < exact->axis_min[a] - tolerance || mid - radius > exact->axis_max[a] + tolerance) return false;
+    }
+    return true;
+}
+
+
+/*
+    Fills exact for cons clipped to the box point1 point2 (the bounds of the tree)
+    Returns false if the corners can't be found (empty, or too many), then only use the planes
+*/
+bool exact_cull_setup(exact_cull* exact, constraint* cons, vec3 point1, vec3 point2){
+    // The planes of the constraint and the 6 faces of the box
+    size_t num_planes = cons->num_planes + 6;
+    plane3* planes = malloc(num_planes*sizeof(plane3));
+    double* norm_size = malloc(num_planes*sizeof(double));
+    for (size_t i = 0; i < cons->num_planes; i++){
+        planes[i] = cons->planes[i];
+    }
+    for (int j = 0; j < 3; j++){
+        plane3 face = {{{0., 0., 0.}}, 0.};
+        face.norm.pos[j] = 1.;
+        face.dval = point1.pos[j];
+        planes[cons->num_planes + 2*j] = face;
+        face.norm.pos[j] = -1.;
+        face.dval = -point2.pos[j];
+        planes[cons->num_planes + 2*j + 1] = face;
+    }
+
+    // Rounding is relative to the size of the coordinates
+    double scale = 1.;
+    for (int j = 0; j < 3; j++){
+        scale = fmax(scale, fmax(fabs(point1.pos[j]), fabs(point2.pos[j])));
+    }
+    double eps = 1e-9*scale;
+    for (size_t i = 0; i < num_planes; i++){
+        norm_size[i] = fabs(planes[i].norm.pos[0]) + fabs(planes[i].norm.pos[1]) + fabs(planes[i].norm.pos[2]);
+    }
+
+    // Corners are where three planes meet inside all the others
+    vec3 corners[CULL_MAX_CORNERS];
+    size_t num_corners = 0;
+    bool ok = true;
+    for (size_t i = 0; i < num_planes && ok; i++){
+        for (size_t j = i+1; j < num_planes && ok; j++){
+            vec3 cross_ij = vec3_cross(planes[i].norm, planes[j].norm);
+            for (size_t k = j+1; k < num_planes && ok; k++){
+                vec3 cross_jk = vec3_cross(planes[j].norm, planes[k].norm);
+                vec3 cross_ki = vec3_cross(planes[k].norm, planes[i].norm);
+                double det = vec3_dot(planes[i].norm, cross_jk);
+                if (!(fabs(det) > 1e-12*norm_size[i]*norm_size[j]*norm_size[k])) continue;
+
+                vec3 corner;
+                for (int m = 0; m < 3; m++){
+                    corner.pos[m] = (planes[i].dval*cross_jk.pos[m] + planes[j].dval*cross_ki.pos[m]
+                                     + planes[k].dval*cross_ij.pos[m])/det;
+                }
+
+                bool inside = true;
+                for (size_t m = 0; m < num_planes && inside; m++){
+                    if (vec3_dot(planes[m].norm, corner) < planes[m].dval - eps*norm_size[m]) inside = false;
+                }
+                if (!inside) continue;
+
+                // Many planes can meet at one corner (the apex of a frustum)
+                bool seen = false;
+                for (size_t m = 0; m < num_corners && !seen; m++){
+                    vec3 diff = vec3_sub(corners[m], corner);
+                    if (fabs(diff.pos[0]) + fabs(diff.pos[1]) + fabs(diff.pos[2]) <= eps) seen = true;
+                }
+                if (seen) continue;
+
+                if (num_corners == CULL_MAX_CORNERS){
+                    ok = false;
+                } else {
+                    corners[num_corners++] = corner;
+                }
+            }
+        }
+    }
+
+    if (num_corners == 0) ok = false;
+
+    if (ok){
+        exact->low = corners[0];
+        exact->high = corners[0];
+        for (size_t m = 1; m < num_corners; m++){
+            for (int j = 0; j < 3; j++){
+                exact->low.pos[j] = fmin(exact->low.pos[j], corners[m].pos[j]);
+                exact->high.pos[j] = fmax(exact->high.pos[j], corners[m].pos[j]);
+            }
+        }
+        exact->tolerance = 4*eps;
+
+        // Edges are where two planes share at least two corners
+        exact->num_axes = 0;
+        for (size_t i = 0; i < num_planes; i++){
+            for (size_t j = i+1; j < num_planes; j++){
+                int shared = 0;
+                for (size_t m = 0; m < num_corners && shared < 2; m++){
+                    if (fabs(vec3_dot(planes[i].norm, corners[m]) - planes[i].dval) <= eps*norm_size[i]
+                        && fabs(vec3_dot(planes[j].norm, corners[m]) - planes[j].dval) <= eps*norm_size[j]) shared++;
+                }
+                if (shared < 2) continue;
+
+                vec3 edge = vec3_cross(planes[i].norm, planes[j].norm);
+                for (int b = 0; b < 3 && exact->num_axes < CULL_MAX_AXES; b++){
+                    vec3 box_axis = {{0., 0., 0.}};
+                    box_axis.pos[b] = 1.;
+                    vec3 axis = vec3_cross(edge, box_axis);
+                    double length = sqrt(vec3_dot(axis, axis));
+
+                    // Parallel to the box axis, or an axis of the box itself (those are low and high)
+                    if (!(length > 1e-12)) continue;
+                    int nonzero = 0;
+                    for (int m = 0; m < 3; m++){
+                        axis.pos[m] /= length;
+                        if (fabs(axis.pos[m]) > 1e-12) nonzero++;
+                    }
+                    if (nonzero < 2) continue;
+
+                    bool repeat = false;
+                    for (size_t a = 0; a < exact->num_axes && !repeat; a++){
+                        if (fabs(vec3_dot(axis, exact->axes[a])) > 1. - 1e-12) repeat = true;
+                    }
+                    if (repeat) continue;
+
+                    double axis_min = INFINITY;
+                    double axis_max = -INFINITY;
+                    for (size_t m = 0; m < num_corners; m++){
+                        double proj = vec3_dot(axis, corners[m]);
+                        axis_min = fmin(axis_min, proj);
+                        axis_max = fmax(axis_max, proj);
+                    }
+                    exact->axes[exact->num_axes] = axis;
+                    exact->axis_min[exact->num_axes] = axis_min;
+                    exact->axis_max[exact->num_axes] = axis_max;
+                    exact->num_axes++;
+                }
+            }
+        }
+    }
+
+    free(planes);
+    free(norm_size);
+    return ok;
+}
+
+
+/*
+    Corners of either kind of tree
+*/
+static inline void tree_bounds(const void* tree, vec3* point1, vec3* point2){
+    if (tree_kind(tree) == MOCT_LINEAR){
+        *point1 = ((const linoctree*)tree)->point1;
+        *point2 = ((const linoctree*)tree)->point2;
+    } else {
+        *point1 = ((const mocttree*)tree)->point1;
+        *point2 = ((const mocttree*)tree)->point2;
+    }
+}
+
+
+/*
+    Sets how queries of cons against tree cull boxes
+    exact is only filled (and kept by cons) for CULL_EXACT, it has to outlive the queries
+*/
+static inline void constraint_cull(constraint* cons, exact_cull* exact, cull_mode cull, const void* tree){
+    cons->exact = NULL;
+    if (cull != CULL_EXACT) return;
+
+    vec3 point1;
+    vec3 point2;
+    tree_bounds(tree, &point1, &point2);
+    if (exact_cull_setup(exact, cons, point1, point2)) cons->exact = exact;
+}
+
+
+/*
+    cube_satisfies and cube_fully_satisfies in one pass, only checking the active planes
+
+    Planes the cube fully satisfies are removed from active, so pass the result on
+    to the children
+*/
+cube_side cube_classify(constraint* cons, vec3 point1, vec3 point2, plane_mask* active){
+    cons->nodes_visited++;
+
+    bool partial = false;
+    vec3 inner;
+    vec3 outer;
+    for (int p = 0; p < cons->num_planes; p++){
+        if (!plane_active(*active, p)) continue;
+
+        plane3* plane = &cons->planes[p];
+        cube_extremes(plane, point1, point2, &inner, &outer);
+
+        // Written as not >= and not < so NaNs are treated the same as satisfies
+        if (!(vec3_dot(plane->norm, inner) >= plane->dval)) return CUBE_OUTSIDE;
+        if (!(vec3_dot(plane->norm, outer) < plane->dval)){
+            if (p < 64) *active &= ~((plane_mask)1<<p);
+        } else {
+            partial = true;
+        }
+    }
+
+    // The planes can't rule out a box near the edges of the region, the exact test can
+    if (partial && cons->exact != NULL && !exact_cull_overlaps(cons->exact, point1, point2)){
+        return CUBE_OUTSIDE;
+    }
+    return partial ? CUBE_PARTIAL : CUBE_INSIDE;
+}
+
+
 /*
     Check if the region defined by a cube with corners
     point1 and point2 has any satisfying space
@@ -54,21 +396,12 @@ bool satisfies(constraint* cons, vec3 point){
 
     False negatives are excedingly rare as the cubes become smaller, which they do so exponentially.
     So it does not matter, and we write ourselves a fast O(n) Algorithmn instead.
+
+    Only the corner furthest along each normal is checked (see cube_extremes)
 */
 bool cube_satisfies(constraint* cons, vec3 point1, vec3 point2){
-    vec3 temp;
-    for (int p = 0; p < cons->num_planes; p++){
-        int i;
-        for (i = 0; i < 8; i++){
-            // Creates every possible pairing of point1 and point2
-            temp.pos[0] = i&1 ? point1.pos[0] : point2.pos[0];
-            temp.pos[1] = i&2 ? point1.pos[1] : point2.pos[1];
-            temp.pos[2] = i&4 ? point1.pos[2] : point2.pos[2];
-            if (vec3_dot(cons->planes[p].norm, temp) >= cons->planes[p].dval) break; // If that pairing satisfies
-        }
-        if (i == 8) return false;
-    }
-    return true;
+    plane_mask active = ALL_PLANES;
+    return cube_classify(cons, point1, point2, &active) != CUBE_OUTSIDE;
 }
 
 
@@ -77,16 +410,9 @@ bool cube_satisfies(constraint* cons, vec3 point1, vec3 point2){
     search.
 
     Its true if all corners of the cube fully satisfy (shape is convex so all points inside
-    must too then).
+    must too then). Only the corner furthest against each normal is checked (see cube_extremes)
 */
 bool cube_fully_satisfies(constraint* cons, vec3 point1, vec3 point2){
-    vec3 temp;
-    for (int i = 0; i < 8; i++){
-        // Creates every possible pairing of point1 and point2
-        temp.pos[0] = i&1 ? point1.pos[0] : point2.pos[0];
-        temp.pos[1] = i&2 ? point1.pos[1] : point2.pos[1];
-        temp.pos[2] = i&4 ? point1.pos[2] : point2.pos[2];
-        if (!satisfies(cons, temp)) return false;
-    }
-    return true;
+    plane_mask active = ALL_PLANES;
+    return cube_classify(cons, point1, point2, &active) == CUBE_INSIDE;
 }
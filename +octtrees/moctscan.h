@@ -0,0 +1,163 @@
+/*
+    Measuring the top, left and right clearances of road points, the scan the
+    clearance scripts make (see query_clearances_moct_par.c)
+
+    The frusta of a road point share their walks of the tree (see moctpacket.h),
+    and the road points are measured in paralell using OpenMP
+*/
+
+#pragma once
+#include <omp.h>
+#include "moctpacket.h"
+#include "moctfrustum.h"
+
+
+/*
+    Everything needed to turn a road point into its scan frusta
+*/
+typedef struct scan_params{
+    double target_plane_width;
+    double observer_height;
+    double max_height;
+    double max_side;
+    size_t min_pts;
+    size_t kth;         // The clearance is the k-th closest (or lowest) point
+    size_t scantiles;
+    cull_mode cull;
+    double* h_offsets;  // Offsets of the top observers along leftwards
+    double* v_offsets;  // Offsets of the side observers along up
+} scan_params;
+
+
+/*
+    Space for the constraint of one frustum, a pyramid always has 5 planes
+*/
+typedef union scan_frustum{
+    uint8_t block_mem[5*sizeof(plane3) + sizeof(constraint)];
+    constraint c;
+} scan_frustum;
+
+
+/*
+    Fills the clearances of all scantiles for a single road point
+    The clearances are columns of scantiles doubles
+
+    The frusta of each direction are adjacent, so they are queried together
+    in packets (see moctpacket.h)
+    Returns the number of boxes checked
+*/
+size_t scan_road_point(void* tree, scan_params* params, vec3 road_point, vec3 forward, vec3 leftward,
+                       double* top_clearances, double* left_clearances, double* right_clearances){
+    scan_frustum frusta[PACKET_MAX];
+    clearance_query queries[PACKET_MAX];
+    exact_cull* exact = params->cull == CULL_EXACT ? malloc(PACKET_MAX*sizeof(exact_cull)) : NULL;
+
+    vec3 flat_leftward = {{leftward.pos[0], leftward.pos[1], 0.}};
+    vec3 up = {{0., 0., 1.}};
+    vec3 corners[4];
+    size_t nodes_visited = 0;
+
+    // A pointer tree is passed to each query, a linear one isn't
+    mocttree* pointer_tree = tree_kind(tree) == MOCT_POINTER ? (mocttree*)tree : NULL;
+
+    const scan_direction directions[3] = {SCAN_UP, SCAN_LEFT, SCAN_RIGHT};
+    double* clearances[3] = {top_clearances, left_clearances, right_clearances};
+
+    for (int d = 0; d < 3; d++){
+        scan_direction direction = directions[d];
+
+        for (size_t first = 0; first < params->scantiles; first += PACKET_MAX){
+            size_t num = params->scantiles - first < PACKET_MAX ? params->scantiles - first : PACKET_MAX;
+            vec3 low = {{INFINITY, INFINITY, INFINITY}};
+            vec3 high = {{-INFINITY, -INFINITY, -INFINITY}};
+
+            for (size_t k = 0; k < num; k++){
+                size_t j = first + k;
+                vec3 observer;
+                if (direction == SCAN_UP){
+                    // Top observers are spread along leftwards at observer height
+                    observer = vec3_add_scaled(road_point, up, params->observer_height);
+                    observer = vec3_add_scaled(observer, flat_leftward, params->h_offsets[j]*params->target_plane_width);
+                } else {
+                    // Side observers are stacked upwards from one unit above the road
+                    observer = vec3_add_scaled(road_point, up, 1. + params->v_offsets[j]*params->target_plane_width);
+                }
+
+                scan_target_corners(observer, forward, leftward, params->target_plane_width, direction,
+                                    params->max_height, params->max_side, corners);
+                // A pyramid is inside the bounds of its apex and corners
+                for (int c = 0; c < 5; c++){
+                    vec3 corner = c == 4 ? observer : corners[c];
+                    for (int m = 0; m < 3; m++){
+                        low.pos[m] = fmin(low.pos[m], corner.pos[m]);
+                        high.pos[m] = fmax(high.pos[m], corner.pos[m]);
+                    }
+                }
+
+                constraint* cons = &frusta[k].c;
+                frustum_constraint(observer, corners, cons);
+                constraint_cull(cons, exact == NULL ? NULL : exact + k, params->cull, tree);
+
+                // Top clearance is the height of the lowest point above the road,
+                // side clearance is the distance to the closest point
+                clearance_mode mode = direction == SCAN_UP ? CLEARANCE_LOWEST_Z : CLEARANCE_NEAREST;
+                clearance_start(&queries[k], cons, pointer_tree, mode, observer, params->kth, params->min_pts);
+            }
+
+            // Points on the faces can round to just outside the corners
+            for (int m = 0; m < 3; m++){
+                low.pos[m] -= 1e-9*fmax(fabs(low.pos[m]), 1.);
+                high.pos[m] += 1e-9*fmax(fabs(high.pos[m]), 1.);
+            }
+            packet_clearance_any(queries, num, tree, low, high);
+
+            for (size_t k = 0; k < num; k++){
+                size_t j = first + k;
+                double value = clearance_finish(&queries[k]);
+                if (direction == SCAN_UP){
+                    if (isinf(value)){
+                        clearances[d][j] = params->max_height;
+                    } else {
+                        clearances[d][j] = value - (queries[k].observer.pos[2] - params->observer_height);
+                    }
+                } else {
+                    clearances[d][j] = isinf(value) ? params->max_side : value;
+                }
+                nodes_visited += frusta[k].c.nodes_visited;
+            }
+        }
+    }
+
+    free(exact);
+    return nodes_visited;
+}
+
+
+/*
+    Fills the clearances of every road point, the road points, forwards and leftwards
+    are 3 x num_road_points and the clearances are scantiles x num_road_points
+    nodes_visited (the boxes checked for each road point) can be NULL
+
+    Call select_halfspace_kernel once before
+*/
+void scan_clearances(void* tree, scan_params* params, const double* road_arr, const double* forward_arr,
+                     const double* leftward_arr, size_t num_road_points,
+                     double* top_clearances, double* left_clearances, double* right_clearances,
+                     double* nodes_visited){
+    ptrdiff_t i;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (i = 0; i < (ptrdiff_t)num_road_points; i++){
+        vec3 road_point, forward, leftward;
+        for (int j = 0; j < 3; j++){
+            road_point.pos[j] = road_arr[3*i+j];
+            forward.pos[j] = forward_arr[3*i+j];
+            leftward.pos[j] = leftward_arr[3*i+j];
+        }
+
+        size_t column = i*params->scantiles;
+        size_t visited = scan_road_point(tree, params, road_point, forward, leftward,
+                                         top_clearances + column, left_clearances + column, right_clearances + column);
+        if (nodes_visited != NULL) nodes_visited[i] = (double)visited;
+    }
+}
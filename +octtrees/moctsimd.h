@@ -0,0 +1,231 @@
+/*
+    Vectorised point tests
+    Tests a run of points stored as separate x, y and z arrays against every plane of a
+    constraint at once, giving a bitmask of the points inside
+
+    The instruction set is picked when the MEX file runs (select_halfspace_kernel), so the
+    same build works on any x86-64 machine. Every kernel gives exactly the same result as
+    satisfies(), the dots are done in the same order and never fused (see MOCT_TARGET, the
+    builds pass -ffp-contract=off so satisfies() isn't fused either).
+*/
+
+#pragma once
+#include "moctquery.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+# define MOCT_X86 1
+# include <immintrin.h>
+# if defined(_MSC_VER)
+#  include <intrin.h>
+# endif
+#endif
+
+// GCC and clang will only emit the wider instructions in functions marked for them,
+// MSVC emits whatever intrinsics it is given. avx512f brings FMA with it and GCC fuses
+// a multiply and add into one by default, which rounds differently to satisfies(), so
+// fusing is turned off too (clang only fuses within one expression, MSVC never does)
+#if defined(MOCT_X86) && defined(__GNUC__) && !defined(__clang__)
+# define MOCT_TARGET(isa) __attribute__((target(isa), optimize("fp-contract=off")))
+#elif defined(MOCT_X86) && !defined(_MSC_VER)
+# define MOCT_TARGET(isa) __attribute__((target(isa)))
+#else
+# define MOCT_TARGET(isa)
+#endif
+
+// Most points a kernel tests at once, one bit each
+# define HALFSPACE_RUN 64
+
+
+/*
+    The instruction sets there are kernels for
+*/
+typedef enum simd_isa{
+    ISA_SCALAR = 0,
+    ISA_AVX2 = 1,
+    ISA_AVX512 = 2,
+    ISA_COUNT = 3
+} simd_isa;
+
+static const char* const isa_names[ISA_COUNT] = {"scalar", "avx2", "avx512"};
+
+
+/*
+    Bit i of the result is set if point i satisfies the active planes of cons
+    Requirements:
+    num_points <= HALFSPACE_RUN
+*/
+typedef uint64_t (*halfspace_kernel)(constraint* cons, plane_mask active, const double* x, const double* y,
+                                     const double* z, size_t num_points);
+
+
+/*
+    Number of bits set
+*/
+static inline int mask_count(uint64_t mask){
+    mask = mask - ((mask>>1)&0x5555555555555555ULL);
+    mask = (mask&0x3333333333333333ULL) + ((mask>>2)&0x3333333333333333ULL);
+    mask = (mask + (mask>>4))&0x0F0F0F0F0F0F0F0FULL;
+    return (int)((mask*0x0101010101010101ULL)>>56);
+}
+
+
+/*
+    Fallback, one point at a time
+*/
+static uint64_t halfspace_mask_scalar(constraint* cons, plane_mask active, const double* x, const double* y,
+                                      const double* z, size_t num_points){
+    uint64_t mask = 0;
+    for (size_t i = 0; i < num_points; i++){
+        vec3 point = {{x[i], y[i], z[i]}};
+        if (satisfies_active(cons, active, point)) mask |= 1ULL<<i;
+    }
+    return mask;
+}
+
+
+#ifdef MOCT_X86
+
+/*
+    4 points at a time
+*/
+MOCT_TARGET("avx2")
+static uint64_t halfspace_mask_avx2(constraint* cons, plane_mask active, const double* x, const double* y,
+                                    const double* z, size_t num_points){
+    uint64_t mask = 0;
+    size_t i = 0;
+    for (; i + 4 <= num_points; i += 4){
+        __m256d px = _mm256_loadu_pd(x + i);
+        __m256d py = _mm256_loadu_pd(y + i);
+        __m256d pz = _mm256_loadu_pd(z + i);
+        int inside = 0xF;
+        for (int p = 0; p < cons->num_planes && inside; p++){
+            if (!plane_active(active, p)) continue;
+            plane3* plane = &cons->planes[p];
+            __m256d dot = _mm256_mul_pd(_mm256_set1_pd(plane->norm.pos[0]), px);
+            dot = _mm256_add_pd(dot, _mm256_mul_pd(_mm256_set1_pd(plane->norm.pos[1]), py));
+            dot = _mm256_add_pd(dot, _mm256_mul_pd(_mm256_set1_pd(plane->norm.pos[2]), pz));
+            // Not less than, so a NaN passes like it does in satisfies()
+            inside &= _mm256_movemask_pd(_mm256_cmp_pd(dot, _mm256_set1_pd(plane->dval), _CMP_NLT_UQ));
+        }
+        mask |= (uint64_t)inside<<i;
+    }
+
+    // The last few
+    if (i < num_points){
+        mask |= halfspace_mask_scalar(cons, active, x + i, y + i, z + i, num_points - i)<<i;
+    }
+    return mask;
+}
+
+
+/*
+    8 points at a time, the tail is masked off instead of done one by one
+*/
+MOCT_TARGET("avx512f")
+static uint64_t halfspace_mask_avx512(constraint* cons, plane_mask active, const double* x, const double* y,
+                                      const double* z, size_t num_points){
+    uint64_t mask = 0;
+    for (size_t i = 0; i < num_points; i += 8){
+        __mmask8 inside = num_points - i >= 8 ? 0xFF : (__mmask8)((1u<<(num_points - i)) - 1);
+        __m512d px = _mm512_maskz_loadu_pd(inside, x + i);
+        __m512d py = _mm512_maskz_loadu_pd(inside, y + i);
+        __m512d pz = _mm512_maskz_loadu_pd(inside, z + i);
+        for (int p = 0; p < cons->num_planes && inside; p++){
+            if (!plane_active(active, p)) continue;
+            plane3* plane = &cons->planes[p];
+            __m512d dot = _mm512_mul_pd(_mm512_set1_pd(plane->norm.pos[0]), px);
+            dot = _mm512_add_pd(dot, _mm512_mul_pd(_mm512_set1_pd(plane->norm.pos[1]), py));
+            dot = _mm512_add_pd(dot, _mm512_mul_pd(_mm512_set1_pd(plane->norm.pos[2]), pz));
+            inside = _mm512_mask_cmp_pd_mask(inside, dot, _mm512_set1_pd(plane->dval), _CMP_NLT_UQ);
+        }
+        mask |= (uint64_t)inside<<i;
+    }
+    return mask;
+}
+
+
+/*
+    Whether the cpu and the os support an instruction set
+*/
+static bool isa_supported(simd_isa isa){
+    if (isa == ISA_SCALAR) return true;
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+
+    // The os has to save the wider registers too
+    __cpuid(info, 1);
+    bool osxsave = (info[2]&(1<<27)) != 0;
+    bool avx = (info[2]&(1<<28)) != 0;
+    if (!osxsave || !avx) return false;
+    unsigned long long xcr0 = _xgetbv(0);
+
+    __cpuidex(info, 7, 0);
+    if (isa == ISA_AVX2) return (xcr0&0x6) == 0x6 && (info[1]&(1<<5));
+    if (isa == ISA_AVX512) return (xcr0&0xE6) == 0xE6 && (info[1]&(1<<16));
+    return false;
+#else
+    __builtin_cpu_init();
+    if (isa == ISA_AVX2) return __builtin_cpu_supports("avx2");
+    if (isa == ISA_AVX512) return __builtin_cpu_supports("avx512f");
+    return false;
+#endif
+}
+
+#else
+
+static bool isa_supported(simd_isa isa){
+    return isa == ISA_SCALAR;
+}
+
+#endif
+
+
+/*
+    The kernel for an instruction set, NULL if there isn't one in this build
+*/
+static halfspace_kernel isa_kernel(simd_isa isa){
+    switch (isa){
+        case ISA_SCALAR: return halfspace_mask_scalar;
+#ifdef MOCT_X86
+        case ISA_AVX2: return halfspace_mask_avx2;
+        case ISA_AVX512: return halfspace_mask_avx512;
+#endif
+        default: return NULL;
+    }
+}
+
+
+// The kernel in use, starts as the fallback until select_halfspace_kernel is called
+static halfspace_kernel halfspace_mask = halfspace_mask_scalar;
+
+
+/*
+    Picks the widest kernel this machine can run
+    Call it at the start of a MEX function, before any threads are started
+*/
+static inline void select_halfspace_kernel(void){
+    // The cpu won't change while the MEX file is loaded
+    static bool selected = false;
+    if (selected) return;
+    selected = true;
+
+    for (int isa = ISA_COUNT - 1; isa >= 0; isa--){
+        if (isa_kernel((simd_isa)isa) != NULL && isa_supported((simd_isa)isa)){
+            halfspace_mask = isa_kernel((simd_isa)isa);
+            return;
+        }
+    }
+}
+
+
+/*
+    Mask of the points [first, first + num_points) of a linear tree inside the active planes of cons
+    Requirements:
+    num_points <= HALFSPACE_RUN
+*/
+static inline uint64_t linear_mask(constraint* cons, plane_mask active, linoctree* tree, size_t first, size_t num_points){
+    return halfspace_mask(cons, active, linear_coords(tree, 0) + first, linear_coords(tree, 1) + first,
+                          linear_coords(tree, 2) + first, num_points);
+}
@@ -0,0 +1,145 @@
+/*
+    Sorting for building trees and reading clouds
+    Keys are sorted along with the 32 bit indexes of where they came from
+*/
+
+#pragma once
+#include <string.h>
+#include <math.h>
+#include <omp.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "moctalloc.h"
+
+
+/*
+    Parallel LSD radix sort of keys (and their indexes), 8 bits at a time
+
+    The input is cut into a fixed number of chunks which are counted and scattered in
+    parallel, the chunks are always merged in order so the sort is stable and the
+    result does not depend on the number of threads
+
+    keys_tmp and index_tmp are scratch of the same size, the result always ends in keys and index
+*/
+void radix_sort_keys(uint64_t* keys, uint32_t* index, uint64_t* keys_tmp, uint32_t* index_tmp, size_t num_keys){
+    uint64_t* keys_out = keys;
+    uint32_t* index_out = index;
+    ptrdiff_t num_chunks = omp_get_max_threads();
+    size_t chunk_size = (num_keys + num_chunks - 1)/num_chunks;
+    size_t* offsets = moct_calloc(256*num_chunks, sizeof(size_t));
+
+    for (int shift = 0; shift < 64; shift += 8){
+        ptrdiff_t c;
+
+        #pragma omp parallel for schedule(static)
+        for (c = 0; c < num_chunks; c++){
+            size_t* count = offsets + 256*c;
+            size_t end = (c+1)*chunk_size < num_keys ? (c+1)*chunk_size : num_keys;
+            memset(count, 0, 256*sizeof(size_t));
+            for (size_t i = c*chunk_size; i < end; i++){
+                count[(keys[i]>>shift)&255]++;
+            }
+        }
+
+        // Turn the counts into where each chunk starts writing, digit major then chunk
+        size_t total = 0;
+        bool one_digit = false;
+        for (int d = 0; d < 256; d++){
+            size_t start = total;
+            for (c = 0; c < num_chunks; c++){
+                size_t count = offsets[256*c + d];
+                offsets[256*c + d] = total;
+                total += count;
+            }
+            if (total - start == num_keys) one_digit = true;
+        }
+
+        // Every key has the same digit, so this pass would not move anything
+        if (one_digit) continue;
+
+        #pragma omp parallel for schedule(static)
+        for (c = 0; c < num_chunks; c++){
+            size_t* offset = offsets + 256*c;
+            size_t end = (c+1)*chunk_size < num_keys ? (c+1)*chunk_size : num_keys;
+            for (size_t i = c*chunk_size; i < end; i++){
+                size_t pos = offset[(keys[i]>>shift)&255]++;
+                keys_tmp[pos] = keys[i];
+                index_tmp[pos] = index[i];
+            }
+        }
+
+        uint64_t* swap_keys = keys;
+        keys = keys_tmp;
+        keys_tmp = swap_keys;
+        uint32_t* swap_index = index;
+        index = index_tmp;
+        index_tmp = swap_index;
+    }
+
+    // An odd number of passes leaves the result in the scratch space
+    if (keys != keys_out){
+        memcpy(keys_out, keys, num_keys*sizeof(uint64_t));
+        memcpy(index_out, index, num_keys*sizeof(uint32_t));
+    }
+    moct_free(offsets);
+}
+
+
+/*
+    A key that sorts the same as value, NaN after everything like MATLAB's sort
+*/
+static inline uint64_t double_sort_key(double value){
+    if (isnan(value)) return UINT64_MAX;
+
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    // Negatives sort backwards by their bits, so flip them, and lift the positives above
+    return (bits>>63) ? ~bits : bits | ((uint64_t)1<<63);
+}
+
+
+/*
+    The order that sorts values (stable, like sort in MATLAB)
+    Returns a moct_malloc'd array of 0 based indexes, or NULL if values are already sorted
+
+    Requirements:
+    num_values <= UINT32_MAX
+*/
+uint32_t* sort_order_doubles(const double* values, size_t num_values){
+    bool sorted = true;
+    for (size_t i = 1; i < num_values && sorted; i++){
+        sorted = double_sort_key(values[i-1]) <= double_sort_key(values[i]);
+    }
+    if (sorted) return NULL;
+
+    uint64_t* keys = moct_malloc(2*num_values*sizeof(uint64_t) + 1);
+    uint32_t* index = moct_malloc(2*num_values*sizeof(uint32_t) + 1);
+
+    ptrdiff_t i;
+    #pragma omp parallel for schedule(static)
+    for (i = 0; i < (ptrdiff_t)num_values; i++){
+        keys[i] = double_sort_key(values[i]);
+        index[i] = (uint32_t)i;
+    }
+
+    radix_sort_keys(keys, index, keys + num_values, index + num_values, num_values);
+    moct_free(keys);
+    return index;
+}
+
+
+/*
+    Reorders rows of row_bytes each in place (through a copy), row i becomes row order[i]
+*/
+void permute_rows(void* rows, size_t row_bytes, const uint32_t* order, size_t num_rows){
+    uint8_t* data = rows;
+    uint8_t* copy = moct_malloc(num_rows*row_bytes + 1);
+    memcpy(copy, data, num_rows*row_bytes);
+
+    ptrdiff_t i;
+    #pragma omp parallel for schedule(static)
+    for (i = 0; i < (ptrdiff_t)num_rows; i++){
+        memcpy(data + (size_t)i*row_bytes, copy + (size_t)order[i]*row_bytes, row_bytes);
+    }
+    moct_free(copy);
+}
@@ -0,0 +1,463 @@
+/*
+    The trajectory of a drive
+    Road points evenly spaced along the path of the vehicle, and their forwards, upwards
+    and leftwards
+    camera_path_magic.m uses these through trajmoct.c and query_upwards_moct_par.c (see
+    road_upwards.m), and cli/clearances.c uses them directly
+
+    Every array of vectors here is 3 x N (x y z of each in turn), like the arguments of
+    query_clearances_moct_par
+*/
+
+#pragma once
+#include <math.h>
+#include <omp.h>
+#include "mocttree.h"
+#include "moctlas.h"
+#include "moctnormal.h"
+#include "moctalloc.h"
+
+// Half the time window (seconds) each scanner's path is smoothed over
+# define TRAJ_SMOOTH_WINDOW 0.5
+
+// Distance either way the heading is fitted over
+# define TRAJ_HEADING_REACH 10.
+
+// Road points each thread finds the forwards of at a time, see traj_forwards
+# define TRAJ_SEGMENT 4096
+
+// Fewest points in a floor box to fit the road's plane to
+# define TRAJ_FLOOR_MIN 10
+
+// Least upwards component of a fitted normal, steeper is noise (25 degrees)
+# define TRAJ_MAX_TILT 0.9
+
+
+/*
+    Running sums of a scanner's path for traj_smooth_add
+    The path is cut into blocks shorter than the smoothing window (in time), every point
+    has the sums from the start of its block up to it, in powers of its time after the
+    block's first time and with its point less the path's first point, so the sums stay
+    small and any run of points is a difference within each block it crosses
+*/
+typedef struct traj_sums{
+    double t[5];        // Sums of t^0 (the count) to t^4
+    double rt[3][3];    // Sums of r t^0 to r t^2, each of x y z
+} traj_sums;
+
+
+/*
+    Adds the sums of the points [from, to] of a block, whose running sums are sums and
+    whose first point is first, shifted to times about t_0
+    (t + delta)^p is expanded (binomially) to sums of the times about the block's start
+*/
+static void traj_sums_add(const traj_sums* sums, size_t first, size_t from, size_t to, double delta, traj_sums* total){
+    traj_sums part = sums[to];
+    if (from > first){
+        for (int p = 0; p < 5; p++){
+            part.t[p] -= sums[from-1].t[p];
+        }
+        for (int j = 0; j < 3; j++){
+            for (int p = 0; p < 3; p++){
+                part.rt[j][p] -= sums[from-1].rt[j][p];
+            }
+        }
+    }
+
+    const double binomial[5][5] = {{1, 0, 0, 0, 0}, {1, 1, 0, 0, 0}, {1, 2, 1, 0, 0}, {1, 3, 3, 1, 0}, {1, 4, 6, 4, 1}};
+    double powers[5] = {1., delta, delta*delta, delta*delta*delta, delta*delta*delta*delta};
+    for (int p = 0; p < 5; p++){
+        for (int q = 0; q <= p; q++){
+            double factor = binomial[p][q]*powers[p-q];
+            total->t[p] += factor*part.t[q];
+            if (p < 3){
+                for (int j = 0; j < 3; j++){
+                    total->rt[j][p] += factor*part.rt[j][q];
+                }
+            }
+        }
+    }
+}
+
+
+/*
+    First index of the sorted times ts[0, n) at or after t, n if there is none
+*/
+static size_t traj_lower_bound(const double* ts, size_t n, double t){
+    size_t first = 0;
+    while (n > 0){
+        size_t half = n/2;
+        if (ts[first + half] < t){
+            first += half + 1;
+            n -= half + 1;
+        } else {
+            n = half;
+        }
+    }
+    return first;
+}
+
+
+/*
+    Resamples one scanner's path (times ts, points rs 3 x n, sorted by time) to new_ts
+    (sorted by time), the least squares quadratic in time over the points within window
+    of each new time, at least 4 points, evaluated at that time
+    The results are added to new_rs (3 x num_new)
+
+    The sums of each fit come from the running sums of the blocks its points cross (see
+    traj_sums), so a fit takes the same time however many points it has, and the new
+    times are fitted in parallel
+
+    Requirements:
+    n >= 4
+*/
+void traj_smooth_add(const double* ts, const double* rs, size_t n, const double* new_ts, size_t num_new,
+                     double window, double* new_rs){
+    traj_sums* sums = moct_malloc(n*sizeof(traj_sums));
+    size_t* block_first = moct_malloc(n*sizeof(size_t));   // First point of the block of each point
+    size_t* block_end = moct_malloc(n*sizeof(size_t));     // And one past its last
+    const double* origin = rs;
+
+    size_t first = 0;
+    for (size_t k = 0; k < n; k++){
+        if (ts[k] - ts[first] >= window) first = k;
+        block_first[k] = first;
+
+        double t = ts[k] - ts[first];
+        double r[3];
+        for (int j = 0; j < 3; j++){
+            r[j] = rs[3*k+j] - origin[j];
+        }
+        traj_sums add = {{1., t, t*t, t*t*t, t*t*t*t}, {{r[0], r[0]*t, r[0]*t*t}, {r[1], r[1]*t, r[1]*t*t}, {r[2], r[2]*t, r[2]*t*t}}};
+        if (k > first){
+            for (int p = 0; p < 5; p++){
+                add.t[p] += sums[k-1].t[p];
+            }
+            for (int j = 0; j < 3; j++){
+                for (int p = 0; p < 3; p++){
+                    add.rt[j][p] += sums[k-1].rt[j][p];
+                }
+            }
+        }
+        sums[k] = add;
+    }
+    for (size_t k = n; k-- > 0;){
+        block_end[k] = k + 1 == n || block_first[k+1] != block_first[k] ? k + 1 : block_end[k+1];
+    }
+
+    ptrdiff_t i;
+    #pragma omp parallel for schedule(static)
+    for (i = 0; i < (ptrdiff_t)num_new; i++){
+        double t_0 = new_ts[i];
+
+        // The same points as sliding the window along the new times, keeping it
+        // off the end and at least 4 points
+        size_t index_end = traj_lower_bound(ts, n, t_0 + window);
+        if (index_end > n - 1) index_end = n - 1;
+        if (index_end < 3) index_end = 3;
+        size_t index_start = traj_lower_bound(ts, n, t_0 - window);
+        if (index_start > index_end - 3) index_start = index_end - 3;
+
+        traj_sums total;
+        memset(&total, 0, sizeof(traj_sums));
+        size_t from = index_start;
+        while (from <= index_end){
+            size_t block = block_first[from];
+            size_t next = block_end[from] < index_end + 1 ? block_end[from] : index_end + 1;
+            traj_sums_add(sums, block, from, next - 1, ts[block] - t_0, &total);
+            from = next;
+        }
+
+        double count = total.t[0];
+        double st = total.t[1], st2 = total.t[2], st3 = total.t[3], st4 = total.t[4];
+
+        // Cramer's rule for the constant of the quadratic
+        double det_denom = st4*st2*count + st3*st*st2 + st2*st3*st - st2*st2*st2 - st3*st3*count - st4*st*st;
+        for (int j = 0; j < 3; j++){
+            double sr = total.rt[j][0], srt = total.rt[j][1], srt2 = total.rt[j][2];
+            double det_num = st4*st2*sr + st3*srt*st2 + srt2*st3*st - srt2*st2*st2 - st3*st3*sr - st4*srt*st;
+            new_rs[3*i+j] += det_num/det_denom + origin[j];
+        }
+    }
+
+    moct_free(sums);
+    moct_free(block_first);
+    moct_free(block_end);
+}
+
+
+/*
+    The road points of a drive, made from the points straight down from the scanners
+    (scan angle rank 0) of points sorted by time
+    Each scanner's path is smoothed and resampled to the times of the scanner with the most
+    points, they are averaged, and the average is resampled to a point every point_density
+
+    Sets road_points to a moct_malloc'd 3 x num_road_points array
+    Returns NULL, or why there can't be a trajectory
+*/
+const char* traj_road_points(const las_columns* points, size_t num_points, double point_density,
+                             double** road_points, size_t* num_road_points){
+    // Split the path by scanner, in order of their ids, each stays sorted by time
+    size_t* scanner_count = moct_calloc(65536, sizeof(size_t));
+    for (size_t i = 0; i < num_points; i++){
+        if (points->scan_angle_rank[i] == 0) scanner_count[points->point_source_ID[i]]++;
+    }
+
+    size_t num_scanners = 0;
+    size_t num_path = 0;
+    size_t most = 0;
+    size_t most_start = 0;
+    size_t* scanner_start = moct_malloc(65536*sizeof(size_t));
+    for (size_t id = 0; id < 65536; id++){
+        scanner_start[id] = num_path;
+        if (scanner_count[id] == 0) continue;
+        if (scanner_count[id] < 4){
+            moct_free(scanner_count);
+            moct_free(scanner_start);
+            return "A scanner has fewer than 4 points with a scan angle rank of 0, too few to make a trajectory";
+        }
+        if (scanner_count[id] > most){
+            most = scanner_count[id];
+            most_start = num_path;
+        }
+        num_scanners++;
+        num_path += scanner_count[id];
+    }
+    if (num_scanners == 0){
+        moct_free(scanner_count);
+        moct_free(scanner_start);
+        return "No points with a scan angle rank of 0, cannot make a trajectory";
+    }
+
+    double* path_times = moct_malloc(num_path*sizeof(double));
+    double* path_points = moct_malloc(3*num_path*sizeof(double));
+    size_t* fill = moct_malloc(65536*sizeof(size_t));
+    memcpy(fill, scanner_start, 65536*sizeof(size_t));
+    for (size_t i = 0; i < num_points; i++){
+        if (points->scan_angle_rank[i] != 0) continue;
+        size_t k = fill[points->point_source_ID[i]]++;
+        path_times[k] = points->gps_time[i];
+        for (int j = 0; j < 3; j++){
+            path_points[3*k+j] = points->coords[j][i];
+        }
+    }
+    moct_free(fill);
+
+    // Every scanner is smoothed and resampled to the times of the one with the most points
+    double* smooth = moct_calloc(3*most, sizeof(double));
+    for (size_t id = 0; id < 65536; id++){
+        if (scanner_count[id] == 0) continue;
+        size_t start = scanner_start[id];
+        traj_smooth_add(path_times + start, path_points + 3*start, scanner_count[id],
+                        path_times + most_start, most, TRAJ_SMOOTH_WINDOW, smooth);
+    }
+    for (size_t i = 0; i < 3*most; i++){
+        smooth[i] /= (double)num_scanners;
+    }
+    moct_free(path_times);
+    moct_free(path_points);
+    moct_free(scanner_count);
+    moct_free(scanner_start);
+
+    // Distance along the smoothed path, the points at repeated distances are dropped
+    double* distances = moct_malloc(most*sizeof(double));
+    size_t num_unique = 1;
+    distances[0] = 0.;
+    double total_distance = 0.;
+    for (size_t i = 1; i < most; i++){
+        double step = 0.;
+        for (int j = 0; j < 3; j++){
+            double d = smooth[3*i+j] - smooth[3*(i-1)+j];
+            step += d*d;
+        }
+        total_distance += sqrt(step);
+        if (total_distance > distances[num_unique-1]){
+            distances[num_unique] = total_distance;
+            memmove(smooth + 3*num_unique, smooth + 3*i, 3*sizeof(double));
+            num_unique++;
+        }
+    }
+
+    // Linearly resampled a point every point_density
+    size_t total_points = 1 + (size_t)floor(total_distance/point_density);
+    double* road = moct_malloc(3*total_points*sizeof(double));
+    size_t k = 0;
+    for (size_t i = 0; i < total_points; i++){
+        double d = i + 1 == total_points ? total_distance : (double)i*(total_distance/(double)(total_points - 1));
+        while (k + 2 < num_unique && distances[k+1] < d) k++;
+
+        if (num_unique == 1){
+            memcpy(road + 3*i, smooth, 3*sizeof(double));
+            continue;
+        }
+        double along = (d - distances[k])/(distances[k+1] - distances[k]);
+        for (int j = 0; j < 3; j++){
+            road[3*i+j] = smooth[3*k+j] + along*(smooth[3*(k+1)+j] - smooth[3*k+j]);
+        }
+    }
+    moct_free(distances);
+    moct_free(smooth);
+
+    *road_points = road;
+    *num_road_points = total_points;
+    return NULL;
+}
+
+
+/*
+    The forwards (unit) of each road point, the least squares slope of the road points
+    within TRAJ_HEADING_REACH either way, the window is shifted to stay inside the road
+
+    The road is cut into segments of TRAJ_SEGMENT road points, done in parallel. Each
+    segment sums its first window, then slides it along a point at a time, so a road
+    point takes the same time however long the window is. The sums are taken about the
+    first point of the segment's first window, which the slope doesn't depend on, and
+    starting again every segment keeps the rounding of the sliding from adding up
+*/
+void traj_forwards(const double* road_points, size_t num_road_points, double point_density, double* forwards){
+    size_t window = (size_t)ceil(TRAJ_HEADING_REACH/point_density);
+    size_t points_per = 2*window + 1;
+    if (points_per > num_road_points) points_per = num_road_points;
+    size_t num_segments = (num_road_points + TRAJ_SEGMENT - 1)/TRAJ_SEGMENT;
+
+    ptrdiff_t s;
+    #pragma omp parallel for schedule(dynamic)
+    for (s = 0; s < (ptrdiff_t)num_segments; s++){
+        size_t begin = (size_t)s*TRAJ_SEGMENT;
+        size_t end = begin + TRAJ_SEGMENT < num_road_points ? begin + TRAJ_SEGMENT : num_road_points;
+
+        size_t first = begin > window ? begin - window : 0;
+        if (first + points_per > num_road_points) first = num_road_points - points_per;
+        const double* origin = road_points + 3*first;
+
+        // Sum of the window's points, and of each times its place in it (1 based)
+        double sum[3] = {0., 0., 0.}, moment[3] = {0., 0., 0.};
+        for (size_t k = 0; k < points_per; k++){
+            for (int j = 0; j < 3; j++){
+                double r = road_points[3*(first + k)+j] - origin[j];
+                sum[j] += r;
+                moment[j] += (double)(k + 1)*r;
+            }
+        }
+
+        for (size_t i = begin; i < end; i++){
+            size_t want = i > window ? i - window : 0;
+            if (want + points_per > num_road_points) want = num_road_points - points_per;
+            // Every point moves down a place, and the next comes in last
+            for (; first < want; first++){
+                for (int j = 0; j < 3; j++){
+                    double r = road_points[3*(first + points_per)+j] - origin[j];
+                    moment[j] += (double)points_per*r - sum[j];
+                    sum[j] += r - (road_points[3*first+j] - origin[j]);
+                }
+            }
+
+            // Least squares slope times a fixed constant
+            double slope[3];
+            for (int j = 0; j < 3; j++){
+                slope[j] = moment[j] - sum[j]*(double)(points_per + 1)/2;
+            }
+            double length = sqrt(slope[0]*slope[0] + slope[1]*slope[1] + slope[2]*slope[2]);
+            for (int j = 0; j < 3; j++){
+                forwards[3*i+j] = slope[j]/length;
+            }
+        }
+    }
+}
+
+
+/*
+    The eigenvector of the smallest eigenvalue of a symmetric 3x3 matrix (cyclic Jacobi)
+*/
+static void traj_smallest_eigenvector(double a[3][3], double vector[3]){
+    double v[3][3] = {{1., 0., 0.}, {0., 1., 0.}, {0., 0., 1.}};
+    for (int sweep = 0; sweep < 50; sweep++){
+        double off = a[0][1]*a[0][1] + a[0][2]*a[0][2] + a[1][2]*a[1][2];
+        if (off == 0.) break;
+
+        for (int p = 0; p < 2; p++){
+            for (int q = p + 1; q < 3; q++){
+                if (a[p][q] == 0.) continue;
+                double theta = (a[q][q] - a[p][p])/(2*a[p][q]);
+                double t = (theta >= 0 ? 1. : -1.)/(fabs(theta) + sqrt(theta*theta + 1.));
+                double c = 1./sqrt(t*t + 1.);
+                double s = t*c;
+                for (int k = 0; k < 3; k++){
+                    double akp = a[k][p], akq = a[k][q];
+                    a[k][p] = c*akp - s*akq;
+                    a[k][q] = s*akp + c*akq;
+                }
+                for (int k = 0; k < 3; k++){
+                    double apk = a[p][k], aqk = a[q][k];
+                    a[p][k] = c*apk - s*aqk;
+                    a[q][k] = s*apk + c*aqk;
+                }
+                for (int k = 0; k < 3; k++){
+                    double vkp = v[k][p], vkq = v[k][q];
+                    v[k][p] = c*vkp - s*vkq;
+                    v[k][q] = s*vkp + c*vkq;
+                }
+            }
+        }
+    }
+
+    int smallest = 0;
+    for (int k = 1; k < 3; k++){
+        if (a[k][k] < a[smallest][smallest]) smallest = k;
+    }
+    for (int k = 0; k < 3; k++){
+        vector[k] = v[k][smallest];
+    }
+}
+
+
+/*
+    The upwards (unit) of each road point, the normal of the plane fitted to the points
+    of the tree in a box of floor_box_edge around it (affine_fit.m), or straight up where
+    there are too few points or the fit tilts too far
+    The tree can be either kind, the points in each box are summed up as they are found
+    (moctnormal.h), nothing is copied or sorted
+
+    Returns how many fits tilted too far
+*/
+size_t traj_upwards(const void* tree, const double* road_points, size_t num_road_points, double floor_box_edge,
+                    double* upwards){
+    size_t num_tilted = 0;
+    ptrdiff_t i;
+    #pragma omp parallel for schedule(dynamic, 64) reduction(+:num_tilted)
+    for (i = 0; i < (ptrdiff_t)num_road_points; i++){
+        vec3 road_point, low, high;
+        for (int j = 0; j < 3; j++){
+            road_point.pos[j] = road_points[3*i+j];
+            low.pos[j] = road_point.pos[j] - floor_box_edge/2;
+            high.pos[j] = road_point.pos[j] + floor_box_edge/2;
+        }
+
+        box_moments moments;
+        box_moments_any(tree, low, high, road_point, &moments);
+
+        double normal[3] = {0., 0., 1.};
+        if (moments.count > TRAJ_FLOOR_MIN){
+            double scatter[3][3];
+            moments_scatter(&moments, scatter);
+            traj_smallest_eigenvector(scatter, normal);
+
+            // The sign of an eigenvector is arbitrary, so the tilt is checked either way up
+            double length = sqrt(normal[0]*normal[0] + normal[1]*normal[1] + normal[2]*normal[2]);
+            if (fabs(normal[2])/length < TRAJ_MAX_TILT){
+                normal[0] = 0.;
+                normal[1] = 0.;
+                normal[2] = 1.;
+                num_tilted++;
+            }
+        }
+
+        // Make sure the normals point up
+        double length = sqrt(normal[0]*normal[0] + normal[1]*normal[1] + normal[2]*normal[2]);
+        double sign = normal[2] < 0 ? -1. : 1.;
+        for (int j = 0; j < 3; j++){
+            upwards[3*i+j] = sign*normal[j]/length;
+        }
+    }
+    return num_tilted;
+}
@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <math.h>
 
 /*
     Points for the octtree
@@ -39,6 +40,50 @@ static inline double vec3_dot(vec3 point1, vec3 point2){
 }
 
 
+/*
+    Vector difference
+*/
+static inline vec3 vec3_sub(vec3 point1, vec3 point2){
+    vec3 ret;
+    for (int i = 0; i < 3; i++){
+        ret.pos[i] = point1.pos[i] - point2.pos[i];
+    }
+    return ret;
+}
+
+
+/*
+    Vector cross
+*/
+static inline vec3 vec3_cross(vec3 point1, vec3 point2){
+    vec3 ret;
+    ret.pos[0] = point1.pos[1]*point2.pos[2] - point1.pos[2]*point2.pos[1];
+    ret.pos[1] = point1.pos[2]*point2.pos[0] - point1.pos[0]*point2.pos[2];
+    ret.pos[2] = point1.pos[0]*point2.pos[1] - point1.pos[1]*point2.pos[0];
+    return ret;
+}
+
+
+#ifdef MOCT_COMPACT
+
+/*
+    Each item is a struct
+    Compact items store the point as integer steps on the tree's grid (see mocttree.grid_step),
+    offset by GRID_BIAS so they fit unsigned, and a 32 bit index
+    Half the size of a full item, so a node holds twice as many
+*/
+typedef struct item{
+    uint32_t index;
+    uint32_t grid[3];
+} item;
+
+// Items per node, 10*16 = 160 bytes
+#ifndef MOCT_BUCKET
+# define MOCT_BUCKET 10
+#endif
+
+#else
+
 /*
     Each item is a struct
 */
@@ -47,6 +92,47 @@ typedef struct item{
     struct vec3 point;
 } item;
 
+// Items per node, 5*32 = 160 bytes
+#ifndef MOCT_BUCKET
+# define MOCT_BUCKET 5
+#endif
+
+#endif
+
+
+/*
+    MOCT_BUCKET can be set when building (-DMOCT_BUCKET=n, see build_mex_files.m) to trade
+    deeper trees for longer leaves, every file must be built with the same one.
+    Only the default keeps octnode at 256 bytes.
+
+    Deepest level a node can be at, the root is level 0, set the same way
+    A node this deep never gets children, the points past its bucket go into one
+    contiguous overflow array of the node instead (see node_items). Without it near
+    duplicate points (the vehicle stopped, several scanners) make a chain of nearly
+    empty nodes one level deeper for every bucket of them.
+*/
+#ifndef MOCT_MAX_DEPTH
+# define MOCT_MAX_DEPTH 21
+#endif
+
+
+/*
+    Which layout a tree pointer is to
+    Every tree struct starts with its kind, so the query functions can tell them apart
+*/
+typedef enum moct_kind{
+    MOCT_POINTER = 0,   // mocttree, nodes linked by pointers (moct_calloc leaves this as 0)
+    MOCT_LINEAR = 1     // linoctree, see moctlinear.h
+} moct_kind;
+
+
+/*
+    Kind of the tree behind a pointer from MATLAB
+*/
+static inline moct_kind tree_kind(const void* tree){
+    return *(const moct_kind*)tree;
+}
+
 
 /*
     Designed for good cache behaviour
@@ -56,21 +142,82 @@ typedef struct octnode{ // 256 bytes large
     uint32_t num_elements;          // 4 bytes
     uint32_t num_total_elements;    // 4 bytes
     struct vec3 midpoint;           // 24 bytes
-    struct item bucket[5];          // 5*32 = 160 bytes
+    union {
+        struct item bucket[MOCT_BUCKET];// 160 bytes
+        struct {                    // Once num_elements > MOCT_BUCKET, only at MOCT_MAX_DEPTH
+            struct item* items;     // The bucket, then the rest
+            size_t space;
+        } overflow;
+    };
     struct octnode* children[8];    // 8*8 = 64 bytes
 } octnode;
 
 
+/*
+    The num_elements items of a node, its bucket unless it overflowed
+*/
+static inline item* node_items(octnode* node){
+    return node->num_elements > MOCT_BUCKET ? node->overflow.items : node->bucket;
+}
+
+
+/*
+    Corners of child octant of a node with the box point1 point2
+    Split at the node's midpoint, which is where insert_node splits it (the root of a
+    tree that grew isn't the middle of its box, see grow_tree)
+    X Y Z reverse indexing
+*/
+static inline void octnode_child_box(const octnode* node, int octant, vec3 point1, vec3 point2,
+                                     vec3* child1, vec3* child2){
+    for (int j = 0; j < 3; j++){
+        if (octant&(1<<j)){
+            child1->pos[j] = node->midpoint.pos[j];
+            child2->pos[j] = point2.pos[j];
+        } else {
+            child1->pos[j] = point1.pos[j];
+            child2->pos[j] = node->midpoint.pos[j];
+        }
+    }
+}
+
+
+/*
+    Points that were added to a tree together, all with the same source id
+    Their indexes are [first, first + count), low and high bound every one of them
+*/
+typedef struct tree_batch{
+    uint32_t source_id;
+    size_t first;
+    size_t count;
+    struct vec3 low;
+    struct vec3 high;
+} tree_batch;
+
+
 /*
     Main structure of the C function
 */
 typedef struct mocttree{
+    moct_kind kind; // Always MOCT_POINTER
+
     // Corners
     // for every element point1 <= point2
     struct vec3 point1;
     struct vec3 point2;
     struct octnode* root; // Always has a root
-    size_t num_elements;
+    size_t num_elements;  // Points given to the tree, the index of the last one
+
+    // Points added together (see append_tree), so they can be dropped again
+    struct tree_batch* batches;
+    size_t num_batches;
+
+    // Grid the points of compact items are stored on (unused otherwise)
+    // point = (grid_step*(grid - GRID_BIAS) + grid_origin) - grid_shift, the arithmetic a
+    // las reader does on the integers of a file (its scale, offset, then any translation)
+    struct vec3 grid_step;
+    struct vec3 grid_origin;
+    struct vec3 grid_shift;
+    bool grid_exact;    // Given a las grid, every point must be on it (see tree_can_hold)
     
     // For memory
     size_t space_chunks; // Points to last avaible
@@ -82,3 +229,83 @@ typedef struct mocttree{
     // Its technically a pointer to an array of pointers to octnodes (sorta), but the alignments
     // are off so indexing will corrupt data.
 } mocttree;
+
+
+// Grid steps are signed like the integers of a las file, stored plus this
+# define GRID_BIAS 2147483648.
+
+
+/*
+    Coordinate axis of grid step (signed, GRID_BIAS already taken off)
+*/
+static inline double grid_coord(const mocttree* tree, int axis, double step){
+    return (tree->grid_step.pos[axis]*step + tree->grid_origin.pos[axis]) - tree->grid_shift.pos[axis];
+}
+
+
+/*
+    The grid step nearest to coordinate axis of a point, clamped to the grid
+    When the point is on the grid this is its step exactly: the nearest one and its
+    neighbours are decoded and whichever gives back the coordinate is taken
+*/
+static inline double grid_nearest(const mocttree* tree, int axis, double coord){
+    double step = floor(((coord + tree->grid_shift.pos[axis]) - tree->grid_origin.pos[axis])/tree->grid_step.pos[axis] + 0.5);
+    if (!(step > -GRID_BIAS)) step = -GRID_BIAS;    // Also catches NaN
+    if (step > GRID_BIAS - 1.) step = GRID_BIAS - 1.;
+    if (grid_coord(tree, axis, step) != coord){
+        if (step > -GRID_BIAS && grid_coord(tree, axis, step - 1.) == coord){
+            step -= 1.;
+        } else if (step < GRID_BIAS - 1. && grid_coord(tree, axis, step + 1.) == coord){
+            step += 1.;
+        }
+    }
+    return step;
+}
+
+
+/*
+    True if a compact item stores point exactly, it is on the tree's grid
+*/
+static inline bool grid_holds(const mocttree* tree, vec3 point){
+    for (int i = 0; i < 3; i++){
+        if (grid_coord(tree, i, grid_nearest(tree, i, point.pos[i])) != point.pos[i]) return false;
+    }
+    return true;
+}
+
+
+/*
+    The point of an item
+    Compact items are decoded from the grid with the same arithmetic a las reader uses,
+    so a point read from a file on the grid comes back exactly (see grid_holds)
+*/
+static inline vec3 item_point(const mocttree* tree, const item* it){
+#ifdef MOCT_COMPACT
+    vec3 ret;
+    for (int i = 0; i < 3; i++){
+        ret.pos[i] = grid_coord(tree, i, (double)it->grid[i] - GRID_BIAS);
+    }
+    return ret;
+#else
+    return it->point;
+#endif
+}
+
+
+/*
+    Makes an item for a point
+    Compact items snap the point to the nearest grid point, anything off the grid is clamped
+*/
+static inline item make_item(const mocttree* tree, size_t index, vec3 point){
+    item ret;
+#ifdef MOCT_COMPACT
+    ret.index = (uint32_t)index;
+    for (int i = 0; i < 3; i++){
+        ret.grid[i] = (uint32_t)(grid_nearest(tree, i, point.pos[i]) + GRID_BIAS);
+    }
+#else
+    ret.index = index;
+    ret.point = point;
+#endif
+    return ret;
+}
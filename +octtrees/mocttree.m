@@ -5,35 +5,92 @@ classdef mocttree < handle
     
     properties (Access = private)
         tree_ptr = uint64(0);
+        mapped = false;     % Mapped from a file by load, unmapped instead of freed
+        file = '';          % The file the tree is saved in, if any, see saveobj
+        file_key = uint64(0);
+        temporary = false;  % file was made by saveobj, deleted with the tree
     end
     
     methods
-        function obj = mocttree(points)
+        function obj = mocttree(points, build_mode, grid)
             %MOCTTREE Construct an instance of this class
             % Constructs an octree from an 3xM matrix of points or Mx3 matrix.
             % For a 3x3 its assumed to be 3xM
-            points = double(points);
-            if ~ismatrix(points)
-                error('Not a matrix')
+            % Or from a struct with x, y and z columns (like readlas
+            % gives), which are used without copying them into a matrix
+            %
+            % build_mode is optional
+            % 'insert' - (default) inserts the points one at a time
+            % 'bulk' - sorts the points in parallel and builds the tree in
+            %          one pass, much faster for large clouds
+            % 'linear' - sorted like 'bulk' but stored as a linear octree,
+            %            a single flat block without pointers. The queries
+            %            are the same, the indexes may come in another order
+            % 'tight' - a 'linear' octree that also keeps the tight box of
+            %           the points under every node. The same results, but
+            %           fewer boxes are checked, and the lowest point of a
+            %           box fully inside a region is known without its points
+            %
+            % grid is only used by 'insert' and 'bulk' trees when the MEX
+            % files are built with compact leaves (see build_mex_files.m),
+            % and those trees must be given one, the linear trees always
+            % keep the points as they are. Points are stored as whole
+            % steps k on a grid,
+            % each coordinate being (scale*k + offset) - shift, the way las
+            % readers decode a file. grid is [scales offsets shifts], e.g.
+            % [x_scale_factor y_scale_factor z_scale_factor x_offset
+            % y_offset z_offset 0 0 0] from the las header, with the
+            % offsets as the shifts too if they were subtracted from the
+            % points, or just the 3 scales (no offset or shift). It is an
+            % error for a point not to be on the grid, or for a compact
+            % tree to have no grid (rounding the points to one could move
+            % them across the edge of a region and change the results)
+            %
+            % With no arguments there is no tree, see load
+            if nargin == 0
+                return;
             end
-            
-            if (size(points, 1) ~= 3)
-                if size(points, 2) == 3
-                    points = points';
-                else
-                    error('Invalid dimensions')
+            if nargin < 2
+                build_mode = 'insert';
+            end
+            if nargin < 3
+                grid = [];
+            end
+            if ~any(strcmp(build_mode, {'insert', 'bulk', 'linear', 'tight'}))
+                error('Build mode must be insert, bulk, linear or tight');
+            end
+
+            if isstruct(points)
+                % Passed on as a cell of the columns
+                points = {double(points.x(:)), double(points.y(:)), double(points.z(:))};
+                min_pointz = cellfun(@min, points, 'UniformOutput', false);
+                max_pointz = cellfun(@max, points, 'UniformOutput', false);
+                min_pointz = [min_pointz{:}]';
+                max_pointz = [max_pointz{:}]';
+            else
+                points = double(points);
+                if ~ismatrix(points)
+                    error('Not a matrix')
                 end
+
+                if (size(points, 1) ~= 3)
+                    if size(points, 2) == 3
+                        points = points';
+                    else
+                        error('Invalid dimensions')
+                    end
+                end
+
+
+                % Points is now formatted like this
+                % [ x1 x2 x3 ... ]
+                % [ y1 y2 y3 ... ]
+                % [ z1 z2 z3 ... ]
+
+                min_pointz = min(points, [], 2);
+                max_pointz = max(points, [], 2);
             end
             
-            
-            % Points is now formatted like this
-            % [ x1 x2 x3 ... ]
-            % [ y1 y2 y3 ... ]
-            % [ z1 z2 z3 ... ]
-            
-            min_pointz = min(points, [], 2);
-            max_pointz = max(points, [], 2);
-            
             if (isempty(min_pointz))
                 min_pointz = [0 0 0];
             end
@@ -42,9 +99,56 @@ classdef mocttree < handle
                 max_pointz = [1 1 1];
             end
             
-            obj.tree_ptr = octtrees.createfreemoct(points, min_pointz, max_pointz);
+            if isempty(grid)
+                obj.tree_ptr = octtrees.createfreemoct(points, min_pointz, max_pointz, char(build_mode));
+            else
+                if numel(grid) ~= 3 && numel(grid) ~= 9
+                    error('Grid must be a vector of length 3 or 9');
+                end
+                obj.tree_ptr = octtrees.createfreemoct(points, min_pointz, max_pointz, char(build_mode), double(grid(:)));
+            end
         end
         
+        function num_added = append(obj, points, source_id)
+            % Adds points to a tree built with 'insert' or 'bulk' without
+            % building it again, e.g. another pass or the next las file.
+            % Takes time proportional to the points added, and the tree
+            % grows to hold any outside of it.
+            %
+            % Points that aren't finite are left out with a warning, as
+            % are those a compact tree (see build_mex_files.m) can't
+            % hold, off the las grid it was built with.
+            % num_added says how many went in
+            %
+            % points are like the constructor's (3xM, Mx3 or a struct with
+            % x, y and z columns). They are numbered after every point the
+            % tree was given before, so the indexes the queries give are
+            % into all the points given in order (concatenate them).
+            %
+            % source_id is a whole number naming the points for drop, the
+            % points the tree was built with are source 0
+            if isstruct(points)
+                points = {double(points.x(:)), double(points.y(:)), double(points.z(:))};
+            else
+                points = double(points);
+                if size(points, 1) ~= 3
+                    if size(points, 2) == 3
+                        points = points';
+                    else
+                        error('Invalid dimensions')
+                    end
+                end
+            end
+            num_added = octtrees.updatemoct('append', obj.tree_ptr, points, double(source_id));
+        end
+
+        function num_dropped = drop(obj, source_id)
+            % Removes every point added with source_id (see append), only
+            % the part of the tree around them is visited. The rest keep
+            % their indexes
+            num_dropped = octtrees.updatemoct('drop', obj.tree_ptr, double(source_id));
+        end
+
         function num_points = query_rect_count(obj, point1, point2)
             % Query points inside a rectangular area given as a bound
             % between two points
@@ -108,7 +212,7 @@ classdef mocttree < handle
             point_indexes = octtrees.query_index_moct(obj.tree_ptr, constrain_mat);
         end
         
-        function num_points = query_planes_count(obj, constraints)
+        function [num_points, nodes_visited] = query_planes_count(obj, constraints, cull)
             % Query points inside a region given by a number of constraints
             % constraints are planes with the equation
             % ax + by + cz >= d
@@ -120,6 +224,16 @@ classdef mocttree < handle
             % [ d1 d2 d3 ... ]
             %
             % If constraits is 4x4 its assumed to be 4xN
+            %
+            % cull is optional, how the tree's boxes are ruled out
+            % 'planes' - (default) a box is skipped if it is fully outside
+            %            one of the planes
+            % 'exact' - also skips boxes outside the region near its edges,
+            %           fewer boxes for thin or slanted regions like frusta
+            % nodes_visited is the number of boxes checked, to compare them
+            if nargin < 3
+                cull = 'planes';
+            end
             
             constraints = double(constraints);
             
@@ -131,10 +245,10 @@ classdef mocttree < handle
                 end
             end
             
-            num_points = octtrees.query_count_moct(obj.tree_ptr, constraints);
+            [num_points, nodes_visited] = octtrees.query_count_moct(obj.tree_ptr, constraints, octtrees.mocttree.cull_code(cull));
         end
         
-        function point_indexes = query_planes_index(obj, constraints)
+        function [point_indexes, nodes_visited] = query_planes_index(obj, constraints, cull)
             % Query points inside a region given by a number of constraints
             % constraints are planes with the equation
             % ax + by + cz >= d
@@ -146,6 +260,11 @@ classdef mocttree < handle
             % [ d1 d2 d3 ... ]
             %
             % If constraits is 4x4 its assumed to be 4xN
+            %
+            % cull is optional, see query_planes_count
+            if nargin < 3
+                cull = 'planes';
+            end
             
             constraints = double(constraints);
             
@@ -157,10 +276,163 @@ classdef mocttree < handle
                 end
             end
             
-            point_indexes = octtrees.query_index_moct(obj.tree_ptr, constraints);
+            [point_indexes, nodes_visited] = octtrees.query_index_moct(obj.tree_ptr, constraints, octtrees.mocttree.cull_code(cull));
         end
-        
-        function num_points = query_planes_count_par(obj, cell_constraints)
+
+        function [lowest_z, nodes_visited] = query_planes_lowest_z(obj, constraints, min_pts, cull, kth)
+            % Lowest z of the points inside a region given by a number of
+            % constraints, computed without returning the points.
+            % constraints are planes with the equation
+            % ax + by + cz >= d
+            %
+            % Constraints is a 4xN or Nx4 Matrix of doubles, see
+            % query_planes_index
+            %
+            % If fewer than min_pts points are inside the region it is
+            % considered noise and Inf is returned
+            %
+            % cull is optional, see query_planes_count
+            %
+            % kth is optional, the k-th lowest z is returned instead (at
+            % most 16), so a few stray points don't set the clearance
+            if nargin < 4
+                cull = 'planes';
+            end
+            if nargin < 5
+                kth = 1;
+            end
+
+            constraints = double(constraints);
+
+            if size(constraints, 1) ~= 4
+                if size(constraints, 2) == 4
+                    constraints = constraints';
+                else
+                    error('Bad inputs size, must be a 4xN or Nx4  Matrix');
+                end
+            end
+
+            [lowest_z, nodes_visited] = octtrees.query_clearance_moct(obj.tree_ptr, constraints, 0, [0 0 0], double(min_pts), ...
+                octtrees.mocttree.cull_code(cull), double(kth));
+        end
+
+        function [distance, nodes_visited] = query_planes_nearest(obj, constraints, observer, min_pts, cull, kth)
+            % Closest distance from observer to the points inside a region
+            % given by a number of constraints, computed without returning
+            % the points.
+            % constraints are planes with the equation
+            % ax + by + cz >= d
+            %
+            % Constraints is a 4xN or Nx4 Matrix of doubles, see
+            % query_planes_index
+            %
+            % If fewer than min_pts points are inside the region it is
+            % considered noise and Inf is returned
+            %
+            % cull is optional, see query_planes_count
+            %
+            % kth is optional, the distance to the k-th closest point is
+            % returned instead (at most 16)
+            if nargin < 5
+                cull = 'planes';
+            end
+            if nargin < 6
+                kth = 1;
+            end
+
+            constraints = double(constraints);
+            observer = double(observer);
+
+            if size(constraints, 1) ~= 4
+                if size(constraints, 2) == 4
+                    constraints = constraints';
+                else
+                    error('Bad inputs size, must be a 4xN or Nx4  Matrix');
+                end
+            end
+
+            if ~isvector(observer) || length(observer) ~= 3
+                error('Bad inputs, the observer must be a vector of length 3');
+            end
+
+            [distance, nodes_visited] = octtrees.query_clearance_moct(obj.tree_ptr, constraints, 1, observer, double(min_pts), ...
+                octtrees.mocttree.cull_code(cull), double(kth));
+        end
+
+        function [top_clearances, left_clearances, right_clearances, nodes_visited] = query_scan_clearances(obj, ...
+                road_points, forwards, leftwards, h_offsets, v_offsets, ...
+                target_plane_width, observer_height, max_height, max_side, min_pts, cull, kth)
+            % Measures the top, left and right clearance of every scantile
+            % of every road point in a single parallel call.
+            %
+            % road_points, forwards and leftwards are Nx3 (or 3xN)
+            % For a 3x3 its assumed to be Nx3 like the clearance scripts
+            % h_offsets and v_offsets are the observer offsets along the
+            % scan line, one per scantile (in target plane widths)
+            %
+            % The results are scantiles x N matrices, a scantile with
+            % fewer than min_pts points is given max_height or max_side
+            %
+            % cull is optional, see query_planes_count. nodes_visited is
+            % 1xN, the boxes checked for each road point
+            %
+            % kth is optional, each clearance is taken from the k-th lowest
+            % or closest point instead (at most 16)
+            if nargin < 12
+                cull = 'planes';
+            end
+            if nargin < 13
+                kth = 1;
+            end
+
+            road_points = double(road_points);
+            forwards = double(forwards);
+            leftwards = double(leftwards);
+
+            if size(road_points, 2) == 3
+                road_points = road_points';
+                forwards = forwards';
+                leftwards = leftwards';
+            end
+
+            if size(road_points, 1) ~= 3 || ~isequal(size(road_points), size(forwards), size(leftwards))
+                error('Bad inputs size, road_points, forwards and leftwards must all be Nx3');
+            end
+
+            if numel(h_offsets) ~= numel(v_offsets)
+                error('Bad inputs size, h_offsets and v_offsets must be the same length');
+            end
+
+            params = double([target_plane_width, observer_height, max_height, max_side, min_pts, kth]);
+            [top_clearances, left_clearances, right_clearances, nodes_visited] = octtrees.query_clearances_moct_par(obj.tree_ptr, ...
+                road_points, forwards, leftwards, double(h_offsets), double(v_offsets), params, octtrees.mocttree.cull_code(cull));
+        end
+
+        function [upwards, num_tilted] = query_upwards(obj, road_points, floor_box_edge)
+            % The up direction of the road at every road point in a single
+            % parallel call, the normal of the plane fitted to the points
+            % in a box of floor_box_edge around it (like affine_fit)
+            %
+            % road_points is Nx3 (or 3xN), for a 3x3 its assumed to be Nx3
+            % upwards is Nx3 unit normals pointing up, [0 0 1] where the box
+            % has 10 or fewer points or the fit tilts more than 25 degrees.
+            % num_tilted is how many tilted too far
+            road_points = double(road_points);
+            transposed = size(road_points, 2) == 3;
+            if transposed
+                road_points = road_points';
+            end
+            if size(road_points, 1) ~= 3
+                error('Bad inputs size, road_points must be Nx3');
+            end
+
+            [upwards, num_tilted] = octtrees.query_upwards_moct_par(obj.tree_ptr, road_points, double(floor_box_edge));
+            if transposed
+                upwards = upwards';
+            end
+        end
+
+        function [num_points, nodes_visited] = query_planes_count_par(obj, cell_constraints, cull)
             % Query points inside a region given by a number of constraints
             % does it in parallel using a cell array of constraints
             
@@ -174,15 +446,21 @@ classdef mocttree < handle
             % [ d1 d2 d3 ... ]
             %
             % If constraits is 4x4 its assumed to be 4xN
+            %
+            % cull is optional, see query_planes_count
+            if nargin < 3
+                cull = 'planes';
+            end
             
             if (isempty(cell_constraints))
                 num_points = double.empty(0,1);
+                nodes_visited = double.empty(0,1);
                 return;
             end
             
             % Apply a check and fix to each cell_constraint
             cell_constraints = cellfun(@checkcons, cell_constraints);
-            num_points = octtrees.query_count_moct_par(obj.tree_ptr, cell_constraints);
+            [num_points, nodes_visited] = octtrees.query_count_moct_par(obj.tree_ptr, cell_constraints, octtrees.mocttree.cull_code(cull));
             
             function cons_double = checkcons(cons_double)
                 cons_double = double(cons_double);
@@ -199,7 +477,42 @@ classdef mocttree < handle
             end
         end
         
-        function num_points = query_planes_count_par_lim(obj, cell_constraints, limit)
+        function [point_indexes, nodes_visited] = query_planes_index_par(obj, cell_constraints, cull)
+            % Query the points inside many regions, each given by a number
+            % of constraints, in parallel using a cell array of constraints
+            % like query_planes_count_par
+            %
+            % point_indexes is a cell array the same shape as
+            % cell_constraints, each the indexes query_planes_index gives
+            %
+            % cull is optional, see query_planes_count
+            if nargin < 3
+                cull = 'planes';
+            end
+            
+            if (isempty(cell_constraints))
+                point_indexes = cell(0,1);
+                nodes_visited = double.empty(0,1);
+                return;
+            end
+            
+            % Apply a check and fix to each cell_constraint
+            for i = 1:numel(cell_constraints)
+                cell_constraints{i} = double(cell_constraints{i});
+                if size(cell_constraints{i}, 1) ~= 4
+                    if size(cell_constraints{i}, 2) == 4
+                        cell_constraints{i} = cell_constraints{i}';
+                    else
+                        error('Bad inputs size, must be a 4xN or Nx4  Matrix');
+                    end
+                end
+            end
+            
+            [point_indexes, nodes_visited] = octtrees.query_index_moct_par(obj.tree_ptr, cell_constraints, ...
+                octtrees.mocttree.cull_code(cull));
+        end
+        
+        function [num_points, nodes_visited, saturated] = query_planes_count_par_lim(obj, cell_constraints, limit, cull)
             % Query points inside a region given by a number of constraints
             % does it in parallel using a cell array of constraints
             
@@ -213,11 +526,28 @@ classdef mocttree < handle
             % [ d1 d2 d3 ... ]
             %
             % If constraits is 4x4 its assumed to be 4xN
+            %
+            % Each count stops once it reaches limit, a scalar for all of
+            % them or one per constraint (e.g. a different min_pts for
+            % each direction). saturated is true where it did, those
+            % counts are at least the limit but not the full count, so
+            % saturated alone tells which regions hold at least limit
+            % points, much faster than counting or finding them all
+            %
+            % cull is optional, see query_planes_count
+            if nargin < 4
+                cull = 'planes';
+            end
             
             if (isempty(cell_constraints))
                 num_points = double.empty(0,1);
+                nodes_visited = double.empty(0,1);
+                saturated = false(0,1);
                 return;
             end
+            if ~isscalar(limit) && numel(limit) ~= numel(cell_constraints)
+                error('Bad inputs size, limit must be a scalar or one per constraint');
+            end
             
             % Apply a check and fix to each cell_constraint
             for i = 1:numel(cell_constraints)
@@ -231,13 +561,129 @@ classdef mocttree < handle
                 end
             end
             
-            num_points = octtrees.query_count_moct_par_lim(obj.tree_ptr, cell_constraints, uint64(limit));
+            [num_points, nodes_visited, saturated] = octtrees.query_count_moct_par_lim(obj.tree_ptr, cell_constraints, uint64(limit), ...
+                octtrees.mocttree.cull_code(cull));
         end
         
+        function save(obj, filename, key)
+            % Writes the tree to filename so a later run can load it
+            % instead of building it again. Only trees built with 'linear'
+            % or 'tight' can be saved
+            %
+            % key is a uint64 from cache_key, load only accepts the file
+            % with the same key
+            octtrees.filemoct('save', obj.tree_ptr, char(filename), uint64(key));
+            obj.forget_temporary();
+            obj.file = char(filename);
+            obj.file_key = uint64(key);
+        end
+        function s = saveobj(obj)
+            % Called when the tree is sent to parpool workers (or saved in
+            % a .mat file). Only the name of the file the tree is in is
+            % sent, and each worker maps that file read only (see load), so
+            % the workers on this machine all share the one copy the
+            % operating system caches instead of building their own.
+            %
+            % A tree that isn't in a file yet is saved to a temporary one
+            % the first time, which is deleted with the tree. Only trees
+            % built with 'linear' or 'tight' can be sent, and only to
+            % workers that can see this machine's files (process pools,
+            % not clusters)
+            if obj.tree_ptr ~= 0 && isempty(obj.file)
+                % The file is only ever this tree's, any key will do
+                filename = [tempname '.moct'];
+                octtrees.filemoct('save', obj.tree_ptr, filename, obj.tree_ptr);
+                obj.file = filename;
+                obj.file_key = obj.tree_ptr;
+                obj.temporary = true;
+            end
+            s.file = obj.file;
+            s.key = obj.file_key;
+        end
+
         function delete(obj)
             % Delete the tree, and the underlying object
             if(obj.tree_ptr ~= 0)
-                octtrees.createfreemoct(obj.tree_ptr);
+                if obj.mapped
+                    octtrees.filemoct('unmap', obj.tree_ptr);
+                else
+                    octtrees.createfreemoct(obj.tree_ptr);
+                end
+            end
+            obj.forget_temporary();
+        end
+    end
+
+    methods (Static)
+        function obj = load(filename, key)
+            % The tree saved in filename, mapped read only so nothing is
+            % read until the queries need it
+            %
+            % Returns [] if there is no file, or it was saved with another
+            % key or by another version, build the tree again then
+            tree_ptr = octtrees.filemoct('map', char(filename), uint64(key));
+            if tree_ptr == 0
+                obj = [];
+                return;
+            end
+
+            obj = octtrees.mocttree();
+            obj.tree_ptr = tree_ptr;
+            obj.mapped = true;
+            obj.file = char(filename);
+            obj.file_key = uint64(key);
+        end
+        function obj = loadobj(s)
+            % The tree sent by saveobj, mapped from its file
+            if isempty(s.file)
+                obj = octtrees.mocttree();
+                return;
+            end
+            obj = octtrees.mocttree.load(s.file, s.key);
+            if isempty(obj)
+                error('Mocttree:loadobj', 'The tree file %s is gone or was changed', s.file);
+            end
+        end
+
+        function key = cache_key(points, settings)
+            % A uint64 hash of the points a tree is built from and the
+            % settings that made them (a vector of numbers), for save
+            % and load
+            %
+            % points is a matrix, or a struct with x, y and z columns
+            if isstruct(points)
+                points = {double(points.x), double(points.y), double(points.z)};
+            else
+                points = double(points);
+            end
+            key = octtrees.filemoct('key', points, double(settings));
+        end
+    end
+
+    methods (Access = private)
+        function forget_temporary(obj)
+            % Deletes the file saveobj made, the workers mapping it keep
+            % their pages until they are done
+            if obj.temporary
+                if isfile(obj.file)
+                    delete(obj.file);
+                end
+                obj.file = '';
+                obj.temporary = false;
+            end
+        end
+    end
+    methods (Static, Access = private)
+        function code = cull_code(cull)
+            % The MEX files take the cull mode as a number, see cull_mode
+            % in moctquery.h
+            switch cull
+                case 'planes'
+                    code = 0;
+                case 'exact'
+                    code = 1;
+                otherwise
+                    error('Cull must be planes or exact');
             end
         end
     end
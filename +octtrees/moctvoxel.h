@@ -0,0 +1,105 @@
+/*
+    Thinning a cloud to a point per voxel
+    Used by voxelmoct.c (decimate_points.m) and cli/clearances.c
+
+    The voxels are a fixed grid of cubes with a corner at the origin, so the same point
+    falls in the same voxel whichever part of the cloud it is thinned with (tiles that
+    overlap keep the same points). The points are radix sorted by voxel (moctsort.h),
+    then every run of points in the same voxel keeps one of them.
+*/
+
+#pragma once
+#include "moctsort.h"
+
+
+// Bits of the voxel number along each axis, the cloud can span 2^21 voxels each way
+# define VOXEL_BITS 21
+
+
+/*
+    Which point of a voxel is kept
+*/
+typedef enum voxel_mode{
+    VOXEL_FIRST = 0,    // The first (in the order of the points, by time for a loaded cloud)
+    VOXEL_LOWEST = 1    // The lowest, a top clearance never rises by more than the voxel
+} voxel_mode;
+
+
+/*
+    Marks the points to keep in keep, one in every voxel of voxel_size, returns how many
+    Points with a scan_angle_rank of 0 (the path of the scanners, see mocttraj.h) are
+    always kept and don't count toward their voxel, scan_angle_rank can be NULL
+
+    Returns SIZE_MAX if the cloud spans more than 2^VOXEL_BITS voxels along an axis
+
+    Requirements:
+    num_points <= UINT32_MAX
+    voxel_size > 0
+*/
+size_t voxel_keep(const double* const coords[3], const int16_t* scan_angle_rank, size_t num_points,
+                  double voxel_size, voxel_mode mode, bool* keep){
+    // Voxel numbers are taken from the lowest voxel of the cloud
+    double low[3] = {INFINITY, INFINITY, INFINITY};
+    double high[3] = {-INFINITY, -INFINITY, -INFINITY};
+    for (size_t i = 0; i < num_points; i++){
+        for (int j = 0; j < 3; j++){
+            low[j] = fmin(low[j], coords[j][i]);
+            high[j] = fmax(high[j], coords[j][i]);
+        }
+    }
+    double first_voxel[3];
+    for (int j = 0; j < 3; j++){
+        first_voxel[j] = floor(low[j]/voxel_size);
+        if (num_points > 0 && floor(high[j]/voxel_size) - first_voxel[j] >= (double)((uint64_t)1<<VOXEL_BITS)){
+            return SIZE_MAX;
+        }
+    }
+
+    uint64_t* keys = moct_malloc(2*num_points*sizeof(uint64_t) + 1);
+    uint32_t* index = moct_malloc(2*num_points*sizeof(uint32_t) + 1);
+
+    // The kept path goes after every voxel
+    ptrdiff_t i;
+    #pragma omp parallel for schedule(static)
+    for (i = 0; i < (ptrdiff_t)num_points; i++){
+        uint64_t key = UINT64_MAX;
+        if (scan_angle_rank == NULL || scan_angle_rank[i] != 0){
+            key = 0;
+            for (int j = 0; j < 3; j++){
+                uint64_t cell = (uint64_t)(floor(coords[j][i]/voxel_size) - first_voxel[j]);
+                key |= cell<<(VOXEL_BITS*j);
+            }
+        }
+        keys[i] = key;
+        index[i] = (uint32_t)i;
+    }
+
+    // Stable, so each voxel's points stay in order
+    radix_sort_keys(keys, index, keys + num_points, index + num_points, num_points);
+
+    size_t num_kept = 0;
+    #pragma omp parallel for schedule(static) reduction(+:num_kept)
+    for (i = 0; i < (ptrdiff_t)num_points; i++){
+        if (keys[i] == UINT64_MAX){
+            keep[index[i]] = true;
+            num_kept++;
+            continue;
+        }
+        // Each voxel is decided (all of its points) at its first point
+        if (i > 0 && keys[i-1] == keys[i]) continue;
+
+        size_t end = (size_t)i + 1;
+        size_t chosen = (size_t)i;
+        for (; end < num_points && keys[end] == keys[i]; end++){
+            if (mode == VOXEL_LOWEST && coords[2][index[end]] < coords[2][index[chosen]]) chosen = end;
+        }
+        for (size_t k = (size_t)i; k < end; k++){
+            keep[index[k]] = k == chosen;
+        }
+        num_kept++;
+    }
+
+    moct_free(keys);
+    moct_free(index);
+    return num_kept;
+}
@@ -0,0 +1,103 @@
+/*
+    Query the clearance inside a region of a moct tree
+    The lowest point or closest point is found during the traversal, so
+    the indexes never have to go back to MATLAB
+*/
+
+#include <mex.h>
+#include <matrix.h>
+#include "moctclearance.h"
+
+
+/*
+    This is entrypoint for this file
+    in matlab it must be called as
+    [clearance, nodes_visited] = query_clearance_moct(uint64 to a moct, constraints, mode, observer, min_pts, cull, kth)
+
+    If you pass an invalid moct you will cause
+    the program to segfault, so be careful.
+
+    The moct can be either kind of tree, see moctlinear.h
+
+    The constraints are a 4xN array of coefficents for planes
+    [ a0 a1 a2 a3 ... ]
+    [ b0 b1 b2 b3 ... ]
+    [ c0 c1 c2 c3 ... ]
+    [ d0 d1 d2 d3 ... ]
+    The region each plane considers is
+    ax + by + cz >= d
+
+    A point must satisfy all planes to be included
+
+    mode is a double
+    0 - returns the lowest z of the points in the region (top clearance)
+    1 - returns the closest distance from observer to the points in the region (side clearance)
+
+    observer is an array of 3 doubles, it is ignored for mode 0
+
+    If fewer than min_pts points are in the region Inf is returned
+
+    kth is optional, the k-th lowest z (or k-th closest distance) is returned instead,
+    1 (the default) to CLEARANCE_MAX_K
+
+    cull is optional, how boxes of the tree are ruled out (see query_count_moct)
+    nodes_visited is the number of boxes checked
+*/
+void mexFunction(int nlhs, mxArray *plhs[],
+                 int nrhs, const mxArray *prhs[]){
+    if (nrhs < 5 || nrhs > 7){
+        mexErrMsgIdAndTxt("Mocttree:query_clearance:nrhs", "Bad arguments");
+    }
+
+    select_halfspace_kernel();
+
+    void* tree = (void*)(mxGetUint64s(prhs[0])[0]);
+
+    double* planearray = mxGetDoubles(prhs[1]);
+    size_t num_planes = mxGetN(prhs[1]);
+
+    clearance_mode mode = (clearance_mode)mxGetScalar(prhs[2]);
+    if (mode != CLEARANCE_LOWEST_Z && mode != CLEARANCE_NEAREST){
+        mexErrMsgIdAndTxt("Mocttree:query_clearance:mode", "Mode must be 0 (lowest z) or 1 (nearest)");
+    }
+
+    double* observerarr = mxGetDoubles(prhs[3]);
+    vec3 observer;
+    for (int i = 0; i < 3; i++){
+        observer.pos[i] = observerarr[i];
+    }
+
+    size_t min_pts = (size_t)mxGetScalar(prhs[4]);
+
+    cull_mode cull = nrhs >= 6 ? (cull_mode)mxGetScalar(prhs[5]) : CULL_PLANES;
+    if (cull != CULL_PLANES && cull != CULL_EXACT){
+        mexErrMsgIdAndTxt("Mocttree:query_clearance:cull", "cull must be 0 (planes) or 1 (exact)");
+    }
+
+    size_t kth = nrhs == 7 ? (size_t)mxGetScalar(prhs[6]) : 1;
+    if (kth < 1 || kth > CLEARANCE_MAX_K){
+        mexErrMsgIdAndTxt("Mocttree:query_clearance:kth", "kth must be 1 to %d", CLEARANCE_MAX_K);
+    }
+
+    constraint* cons = mxMalloc(num_planes*sizeof(plane3) + sizeof(constraint));
+    constraint_init(cons, num_planes);
+
+    for (int i = 0; i < num_planes; i++){
+        cons->planes[i].norm.pos[0] = planearray[4*i+0];    // a
+        cons->planes[i].norm.pos[1] = planearray[4*i+1];    // b
+        cons->planes[i].norm.pos[2] = planearray[4*i+2];    // c
+        cons->planes[i].dval = planearray[4*i+3];           // d
+    }
+
+    exact_cull exact;
+    constraint_cull(cons, &exact, cull, tree);
+
+    double clearance = clearance_any(cons, tree, mode, observer, kth, min_pts);
+    size_t nodes_visited = cons->nodes_visited;
+    mxFree(cons);
+
+    plhs[0] = mxCreateDoubleScalar(clearance);
+    if (nlhs > 1){
+        plhs[1] = mxCreateDoubleScalar((double)nodes_visited);
+    }
+}
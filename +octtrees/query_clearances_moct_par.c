@@ -0,0 +1,107 @@
+/*
+    Measure the top, left and right clearances of every scantile of every road point
+    in one call, see moctscan.h
+*/
+
+#include <mex.h>
+#include <matrix.h>
+#include "moctscan.h"
+
+
+/*
+    This is entrypoint for this file
+    in matlab it must be called as
+    [top, left, right, nodes_visited] = query_clearances_moct_par(uint64 to a moct, road_points, forwards, leftwards,
+                                                                  h_offsets, v_offsets, params, cull)
+
+    If you pass an invalid moct you will cause
+    the program to segfault, so be careful.
+
+    The moct can be either kind of tree, see moctlinear.h
+
+    road_points, forwards and leftwards are 3xN arrays
+    [ x1 x2 x3 ... ]
+    [ y1 y2 y3 ... ]
+    [ z1 z2 z3 ... ]
+
+    h_offsets and v_offsets are arrays of scantiles doubles, the offsets of each observer
+    (in target plane widths) from the road point.
+
+    params is an array of 5 or 6 doubles
+    [ target_plane_width, observer_height, max_height, max_side, min_pts, kth ]
+    kth is optional, the k-th lowest (closest) point is used instead of the lowest (closest),
+    1 (the default) to CLEARANCE_MAX_K
+
+    The three results are scantiles x N, the same as the clearance scripts
+
+    cull is optional, how boxes of the tree are ruled out (see query_count_moct)
+    nodes_visited is 1 x N, the number of boxes checked for each road point
+*/
+void mexFunction(int nlhs, mxArray *plhs[],
+                 int nrhs, const mxArray *prhs[]){
+    if (nrhs != 7 && nrhs != 8){
+        mexErrMsgIdAndTxt("Mocttree:query_clearances:nrhs", "Bad arguments");
+    }
+
+    select_halfspace_kernel();
+
+    void* tree = (void*)(mxGetUint64s(prhs[0])[0]);
+
+    double* road_arr = mxGetDoubles(prhs[1]);
+    double* forward_arr = mxGetDoubles(prhs[2]);
+    double* leftward_arr = mxGetDoubles(prhs[3]);
+    size_t num_road_points = mxGetN(prhs[1]);
+
+    if (mxGetM(prhs[1]) != 3 || mxGetM(prhs[2]) != 3 || mxGetM(prhs[3]) != 3){
+        mexErrMsgIdAndTxt("Mocttree:query_clearances:size", "road_points, forwards and leftwards must be 3xN");
+    }
+    if (mxGetN(prhs[2]) != num_road_points || mxGetN(prhs[3]) != num_road_points){
+        mexErrMsgIdAndTxt("Mocttree:query_clearances:size", "Every road point needs a forwards and leftwards");
+    }
+
+    if (mxGetNumberOfElements(prhs[4]) != mxGetNumberOfElements(prhs[5])){
+        mexErrMsgIdAndTxt("Mocttree:query_clearances:size", "h_offsets and v_offsets must be the same length");
+    }
+
+    size_t num_params = mxGetNumberOfElements(prhs[6]);
+    if (num_params != 5 && num_params != 6){
+        mexErrMsgIdAndTxt("Mocttree:query_clearances:params", "params must have 5 or 6 elements");
+    }
+
+    scan_params params;
+    double* param_arr = mxGetDoubles(prhs[6]);
+    params.target_plane_width = param_arr[0];
+    params.observer_height = param_arr[1];
+    params.max_height = param_arr[2];
+    params.max_side = param_arr[3];
+    params.min_pts = (size_t)param_arr[4];
+    params.kth = num_params == 6 ? (size_t)param_arr[5] : 1;
+    if (params.kth < 1 || params.kth > CLEARANCE_MAX_K){
+        mexErrMsgIdAndTxt("Mocttree:query_clearances:kth", "kth must be 1 to %d", CLEARANCE_MAX_K);
+    }
+    params.scantiles = mxGetNumberOfElements(prhs[4]);
+    params.h_offsets = mxGetDoubles(prhs[4]);
+    params.v_offsets = mxGetDoubles(prhs[5]);
+    params.cull = nrhs == 8 ? (cull_mode)mxGetScalar(prhs[7]) : CULL_PLANES;
+    if (params.cull != CULL_PLANES && params.cull != CULL_EXACT){
+        mexErrMsgIdAndTxt("Mocttree:query_clearances:cull", "cull must be 0 (planes) or 1 (exact)");
+    }
+
+    plhs[0] = mxCreateUninitNumericMatrix(params.scantiles, num_road_points, mxDOUBLE_CLASS, mxREAL);
+    plhs[1] = mxCreateUninitNumericMatrix(params.scantiles, num_road_points, mxDOUBLE_CLASS, mxREAL);
+    plhs[2] = mxCreateUninitNumericMatrix(params.scantiles, num_road_points, mxDOUBLE_CLASS, mxREAL);
+    double* top_clearances = mxGetDoubles(plhs[0]);
+    double* left_clearances = mxGetDoubles(plhs[1]);
+    double* right_clearances = mxGetDoubles(plhs[2]);
+
+    // Boxes checked for each road point, only if asked for
+    double* nodes_visited = NULL;
+    if (nlhs > 3){
+        plhs[3] = mxCreateUninitNumericMatrix(1, num_road_points, mxDOUBLE_CLASS, mxREAL);
+        nodes_visited = mxGetDoubles(plhs[3]);
+    }
+
+    // Complete the rest of the work in parallel
+    scan_clearances(tree, &params, road_arr, forward_arr, leftward_arr, num_road_points,
+                    top_clearances, left_clearances, right_clearances, nodes_visited);
+}
@@ -4,68 +4,19 @@
 
 #include <mex.h>
 #include <matrix.h>
-#include "moctquery.h"
-
-
-/*
-    Returns the total number of points satisfying a constraint in an octnode (resursively)
-    
-    Requirements:
-    All coordinates in point1 < node.midpoint < point2
-*/
-size_t query_count_node(constraint* cons, octnode* node, vec3 point1, vec3 point2){
-    if(!cube_satisfies(cons, point1, point2)){
-        return 0;
-    }
-
-    if(cube_fully_satisfies(cons, point1, point2)){
-        return node->num_total_elements;
-    }
-
-    size_t count = 0;
-    
-    for (int i = 0; i < node->num_elements; i++){
-        if (satisfies(cons, node->bucket[i].point)) count++;
-    }
-
-    // Add any in our children's bucket that satisfy
-    for (int i = 0; i < 8; i++){
-        if (node->children[i] != NULL){
-            // X Y Z reverse indexing
-            vec3 temp1;
-            vec3 temp2;
-            for (int j = 0; j < 3; j++){
-                if (i&(1<<j)){
-                    temp1.pos[j] = node->midpoint.pos[j];
-                    temp2.pos[j] = point2.pos[j];
-                } else {
-                    temp1.pos[j] = point1.pos[j];
-                    temp2.pos[j] = node->midpoint.pos[j];
-                }
-            }
-            count += query_count_node(cons, node->children[i], temp1, temp2);
-        }
-    }
-    return count;
-}
-
-
-/*
-    Returns the total number of points satisfying a constrain in a tree
-*/
-size_t query_count_tree(constraint* cons, mocttree* tree){
-    return query_count_node(cons, tree->root, tree->point1, tree->point2);
-}
+#include "moctcount.h"
 
 
 /*
     This is entrypoint for this file
     in matlab it must be called as 
-    query_count_moct(uint64 to a moct, constraints)
+    [count, nodes_visited] = query_count_moct(uint64 to a moct, constraints, cull)
 
     If you pass an invalid moct you will cause
     the program to segfault, so be careful.
 
+    The moct can be either kind of tree, see moctlinear.h
+
 
     The constraints are a 4xN array of coefficents for planes
     [ a0 a1 a2 a3 ... ]
@@ -76,20 +27,31 @@ size_t query_count_tree(constraint* cons, mocttree* tree){
     ax + by + cz >= d
 
     A point must satisfy all planes to be included
+
+    cull is optional, how boxes of the tree are ruled out (see cull_mode)
+    0 only uses the planes, 1 also uses the exact test
+    nodes_visited is the number of boxes checked, to compare them
 */
 void mexFunction(int nlhs, mxArray *plhs[],
                  int nrhs, const mxArray *prhs[]){
-    if (nrhs != 2){
+    if (nrhs != 2 && nrhs != 3){
         mexErrMsgIdAndTxt("Mocttree:query_count:nrhs", "Bad arguments");
     }
 
-    mocttree* tree = (mocttree*)(mxGetUint64s(prhs[0])[0]);
+    cull_mode cull = nrhs == 3 ? (cull_mode)mxGetScalar(prhs[2]) : CULL_PLANES;
+    if (cull != CULL_PLANES && cull != CULL_EXACT){
+        mexErrMsgIdAndTxt("Mocttree:query_count:cull", "cull must be 0 (planes) or 1 (exact)");
+    }
+
+    select_halfspace_kernel();
+
+    void* tree = (void*)(mxGetUint64s(prhs[0])[0]);
     
     double* planearray = mxGetDoubles(prhs[1]);
     size_t num_planes = mxGetN(prhs[1]);
 
-    constraint* cons = malloc(num_planes*sizeof(plane3) + sizeof(cons));
-    cons->num_planes = num_planes;
+    constraint* cons = malloc(num_planes*sizeof(plane3) + sizeof(constraint));
+    constraint_init(cons, num_planes);
 
     for (int i = 0; i < num_planes; i++){
         cons->planes[i].norm.pos[0] = planearray[4*i+0];    // a
@@ -98,10 +60,17 @@ void mexFunction(int nlhs, mxArray *plhs[],
         cons->planes[i].dval = planearray[4*i+3];           // d
     }
 
+    exact_cull exact;
+    constraint_cull(cons, &exact, cull, tree);
+
     size_t one = 1;
     mxArray* result = mxCreateUninitNumericArray(1, &one, mxUINT64_CLASS, mxREAL);
-    mxGetUint64s(result)[0] = (uint64_t)query_count_tree(cons, tree);
+    mxGetUint64s(result)[0] = (uint64_t)query_count_any(cons, tree, COUNT_NO_LIMIT);
 
-    free(cons);
     plhs[0] = result;
+    if (nlhs > 1){
+        plhs[1] = mxCreateUninitNumericArray(1, &one, mxUINT64_CLASS, mxREAL);
+        mxGetUint64s(plhs[1])[0] = (uint64_t)cons->nodes_visited;
+    }
+    free(cons);
 }
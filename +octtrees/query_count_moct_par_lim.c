@@ -2,78 +2,25 @@
     Query the count of each element in a moct tree
     Performs query in paralell using OpenMP
 
-    Early dropout using a limit
+    Early dropout using a limit, each constraint can have its own
 */
 
 #include <mex.h>
 #include <matrix.h>
 #include <omp.h>
-#include "moctquery.h"
-
-uint64_t check_lim;
-/*
-    Returns the total number of points satisfying a constraint in an octnode (resursively)
-    
-    Requirements:
-    All coordinates in point1 < node.midpoint < point2
-*/
-size_t query_count_node(constraint* cons, octnode* node, vec3 point1, vec3 point2){
-    if(!cube_satisfies(cons, point1, point2)){
-        return 0;
-    }
-
-    if(cube_fully_satisfies(cons, point1, point2)){
-        return node->num_total_elements;
-    }
-
-    size_t count = 0;
-    
-    // Add any in our bucket that satisfy
-    for (int i = 0; i < node->num_elements; i++){
-        if (satisfies(cons, node->bucket[i].point)) count++;
-    }
-
-
-    // Add any in our children's bucket that satisfy
-    for (int i = 0; i < 8; i++){
-        if (node->children[i] != NULL){
-            // X Y Z reverse indexing
-            vec3 temp1;
-            vec3 temp2;
-            for (int j = 0; j < 3; j++){
-                if (i&(1<<j)){
-                    temp1.pos[j] = node->midpoint.pos[j];
-                    temp2.pos[j] = point2.pos[j];
-                } else {
-                    temp1.pos[j] = point1.pos[j];
-                    temp2.pos[j] = node->midpoint.pos[j];
-                }
-            }
-            count += query_count_node(cons, node->children[i], temp1, temp2);
-            // Breakout
-            if(count >= check_lim) return count;
-        }
-    }
-    return count;
-}
-
-
-/*
-    Returns the total number of points satisfying a constrain in a tree
-*/
-size_t query_count_tree(constraint* cons, mocttree* tree){
-    return query_count_node(cons, tree->root, tree->point1, tree->point2);
-}
+#include "moctcount.h"
 
 
 /*
     This is entrypoint for this file
     in matlab it must be called as 
-    query_count_moct_par_lim(uint64 to a moct, constraints, check_lim)
+    [counts, nodes_visited, saturated] = query_count_moct_par_lim(uint64 to a moct, constraints, check_lim, cull)
 
     If you pass an invalid moct you will cause
     the program to segfault, so be careful.
 
+    The moct can be either kind of tree, see moctlinear.h
+
     The second argument is a cell array of pointers to constraints
     Each element in the cell array to should point to a valid constraint
 
@@ -91,21 +38,56 @@ size_t query_count_tree(constraint* cons, mocttree* tree){
     This is for better malloc behavior
 
     Check lim means if check lim are found the function goes into early dropout and completes
+    check_lim is uint64, one limit for every constraint or one per constraint (any shape
+    with as many elements as the cell array)
+
+    cull is optional, how boxes of the tree are ruled out (see query_count_moct)
+    nodes_visited is the number of boxes each query checked, the same shape as counts
+    saturated is logical, the same shape as counts, true where the limit was reached
+    A saturated count is at least its limit but may be short of the full count, the
+    others are exact, so saturated alone answers "are there at least check_lim points"
 */
 void mexFunction(int nlhs, mxArray *plhs[],
                  int nrhs, const mxArray *prhs[]){
-    if (nrhs != 3){
+    if (nrhs != 3 && nrhs != 4){
         mexErrMsgIdAndTxt("Mocttree:query_count:nrhs", "Bad arguments");
     }
 
-    mocttree* tree = (mocttree*)(mxGetUint64s(prhs[0])[0]);
+    cull_mode cull = nrhs == 4 ? (cull_mode)mxGetScalar(prhs[3]) : CULL_PLANES;
+    if (cull != CULL_PLANES && cull != CULL_EXACT){
+        mexErrMsgIdAndTxt("Mocttree:query_count:cull", "cull must be 0 (planes) or 1 (exact)");
+    }
+
+    select_halfspace_kernel();
+
+    void* tree = (void*)(mxGetUint64s(prhs[0])[0]);
     size_t num_lookups = mxGetNumberOfElements(prhs[1]);    // How many constraints are in our cell array
 
     // Created in the same shape as the input constraints
     mxArray* results = mxCreateUninitNumericArray(mxGetNumberOfDimensions(prhs[1]), mxGetDimensions(prhs[1]), mxUINT64_CLASS, mxREAL);
     uint64_t* raw_results_ptr = mxGetUint64s(results);
 
-    check_lim = mxGetUint64s(prhs[2])[0];
+    // Boxes checked by each query, only if asked for
+    mxArray* visited = NULL;
+    uint64_t* raw_visited_ptr = NULL;
+    if (nlhs > 1){
+        visited = mxCreateUninitNumericArray(mxGetNumberOfDimensions(prhs[1]), mxGetDimensions(prhs[1]), mxUINT64_CLASS, mxREAL);
+        raw_visited_ptr = mxGetUint64s(visited);
+    }
+
+    // Saturated flags, only if asked for
+    mxArray* saturated = NULL;
+    mxLogical* raw_saturated_ptr = NULL;
+    if (nlhs > 2){
+        saturated = mxCreateLogicalArray(mxGetNumberOfDimensions(prhs[1]), mxGetDimensions(prhs[1]));
+        raw_saturated_ptr = mxGetLogicals(saturated);
+    }
+
+    size_t num_limits = mxGetNumberOfElements(prhs[2]);
+    if (!mxIsUint64(prhs[2]) || (num_limits != 1 && num_limits != num_lookups)){
+        mexErrMsgIdAndTxt("Mocttree:query_count:lim", "check_lim must be uint64, one limit or one per constraint");
+    }
+    const uint64_t* check_lim = mxGetUint64s(prhs[2]);
 
     // Complete the rest of the work in parallel
     #pragma omp parallel
@@ -116,6 +98,7 @@ void mexFunction(int nlhs, mxArray *plhs[],
             //uint8_t block_mem[64 * sizeof(plane3) + sizeof(constraint)];
             constraint c;
         } cons;
+        exact_cull exact;
 
         int i = 0;
 
@@ -125,15 +108,21 @@ void mexFunction(int nlhs, mxArray *plhs[],
             double* plane_arr = mxGetDoubles(cons_matrix);
             size_t num_planes = mxGetN(cons_matrix);
 
-            cons.c.num_planes = num_planes;
+            constraint_init(&cons.c, num_planes);
             for (int j = 0; j < num_planes; j++){
                 cons.c.planes[j].norm.pos[0] = plane_arr[4*j+0];    // a
                 cons.c.planes[j].norm.pos[1] = plane_arr[4*j+1];    // b
                 cons.c.planes[j].norm.pos[2] = plane_arr[4*j+2];    // c
                 cons.c.planes[j].dval = plane_arr[4*j+3];           // d
             }
-            raw_results_ptr[i] = (uint64_t)query_count_tree(&(cons.c), tree);
+            constraint_cull(&cons.c, &exact, cull, tree);
+            uint64_t limit = check_lim[num_limits == 1 ? 0 : i];
+            raw_results_ptr[i] = (uint64_t)query_count_any(&(cons.c), tree, limit);
+            if (raw_visited_ptr != NULL) raw_visited_ptr[i] = (uint64_t)cons.c.nodes_visited;
+            if (raw_saturated_ptr != NULL) raw_saturated_ptr[i] = raw_results_ptr[i] >= limit;
         }
     }
     plhs[0] = results;
+    if (visited != NULL) plhs[1] = visited;
+    if (saturated != NULL) plhs[2] = saturated;
 }
@@ -0,0 +1,135 @@
+/*
+    Query for the indexes of the points of many constraints
+    Performs query in paralell using OpenMP
+*/
+
+#include <mex.h>
+#include <matrix.h>
+#include <omp.h>
+#include "moctindex.h"
+
+
+/*
+    Copies the i-th constraint of the cell array into cons, which has room for 32 planes
+*/
+static void get_constraint(const mxArray* cell_constraints, size_t i, constraint* cons){
+    mxArray* cons_matrix = mxGetCell(cell_constraints, i);
+    double* plane_arr = mxGetDoubles(cons_matrix);
+    size_t num_planes = mxGetN(cons_matrix);
+
+    constraint_init(cons, num_planes);
+    for (int j = 0; j < num_planes; j++){
+        cons->planes[j].norm.pos[0] = plane_arr[4*j+0];    // a
+        cons->planes[j].norm.pos[1] = plane_arr[4*j+1];    // b
+        cons->planes[j].norm.pos[2] = plane_arr[4*j+2];    // c
+        cons->planes[j].dval = plane_arr[4*j+3];           // d
+    }
+}
+
+
+/*
+    This is entrypoint for this file
+    in matlab it must be called as
+    [indexes, nodes_visited] = query_index_moct_par(uint64 to a moct, constraints, cull)
+
+    If you pass an invalid moct you will cause
+    the program to segfault, so be careful.
+
+    The moct can be either kind of tree, see moctlinear.h
+
+    The second argument is a cell array of constraints, like query_count_moct_par
+    There should be NO MORE THAN 32 planes in a single constraint!
+
+    indexes is a cell array the same shape as constraints, each a column of the indexes
+    of the points in that constraint, in the same order as query_index_moct gives them
+
+    Every constraint is counted in parallel, then each result is made at its size (MATLAB
+    arrays can only be made on this thread) and filled in parallel, so nothing is grown
+    or copied
+
+    cull is optional, how boxes of the tree are ruled out (see query_count_moct)
+    nodes_visited is the number of boxes each query checked (by the count and the fill),
+    the same shape as indexes
+*/
+void mexFunction(int nlhs, mxArray *plhs[],
+                 int nrhs, const mxArray *prhs[]){
+    if (nrhs != 2 && nrhs != 3){
+        mexErrMsgIdAndTxt("Mocttree:query_index:nrhs", "Bad arguments");
+    }
+
+    cull_mode cull = nrhs == 3 ? (cull_mode)mxGetScalar(prhs[2]) : CULL_PLANES;
+    if (cull != CULL_PLANES && cull != CULL_EXACT){
+        mexErrMsgIdAndTxt("Mocttree:query_index:cull", "cull must be 0 (planes) or 1 (exact)");
+    }
+    if (!mxIsCell(prhs[1])){
+        mexErrMsgIdAndTxt("Mocttree:query_index:constraints", "The constraints must be a cell array");
+    }
+
+    select_halfspace_kernel();
+
+    void* tree = (void*)(mxGetUint64s(prhs[0])[0]);
+    size_t num_lookups = mxGetNumberOfElements(prhs[1]);    // How many constraints are in our cell array
+
+    size_t* counts = mxMalloc(num_lookups*sizeof(size_t) + 1);
+    size_t** index_arrays = mxMalloc(num_lookups*sizeof(size_t*) + 1);
+
+    // Boxes checked by each query, only if asked for
+    mxArray* visited = NULL;
+    uint64_t* raw_visited_ptr = NULL;
+    if (nlhs > 1){
+        visited = mxCreateNumericArray(mxGetNumberOfDimensions(prhs[1]), mxGetDimensions(prhs[1]), mxUINT64_CLASS, mxREAL);
+        raw_visited_ptr = mxGetUint64s(visited);
+    }
+
+    ptrdiff_t i;
+
+    // Count every constraint
+    #pragma omp parallel
+    {
+        // Instead of doing a lot of mallocs, we just have a fixed size stuck on the stack
+        union {
+            uint8_t block_mem[32*sizeof(plane3) + sizeof(constraint)];
+            constraint c;
+        } cons;
+        exact_cull exact;
+
+        #pragma omp for schedule(dynamic)
+        for (i = 0; i < (ptrdiff_t)num_lookups; i++){
+            get_constraint(prhs[1], i, &cons.c);
+            constraint_cull(&cons.c, &exact, cull, tree);
+            counts[i] = query_count_any(&cons.c, tree, COUNT_NO_LIMIT);
+            if (raw_visited_ptr != NULL) raw_visited_ptr[i] = (uint64_t)cons.c.nodes_visited;
+        }
+    }
+
+    // Make every result at its size
+    mxArray* results = mxCreateCellArray(mxGetNumberOfDimensions(prhs[1]), mxGetDimensions(prhs[1]));
+    for (size_t k = 0; k < num_lookups; k++){
+        mxArray* indexes = mxCreateUninitNumericMatrix(counts[k], 1, mxUINT64_CLASS, mxREAL);
+        index_arrays[k] = (size_t*)mxGetUint64s(indexes);
+        mxSetCell(results, k, indexes);
+    }
+
+    // Fill them
+    #pragma omp parallel
+    {
+        union {
+            uint8_t block_mem[32*sizeof(plane3) + sizeof(constraint)];
+            constraint c;
+        } cons;
+        exact_cull exact;
+
+        #pragma omp for schedule(dynamic)
+        for (i = 0; i < (ptrdiff_t)num_lookups; i++){
+            get_constraint(prhs[1], i, &cons.c);
+            constraint_cull(&cons.c, &exact, cull, tree);
+            query_index_fill(&cons.c, tree, index_arrays[i]);
+            if (raw_visited_ptr != NULL) raw_visited_ptr[i] += (uint64_t)cons.c.nodes_visited;
+        }
+    }
+
+    mxFree(counts);
+    mxFree(index_arrays);
+    plhs[0] = results;
+    if (visited != NULL) plhs[1] = visited;
+}
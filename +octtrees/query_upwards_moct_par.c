@@ -0,0 +1,48 @@
+/*
+    Fit the road's plane under every road point in one call, see traj_upwards (mocttraj.h)
+*/
+
+#include <mex.h>
+#include <matrix.h>
+#include "mocttraj.h"
+
+
+/*
+    This is entrypoint for this file
+    in matlab it must be called as
+    [upwards, num_tilted] = query_upwards_moct_par(uint64 to a moct, road_points, floor_box_edge)
+
+    If you pass an invalid moct you will cause
+    the program to segfault, so be careful.
+
+    The moct can be either kind of tree, see moctlinear.h
+
+    road_points is a 3xN array
+    [ x1 x2 x3 ... ]
+    [ y1 y2 y3 ... ]
+    [ z1 z2 z3 ... ]
+
+    upwards is 3xN, the unit normal (pointing up) of the plane fitted to the points in a
+    box of floor_box_edge around each road point, like road_upwards.m, [0 0 1] where there
+    are too few points or the fit tilts too far
+    num_tilted is how many fits tilted too far
+*/
+void mexFunction(int nlhs, mxArray *plhs[],
+                 int nrhs, const mxArray *prhs[]){
+    if (nrhs != 3){
+        mexErrMsgIdAndTxt("Mocttree:query_upwards:nrhs", "Bad arguments");
+    }
+    if (mxGetM(prhs[1]) != 3 && mxGetNumberOfElements(prhs[1]) != 0){
+        mexErrMsgIdAndTxt("Mocttree:query_upwards:size", "road_points must be 3xN");
+    }
+
+    void* tree = (void*)(mxGetUint64s(prhs[0])[0]);
+    double* road_arr = mxGetDoubles(prhs[1]);
+    size_t num_road_points = mxGetN(prhs[1]);
+    double floor_box_edge = mxGetScalar(prhs[2]);
+
+    plhs[0] = mxCreateUninitNumericMatrix(3, num_road_points, mxDOUBLE_CLASS, mxREAL);
+    size_t num_tilted = traj_upwards(tree, road_arr, num_road_points, floor_box_edge, mxGetDoubles(plhs[0]));
+
+    if (nlhs > 1) plhs[1] = mxCreateDoubleScalar((double)num_tilted);
+}
@@ -0,0 +1,191 @@
+/*
+    Reads the points of a LAS file straight into the columns the clearance tool uses,
+    see moctlas.h
+
+    The file is read in large sequential chunks and decoded as it goes, only the
+    kept points are ever stored, so the cloud is never held twice
+*/
+
+#include <mex.h>
+#include <matrix.h>
+#include <stdio.h>
+#include <string.h>
+#include <omp.h>
+#include "moctlas.h"
+#include "moctsort.h"
+
+static const char* las_field_names[] = {"x", "y", "z", "gps_time", "scan_angle_rank", "point_source_ID"};
+# define LAS_NUM_FIELDS 6
+
+
+static const char* header_field_names[] = {
+    "version_major", "version_minor", "point_data_format", "point_data_record_length",
+    "number_of_point_records", "x_scale_factor", "y_scale_factor", "z_scale_factor",
+    "x_offset", "y_offset", "z_offset", "max_x", "min_x", "max_y", "min_y", "max_z", "min_z"
+};
+# define HEADER_NUM_FIELDS 17
+
+
+/*
+    The header as a struct, with the same field names as las2mat
+*/
+static mxArray* create_header(const las_header* header){
+    mxArray* result = mxCreateStructMatrix(1, 1, HEADER_NUM_FIELDS, header_field_names);
+    double values[HEADER_NUM_FIELDS] = {
+        header->version_major, header->version_minor, header->point_format, header->record_length,
+        (double)header->num_points, header->scale[0], header->scale[1], header->scale[2],
+        header->offset[0], header->offset[1], header->offset[2],
+        header->max[0], header->min[0], header->max[1], header->min[1], header->max[2], header->min[2]
+    };
+    for (int i = 0; i < HEADER_NUM_FIELDS; i++){
+        mxSetFieldByNumber(result, 0, i, mxCreateDoubleScalar(values[i]));
+    }
+    return result;
+}
+
+
+/*
+    Creates the columns of a las_struct with num_rows rows
+*/
+static las_columns create_fields(mxArray* fields[LAS_NUM_FIELDS], size_t num_rows){
+    for (int j = 0; j < 4; j++){
+        fields[j] = mxCreateUninitNumericMatrix(num_rows, 1, mxDOUBLE_CLASS, mxREAL);
+    }
+    fields[4] = mxCreateUninitNumericMatrix(num_rows, 1, mxINT16_CLASS, mxREAL);
+    fields[5] = mxCreateUninitNumericMatrix(num_rows, 1, mxUINT16_CLASS, mxREAL);
+
+    las_columns columns;
+    for (int j = 0; j < 3; j++){
+        columns.coords[j] = mxGetDoubles(fields[j]);
+    }
+    columns.gps_time = mxGetDoubles(fields[3]);
+    columns.scan_angle_rank = mxGetInt16s(fields[4]);
+    columns.point_source_ID = mxGetUint16s(fields[5]);
+    return columns;
+}
+
+
+/*
+    Reads every kept point, the columns are made at their final size and filled as
+    the file is read
+    Returns false if the file ends early
+*/
+static bool read_all(FILE* file, const las_header* header, uint64_t step, const double shift[3],
+                     mxArray* fields[LAS_NUM_FIELDS]){
+    las_columns columns = create_fields(fields, (size_t)las_first_kept(header->num_points, step));
+    return las_read_rows(file, header, step, shift, &columns);
+}
+
+
+/*
+    Reads only the kept points with one scan angle rank, see las_read_scan_angle
+    Returns false if the file ends early
+*/
+static bool read_scan_angle(FILE* file, const las_header* header, uint64_t step, const double shift[3],
+                            int16_t scan_angle, mxArray* fields[LAS_NUM_FIELDS]){
+    las_columns kept;
+    ptrdiff_t num_kept = las_read_scan_angle(file, header, step, shift, scan_angle, &kept);
+    if (num_kept < 0) return false;
+
+    las_columns columns = create_fields(fields, (size_t)num_kept);
+    for (int j = 0; j < 3; j++){
+        memcpy(columns.coords[j], kept.coords[j], num_kept*sizeof(double));
+    }
+    memcpy(columns.gps_time, kept.gps_time, num_kept*sizeof(double));
+    memcpy(columns.scan_angle_rank, kept.scan_angle_rank, num_kept*sizeof(int16_t));
+    memcpy(columns.point_source_ID, kept.point_source_ID, num_kept*sizeof(uint16_t));
+    las_columns_free(&kept);
+    return true;
+}
+
+
+/*
+    This is entrypoint for this file
+    in matlab it must be called as
+    [las_struct, header] = readlas(filename, sample_step, translate) OR
+    [las_struct, header] = readlas(filename, sample_step, translate, scan_angle_rank)
+
+    Reads every sample_step-th point (1, the default, reads them all) of a LAS 1.0 to 1.4
+    file into las_struct, with the fields
+    x, y, z (doubles, scaled and offset like any reader)
+    gps_time (double, 0 if the point format has none)
+    scan_angle_rank (int16 degrees)
+    point_source_ID (uint16)
+    each a column with a row per point. The points are sorted by gps_time (stably).
+
+    If translate is true the header offsets are subtracted from x, y and z, bringing
+    the points near the origin.
+
+    With scan_angle_rank only the points (of those sampled) with that scan angle rank
+    are kept, reading just the ones a trajectory is made of (0) takes very little memory
+
+    header has the scale factors, offsets and bounds of the file, named like las2mat's
+*/
+void mexFunction(int nlhs, mxArray *plhs[],
+                 int nrhs, const mxArray *prhs[]){
+    if (nrhs < 1 || nrhs > 4){
+        mexErrMsgIdAndTxt("Mocttree:readlas:nrhs", "Bad arguments");
+    }
+
+    uint64_t step = 1;
+    if (nrhs >= 2){
+        double arg = mxGetScalar(prhs[1]);
+        if (!(arg >= 1.) || arg != floor(arg)){
+            mexErrMsgIdAndTxt("Mocttree:readlas:step", "sample_step must be a whole number, at least 1");
+        }
+        step = (uint64_t)arg;
+    }
+    bool translate = nrhs >= 3 && mxGetScalar(prhs[2]) != 0.;
+
+    char* filename = mxArrayToString(prhs[0]);
+    if (filename == NULL){
+        mexErrMsgIdAndTxt("Mocttree:readlas:filename", "The filename must be a string");
+    }
+    las_header header;
+    const char* error;
+    FILE* file = las_open(filename, &header, &error);
+    mxFree(filename);
+    if (file == NULL){
+        mexErrMsgIdAndTxt("Mocttree:readlas:file", "%s", error);
+    }
+
+    if (las_first_kept(header.num_points, step) > UINT32_MAX){
+        fclose(file);
+        mexErrMsgIdAndTxt("Mocttree:readlas:size", "At most 2^32-1 points can be kept, use a larger sample_step");
+    }
+
+    double shift[3];
+    for (int j = 0; j < 3; j++){
+        shift[j] = translate ? header.offset[j] : 0.;
+    }
+
+    mxArray* fields[LAS_NUM_FIELDS];
+    bool ok;
+    if (nrhs == 4){
+        ok = read_scan_angle(file, &header, step, shift, (int16_t)mxGetScalar(prhs[3]), fields);
+    } else {
+        ok = read_all(file, &header, step, shift, fields);
+    }
+    fclose(file);
+    if (!ok){
+        mexErrMsgIdAndTxt("Mocttree:readlas:truncated", "The file has fewer points than its header says");
+    }
+
+    // Sorted by time, same as sort in MATLAB, the trajectory and the tree expect it
+    size_t num_kept = mxGetNumberOfElements(fields[0]);
+    uint32_t* order = sort_order_doubles(mxGetDoubles(fields[3]), num_kept);
+    if (order != NULL){
+        for (int j = 0; j < LAS_NUM_FIELDS; j++){
+            permute_rows(mxGetData(fields[j]), mxGetElementSize(fields[j]), order, num_kept);
+        }
+        mxFree(order);
+    }
+
+    plhs[0] = mxCreateStructMatrix(1, 1, LAS_NUM_FIELDS, las_field_names);
+    for (int j = 0; j < LAS_NUM_FIELDS; j++){
+        mxSetFieldByNumber(plhs[0], 0, j, fields[j]);
+    }
+    if (nlhs > 1){
+        plhs[1] = create_header(&header);
+    }
+}
@@ -0,0 +1,390 @@
+/*
+    Splits the points of a LAS file into tiles on disk, and reads the tiles back
+    one at a time, so a cloud larger than memory can be measured a tile at a time
+
+    The file is read once, in chunks (see moctlas.h), and every point is appended to
+    each tile whose box it is in, tiles may overlap. Only a small buffer per tile is
+    ever held in memory.
+*/
+
+#include <mex.h>
+#include <matrix.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <omp.h>
+#include "moctlas.h"
+#include "moctsort.h"
+
+// Point records read at a time
+# define TILE_CHUNK ((size_t)1<<16)
+
+// Points held for each tile before they are written out
+# define TILE_BUFFER 2048
+
+// Most cells along each side of the grid the tiles are found with
+# define TILE_GRID_MAX 4096
+
+
+/*
+    A point in a tile file, they are written as is
+*/
+typedef struct tile_point{ // 40 bytes large
+    double pos[3];
+    double gps_time;
+    int16_t scan_angle_rank;    // So tiles are thinned like the whole cloud (voxelmoct.c)
+} tile_point;
+
+
+/*
+    The tiles of a split
+    An xy grid over the tiles finds the few a point could be in, cell c lists the tiles
+    cell_tiles[cell_start[c]] to cell_tiles[cell_start[c+1] - 1]
+*/
+typedef struct tile_set{
+    size_t num_tiles;
+    const double* low;      // 3 x num_tiles, the corners of each tile's box
+    const double* high;
+
+    double origin[2];
+    double cell;
+    size_t dims[2];
+    size_t* cell_start;
+    uint32_t* cell_tiles;
+
+    char** filenames;
+    tile_point* buffers;    // TILE_BUFFER for each tile
+    size_t* num_buffered;
+    double* counts;         // Points written to each tile
+} tile_set;
+
+
+/*
+    The range of grid cells [first, last] along axis the interval low to high covers
+*/
+static inline void tile_cells(const tile_set* set, int axis, double low, double high, size_t* first, size_t* last){
+    double from = floor((low - set->origin[axis])/set->cell);
+    double to = floor((high - set->origin[axis])/set->cell);
+    double max_cell = (double)(set->dims[axis] - 1);
+    *first = (size_t)fmin(fmax(from, 0.), max_cell);
+    *last = (size_t)fmin(fmax(to, 0.), max_cell);
+}
+
+
+/*
+    Makes the grid over the boxes of the tiles
+*/
+static void tile_grid(tile_set* set){
+    double min_xy[2] = {INFINITY, INFINITY};
+    double max_xy[2] = {-INFINITY, -INFINITY};
+    for (size_t t = 0; t < set->num_tiles; t++){
+        for (int a = 0; a < 2; a++){
+            min_xy[a] = fmin(min_xy[a], set->low[3*t+a]);
+            max_xy[a] = fmax(max_xy[a], set->high[3*t+a]);
+        }
+    }
+
+    // About four cells per tile, a tile is a few cells across
+    double extent[2] = {fmax(max_xy[0] - min_xy[0], 1e-9), fmax(max_xy[1] - min_xy[1], 1e-9)};
+    set->cell = sqrt(extent[0]*extent[1]/(4.*(double)set->num_tiles));
+    for (int a = 0; a < 2; a++){
+        set->cell = fmax(set->cell, extent[a]/TILE_GRID_MAX);
+    }
+    for (int a = 0; a < 2; a++){
+        set->origin[a] = min_xy[a];
+        set->dims[a] = (size_t)ceil(extent[a]/set->cell) + 1;
+        if (set->dims[a] > TILE_GRID_MAX) set->dims[a] = TILE_GRID_MAX;
+    }
+
+    size_t num_cells = set->dims[0]*set->dims[1];
+    set->cell_start = mxCalloc(num_cells + 1, sizeof(size_t));
+
+    // Count, then fill, the tiles of each cell
+    for (int pass = 0; pass < 2; pass++){
+        size_t* fill = NULL;
+        if (pass == 1){
+            for (size_t c = 0; c < num_cells; c++){
+                set->cell_start[c+1] += set->cell_start[c];
+            }
+            set->cell_tiles = mxMalloc(set->cell_start[num_cells]*sizeof(uint32_t) + 1);
+            fill = mxMalloc(num_cells*sizeof(size_t) + 1);
+            memcpy(fill, set->cell_start, num_cells*sizeof(size_t));
+        }
+
+        for (size_t t = 0; t < set->num_tiles; t++){
+            size_t x1, x2, y1, y2;
+            tile_cells(set, 0, set->low[3*t], set->high[3*t], &x1, &x2);
+            tile_cells(set, 1, set->low[3*t+1], set->high[3*t+1], &y1, &y2);
+            for (size_t y = y1; y <= y2; y++){
+                for (size_t x = x1; x <= x2; x++){
+                    size_t c = y*set->dims[0] + x;
+                    if (pass == 0){
+                        set->cell_start[c+1]++;
+                    } else {
+                        set->cell_tiles[fill[c]++] = (uint32_t)t;
+                    }
+                }
+            }
+        }
+        mxFree(fill);
+    }
+}
+
+
+/*
+    Appends the buffered points of a tile to its file
+    Returns false if the file can't be written
+*/
+static bool tile_flush(tile_set* set, size_t t){
+    if (set->num_buffered[t] == 0) return true;
+
+    FILE* file = fopen(set->filenames[t], "ab");
+    if (file == NULL) return false;
+    bool ok = fwrite(set->buffers + t*TILE_BUFFER, sizeof(tile_point), set->num_buffered[t], file) == set->num_buffered[t];
+    ok = fclose(file) == 0 && ok;
+
+    set->counts[t] += (double)set->num_buffered[t];
+    set->num_buffered[t] = 0;
+    return ok;
+}
+
+
+/*
+    Adds a point to every tile it is in
+    Returns false if a tile file can't be written
+*/
+static bool tile_add(tile_set* set, const tile_point* point){
+    size_t x, y, unused;
+    tile_cells(set, 0, point->pos[0], point->pos[0], &x, &unused);
+    tile_cells(set, 1, point->pos[1], point->pos[1], &y, &unused);
+    size_t c = y*set->dims[0] + x;
+
+    for (size_t i = set->cell_start[c]; i < set->cell_start[c+1]; i++){
+        size_t t = set->cell_tiles[i];
+        bool inside = true;
+        for (int a = 0; a < 3; a++){
+            if (point->pos[a] < set->low[3*t+a] || point->pos[a] > set->high[3*t+a]) inside = false;
+        }
+        if (!inside) continue;
+
+        set->buffers[t*TILE_BUFFER + set->num_buffered[t]++] = *point;
+        if (set->num_buffered[t] == TILE_BUFFER && !tile_flush(set, t)) return false;
+    }
+    return true;
+}
+
+
+/*
+    'split', see mexFunction
+*/
+static void split_tiles(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]){
+    if (nrhs != 7 || !mxIsDouble(prhs[4]) || !mxIsDouble(prhs[5]) || mxGetM(prhs[4]) != 3 ||
+        mxGetM(prhs[5]) != 3 || mxGetN(prhs[4]) != mxGetN(prhs[5]) || mxGetN(prhs[4]) == 0){
+        mexErrMsgIdAndTxt("Mocttree:tilelas:nrhs", "Bad arguments");
+    }
+
+    double arg = mxGetScalar(prhs[2]);
+    if (!(arg >= 1.) || arg != floor(arg)){
+        mexErrMsgIdAndTxt("Mocttree:tilelas:step", "sample_step must be a whole number, at least 1");
+    }
+    uint64_t step = (uint64_t)arg;
+    bool translate = mxGetScalar(prhs[3]) != 0.;
+
+    tile_set set;
+    set.num_tiles = mxGetN(prhs[4]);
+    set.low = mxGetDoubles(prhs[4]);
+    set.high = mxGetDoubles(prhs[5]);
+    if (set.num_tiles > UINT32_MAX){
+        mexErrMsgIdAndTxt("Mocttree:tilelas:size", "Too many tiles");
+    }
+
+    // Every tile file starts out empty
+    char* folder = mxArrayToString(prhs[6]);
+    if (folder == NULL){
+        mexErrMsgIdAndTxt("Mocttree:tilelas:folder", "The folder must be a string");
+    }
+    size_t name_bytes = strlen(folder) + 32;
+    set.filenames = mxMalloc(set.num_tiles*sizeof(char*));
+    for (size_t t = 0; t < set.num_tiles; t++){
+        set.filenames[t] = mxMalloc(name_bytes);
+        snprintf(set.filenames[t], name_bytes, "%s/tile%zu.bin", folder, t + 1);
+        FILE* file = fopen(set.filenames[t], "wb");
+        if (file == NULL){
+            mexErrMsgIdAndTxt("Mocttree:tilelas:write", "Could not create the tile files");
+        }
+        fclose(file);
+    }
+    mxFree(folder);
+
+    char* filename = mxArrayToString(prhs[1]);
+    if (filename == NULL){
+        mexErrMsgIdAndTxt("Mocttree:tilelas:filename", "The filename must be a string");
+    }
+    las_header header;
+    const char* error;
+    FILE* file = las_open(filename, &header, &error);
+    mxFree(filename);
+    if (file == NULL){
+        mexErrMsgIdAndTxt("Mocttree:tilelas:file", "%s", error);
+    }
+
+    tile_grid(&set);
+    set.buffers = mxMalloc(set.num_tiles*TILE_BUFFER*sizeof(tile_point));
+    set.num_buffered = mxCalloc(set.num_tiles, sizeof(size_t));
+    plhs[0] = mxCreateDoubleMatrix(1, set.num_tiles, mxREAL);
+    set.counts = mxGetDoubles(plhs[0]);
+
+    double shift[3];
+    for (int j = 0; j < 3; j++){
+        shift[j] = translate ? header.offset[j] : 0.;
+    }
+
+    las_columns chunk = las_columns_alloc(TILE_CHUNK);
+    uint8_t* records = mxMalloc(TILE_CHUNK*header.record_length);
+    error = NULL;
+    for (uint64_t first = 0; first < header.num_points && error == NULL; first += TILE_CHUNK){
+        size_t num = header.num_points - first < TILE_CHUNK ? (size_t)(header.num_points - first) : TILE_CHUNK;
+        if (fread(records, header.record_length, num, file) != num){
+            error = "The file has fewer points than its header says";
+            break;
+        }
+
+        uint64_t first_row = las_first_kept(first, step);
+        las_decode(&header, records, first, num, step, shift, &chunk, first_row);
+
+        size_t num_rows = (size_t)(las_first_kept(first + num, step) - first_row);
+        for (size_t r = 0; r < num_rows && error == NULL; r++){
+            tile_point point = {{chunk.coords[0][r], chunk.coords[1][r], chunk.coords[2][r]}, chunk.gps_time[r],
+                                chunk.scan_angle_rank[r]};
+            if (!tile_add(&set, &point)) error = "Could not write the tile files";
+        }
+    }
+    for (size_t t = 0; t < set.num_tiles && error == NULL; t++){
+        if (!tile_flush(&set, t)) error = "Could not write the tile files";
+    }
+    fclose(file);
+    las_columns_free(&chunk);
+    mxFree(records);
+    mxFree(set.buffers);
+    mxFree(set.num_buffered);
+    mxFree(set.cell_start);
+    mxFree(set.cell_tiles);
+    for (size_t t = 0; t < set.num_tiles; t++){
+        mxFree(set.filenames[t]);
+    }
+    mxFree(set.filenames);
+
+    if (error != NULL){
+        mexErrMsgIdAndTxt("Mocttree:tilelas:split", "%s", error);
+    }
+}
+
+
+/*
+    'read', see mexFunction
+*/
+static void read_tile(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]){
+    if (nrhs != 2){
+        mexErrMsgIdAndTxt("Mocttree:tilelas:nrhs", "Bad arguments");
+    }
+
+    char* filename = mxArrayToString(prhs[1]);
+    if (filename == NULL){
+        mexErrMsgIdAndTxt("Mocttree:tilelas:filename", "The filename must be a string");
+    }
+    FILE* file = fopen(filename, "rb");
+    mxFree(filename);
+    if (file == NULL){
+        mexErrMsgIdAndTxt("Mocttree:tilelas:file", "Could not open the tile");
+    }
+
+    // The size of the file, which may be past 2GB (long is 32 bits on Windows)
+#if defined(_WIN32)
+    _fseeki64(file, 0, SEEK_END);
+    uint64_t bytes = (uint64_t)_ftelli64(file);
+#else
+    fseek(file, 0, SEEK_END);
+    uint64_t bytes = (uint64_t)ftell(file);
+#endif
+    rewind(file);
+    size_t num_points = (size_t)(bytes/sizeof(tile_point));
+    if (num_points > UINT32_MAX){
+        fclose(file);
+        mexErrMsgIdAndTxt("Mocttree:tilelas:size", "At most 2^32-1 points fit in a tile, use shorter tiles");
+    }
+
+    static const char* field_names[] = {"x", "y", "z", "gps_time", "scan_angle_rank"};
+    mxArray* fields[5];
+    double* columns[4];
+    for (int j = 0; j < 4; j++){
+        fields[j] = mxCreateUninitNumericMatrix(num_points, 1, mxDOUBLE_CLASS, mxREAL);
+        columns[j] = mxGetDoubles(fields[j]);
+    }
+    fields[4] = mxCreateUninitNumericMatrix(num_points, 1, mxINT16_CLASS, mxREAL);
+    int16_t* scan_angle_rank = mxGetInt16s(fields[4]);
+
+    tile_point* points = mxMalloc(TILE_CHUNK*sizeof(tile_point));
+    bool ok = true;
+    for (size_t first = 0; first < num_points && ok; first += TILE_CHUNK){
+        size_t num = num_points - first < TILE_CHUNK ? num_points - first : TILE_CHUNK;
+        ok = fread(points, sizeof(tile_point), num, file) == num;
+        for (size_t i = 0; i < num && ok; i++){
+            for (int j = 0; j < 3; j++){
+                columns[j][first + i] = points[i].pos[j];
+            }
+            columns[3][first + i] = points[i].gps_time;
+            scan_angle_rank[first + i] = points[i].scan_angle_rank;
+        }
+    }
+    mxFree(points);
+    fclose(file);
+    if (!ok){
+        mexErrMsgIdAndTxt("Mocttree:tilelas:file", "Could not read the tile");
+    }
+
+    // The points were written in file order, sorted they are in the same order as readlas gives
+    uint32_t* order = sort_order_doubles(columns[3], num_points);
+    if (order != NULL){
+        for (int j = 0; j < 4; j++){
+            permute_rows(columns[j], sizeof(double), order, num_points);
+        }
+        permute_rows(scan_angle_rank, sizeof(int16_t), order, num_points);
+        mxFree(order);
+    }
+
+    plhs[0] = mxCreateStructMatrix(1, 1, 5, field_names);
+    for (int j = 0; j < 5; j++){
+        mxSetFieldByNumber(plhs[0], 0, j, fields[j]);
+    }
+}
+
+
+/*
+    This is entrypoint for this file
+    in matlab it must be called as one of
+    counts = tilelas('split', filename, sample_step, translate, tile_low, tile_high, folder)
+    tile = tilelas('read', tile_filename)
+
+    'split' reads the las file the same way as readlas (sample_step and translate are the
+    same) and writes each point to every tile whose box it is inside, tile_low and tile_high
+    are 3 x num_tiles, the corners of the boxes. Tile k (1 based) is written to
+    folder/tile<k>.bin, and counts (1 x num_tiles) is how many points each got
+
+    'read' reads a tile back into a struct with the x, y, z, gps_time and scan_angle_rank
+    columns, sorted by gps_time like readlas
+*/
+void mexFunction(int nlhs, mxArray *plhs[],
+                 int nrhs, const mxArray *prhs[]){
+    char command[8];
+    if (nrhs < 1 || mxGetString(prhs[0], command, sizeof(command)) != 0){
+        mexErrMsgIdAndTxt("Mocttree:tilelas:command", "The first argument must be 'split' or 'read'");
+    }
+
+    if (strcmp(command, "split") == 0){
+        split_tiles(nlhs, plhs, nrhs, prhs);
+    } else if (strcmp(command, "read") == 0){
+        read_tile(nlhs, plhs, nrhs, prhs);
+    } else {
+        mexErrMsgIdAndTxt("Mocttree:tilelas:command", "The first argument must be 'split' or 'read'");
+    }
+}
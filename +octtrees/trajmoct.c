@@ -0,0 +1,79 @@
+/*
+    The road points and forwards of a drive, see mocttraj.h
+    camera_path_magic.m uses this for the path, the upwards come from the octree
+    (query_upwards_moct_par.c)
+*/
+
+#include <mex.h>
+#include <matrix.h>
+#include "mocttraj.h"
+
+
+/*
+    The column name of las_struct, checked to be class_id and num_rows long
+*/
+static void* get_column(const mxArray* las_struct, const char* name, mxClassID class_id, size_t num_rows){
+    mxArray* column = mxGetField(las_struct, 0, name);
+    if (column == NULL || mxGetClassID(column) != class_id || mxIsComplex(column)){
+        mexErrMsgIdAndTxt("Mocttree:trajmoct:column", "las_struct.%s is missing or of the wrong class", name);
+    }
+    if (mxGetNumberOfElements(column) != num_rows){
+        mexErrMsgIdAndTxt("Mocttree:trajmoct:column", "las_struct.%s is not the same length as las_struct.x", name);
+    }
+    return mxGetData(column);
+}
+
+
+/*
+    This is entrypoint for this file
+    in matlab it must be called as
+    [road_points, forwards] = trajmoct(las_struct, point_density)
+
+    las_struct has the x, y, z and gps_time (double), scan_angle_rank (int16) and
+    point_source_ID (uint16) columns of the points, sorted by gps_time, like readlas
+    gives. Only the points with a scan angle rank of 0 are used
+
+    road_points are 3xN, a point every point_density along the smoothed path of the
+    scanners, and forwards are the 3xN unit headings at them, the same as the path and
+    forwards of camera_path_magic.m
+*/
+void mexFunction(int nlhs, mxArray *plhs[],
+                 int nrhs, const mxArray *prhs[]){
+    if (nrhs != 2 || !mxIsStruct(prhs[0])){
+        mexErrMsgIdAndTxt("Mocttree:trajmoct:nrhs", "Bad arguments");
+    }
+    double point_density = mxGetScalar(prhs[1]);
+    if (!(point_density > 0.)){
+        mexErrMsgIdAndTxt("Mocttree:trajmoct:density", "point_density must be positive");
+    }
+
+    mxArray* x = mxGetField(prhs[0], 0, "x");
+    if (x == NULL){
+        mexErrMsgIdAndTxt("Mocttree:trajmoct:column", "las_struct.x is missing");
+    }
+    size_t num_points = mxGetNumberOfElements(x);
+
+    las_columns points;
+    points.coords[0] = get_column(prhs[0], "x", mxDOUBLE_CLASS, num_points);
+    points.coords[1] = get_column(prhs[0], "y", mxDOUBLE_CLASS, num_points);
+    points.coords[2] = get_column(prhs[0], "z", mxDOUBLE_CLASS, num_points);
+    points.gps_time = get_column(prhs[0], "gps_time", mxDOUBLE_CLASS, num_points);
+    points.scan_angle_rank = get_column(prhs[0], "scan_angle_rank", mxINT16_CLASS, num_points);
+    points.point_source_ID = get_column(prhs[0], "point_source_ID", mxUINT16_CLASS, num_points);
+
+    double* road_points;
+    size_t num_road_points;
+    const char* error = traj_road_points(&points, num_points, point_density, &road_points, &num_road_points);
+    if (error != NULL){
+        mexErrMsgIdAndTxt("Mocttree:trajmoct:path", "%s", error);
+    }
+
+    plhs[0] = mxCreateUninitNumericMatrix(3, num_road_points, mxDOUBLE_CLASS, mxREAL);
+    memcpy(mxGetDoubles(plhs[0]), road_points, 3*num_road_points*sizeof(double));
+    moct_free(road_points);
+
+    if (nlhs > 1){
+        plhs[1] = mxCreateUninitNumericMatrix(3, num_road_points, mxDOUBLE_CLASS, mxREAL);
+        traj_forwards(mxGetDoubles(plhs[0]), num_road_points, point_density, mxGetDoubles(plhs[1]));
+    }
+}
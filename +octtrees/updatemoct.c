@@ -0,0 +1,94 @@
+/*
+    Adds points to a tree that is already built, and drops them again, see the
+    incremental code in moctbuild.h
+*/
+
+#include <mex.h>
+#include <matrix.h>
+#include <string.h>
+#include "moctbuild.h"
+
+
+/*
+    The tree argument, only pointer trees can change
+*/
+static mocttree* get_tree(const mxArray* arg){
+    if (!mxIsUint64(arg) || mxGetNumberOfElements(arg) != 1){
+        mexErrMsgIdAndTxt("Mocttree:updatemoct:tree", "The tree must be a uint64 scalar");
+    }
+    void* tree = (void*)(mxGetUint64s(arg)[0]);
+    if (tree_kind(tree) != MOCT_POINTER){
+        mexErrMsgIdAndTxt("Mocttree:updatemoct:kind", "Only trees built with 'insert' or 'bulk' can be changed");
+    }
+    return (mocttree*)tree;
+}
+
+
+/*
+    The source id argument, a whole number that fits in 32 bits
+*/
+static uint32_t get_source_id(const mxArray* arg){
+    double value = mxGetScalar(arg);
+    if (mxGetNumberOfElements(arg) != 1 || !(value >= 0.) || value > (double)UINT32_MAX || value != floor(value)){
+        mexErrMsgIdAndTxt("Mocttree:updatemoct:source", "The source id must be a whole number from 0 to 2^32-1");
+    }
+    return (uint32_t)value;
+}
+
+
+/*
+    This is entrypoint for this file
+    in matlab it must be called as one of
+    num_added = updatemoct('append', uint64 to a moct, points, source_id)
+    num_dropped = updatemoct('drop', uint64 to a moct, source_id)
+
+    Only trees built with 'insert' or 'bulk' can change, linear trees are one flat block
+
+    'append' adds the points (3xN or a cell of x, y and z, like createfreemoct) as a batch
+    of source_id, the tree grows to hold any outside of it. They are numbered after
+    every point the tree was given before (dropped ones too), so the indexes the queries
+    give are into all the points given, in order. Non finite points are left out, like
+    points a compact tree's grid can't hold, not on the las grid it was given (see
+    createfreemoct). Leaving any out is a warning
+
+    'drop' removes every point appended with source_id, the points the tree was built
+    with are source 0. The rest keep their indexes
+
+    Both take time proportional to the points appended or dropped, not to the tree
+*/
+void mexFunction(int nlhs, mxArray *plhs[],
+                 int nrhs, const mxArray *prhs[]){
+    char command[16];
+    if (nrhs < 1 || mxGetString(prhs[0], command, sizeof(command)) != 0){
+        mexErrMsgIdAndTxt("Mocttree:updatemoct:command", "The first argument must be 'append' or 'drop'");
+    }
+
+    if (strcmp(command, "append") == 0){
+        if (nrhs != 4){
+            mexErrMsgIdAndTxt("Mocttree:updatemoct:nrhs", "Bad arguments");
+        }
+        mocttree* tree = get_tree(prhs[1]);
+        size_t num_points;
+        point_source source = get_point_source(prhs[2], &num_points, "Mocttree:updatemoct:points");
+        uint32_t source_id = get_source_id(prhs[3]);
+#ifdef MOCT_COMPACT
+        if (tree->num_elements + num_points > UINT32_MAX){
+            mexErrMsgIdAndTxt("Mocttree:updatemoct:size", "Compact trees support at most 2^32-1 points");
+        }
+#endif
+        size_t num_added = append_tree(tree, source_id, &source, num_points);
+        if (num_added < num_points){
+            mexWarnMsgIdAndTxt("Mocttree:updatemoct:skipped", "%zu of the %zu points were left out, they aren't finite or the tree's grid can't hold them",
+                               num_points - num_added, num_points);
+        }
+        plhs[0] = mxCreateDoubleScalar((double)num_added);
+    } else if (strcmp(command, "drop") == 0){
+        if (nrhs != 3){
+            mexErrMsgIdAndTxt("Mocttree:updatemoct:nrhs", "Bad arguments");
+        }
+        mocttree* tree = get_tree(prhs[1]);
+        plhs[0] = mxCreateDoubleScalar((double)drop_source(tree, get_source_id(prhs[2])));
+    } else {
+        mexErrMsgIdAndTxt("Mocttree:updatemoct:command", "The first argument must be 'append' or 'drop'");
+    }
+}
@@ -0,0 +1,67 @@
+/*
+    Thin a cloud to a point per voxel, see moctvoxel.h
+*/
+
+#include <mex.h>
+#include <matrix.h>
+#include "moctvoxel.h"
+
+
+/*
+    This is entrypoint for this file
+    in matlab it must be called as
+    keep = voxelmoct(las_struct, voxel_size, lowest)
+
+    las_struct has the x, y and z (double) columns of the points, like readlas or
+    tilelas give. If it has a scan_angle_rank (int16) column the points with a scan angle
+    rank of 0 are always kept, the trajectory is made from them
+
+    voxel_size is the edge of the voxels (in las file units)
+    lowest is optional, false (the default) keeps the first point of each voxel, true
+    keeps the lowest
+
+    keep is a logical column, true for the points kept
+*/
+void mexFunction(int nlhs, mxArray *plhs[],
+                 int nrhs, const mxArray *prhs[]){
+    if ((nrhs != 2 && nrhs != 3) || !mxIsStruct(prhs[0])){
+        mexErrMsgIdAndTxt("Mocttree:voxelmoct:nrhs", "Bad arguments");
+    }
+    double voxel_size = mxGetScalar(prhs[1]);
+    if (!(voxel_size > 0.) || isinf(voxel_size)){
+        mexErrMsgIdAndTxt("Mocttree:voxelmoct:size", "voxel_size must be positive");
+    }
+    voxel_mode mode = nrhs == 3 && mxGetScalar(prhs[2]) != 0. ? VOXEL_LOWEST : VOXEL_FIRST;
+
+    static const char* names[3] = {"x", "y", "z"};
+    const double* coords[3];
+    size_t num_points = 0;
+    for (int j = 0; j < 3; j++){
+        mxArray* column = mxGetField(prhs[0], 0, names[j]);
+        if (column == NULL || !mxIsDouble(column) || mxIsComplex(column)){
+            mexErrMsgIdAndTxt("Mocttree:voxelmoct:column", "las_struct.%s is missing or not double", names[j]);
+        }
+        if (j == 0) num_points = mxGetNumberOfElements(column);
+        if (mxGetNumberOfElements(column) != num_points){
+            mexErrMsgIdAndTxt("Mocttree:voxelmoct:column", "las_struct.%s is not the same length as las_struct.x", names[j]);
+        }
+        coords[j] = mxGetDoubles(column);
+    }
+    if (num_points > UINT32_MAX){
+        mexErrMsgIdAndTxt("Mocttree:voxelmoct:points", "At most 2^32-1 points can be thinned");
+    }
+
+    const int16_t* scan_angle_rank = NULL;
+    mxArray* rank = mxGetField(prhs[0], 0, "scan_angle_rank");
+    if (rank != NULL){
+        if (mxGetClassID(rank) != mxINT16_CLASS || mxGetNumberOfElements(rank) != num_points){
+            mexErrMsgIdAndTxt("Mocttree:voxelmoct:column", "las_struct.scan_angle_rank must be int16 and as long as las_struct.x");
+        }
+        scan_angle_rank = mxGetData(rank);
+    }
+
+    plhs[0] = mxCreateLogicalMatrix(num_points, 1);
+    if (voxel_keep(coords, scan_angle_rank, num_points, voxel_size, mode, mxGetLogicals(plhs[0])) == SIZE_MAX){
+        mexErrMsgIdAndTxt("Mocttree:voxelmoct:size", "The cloud spans more than 2^%d voxels, use a larger voxel_size", VOXEL_BITS);
+    }
+}
@@ -0,0 +1,785 @@
+/*
+    Benchmark of building and querying the octrees on synthetic road corridors
+    The scene is made from the seed alone, so a run is repeatable on any machine and
+    two builds of the library can be compared on the same points and the same queries.
+
+    The corridor is a gently curving, climbing road with verges, noise walls on every
+    other stretch, overpasses crossing it and a tunnel. The queries are the scan frusta
+    of road points along it, the same ones the clearance scan makes (see moctscan.h).
+
+    Every build mode of createfreemoct and every query of the query_* MEX files is run
+    through the same code they run (moctbuild.h, moctcount.h, moctindex.h, moctscan.h),
+    and the results are printed as csv to stdout, a row per kernel and tree:
+      kernel         the MEX file (and build mode) it stands for
+      tree           insert, bulk, linear or tight, the mode the tree was built with
+      leaf           most points a leaf holds, MOCT_BUCKET or LINEAR_LEAF (both are set when
+                     compiling, make sweep builds and runs the bench at several)
+      threads        OpenMP threads, serial kernels always use 1
+      points         points in the scene
+      queries        constraints (or road points for the clearance scan), 0 for builds
+      seconds        best of the repeats
+      points_per_s   points built per second, empty for queries
+      queries_per_s  empty for builds
+      nodes_visited  boxes checked by all the queries, empty for builds
+      found          points found by all the queries, empty for builds
+      peak_rss_kb    the process' peak resident memory so far, so it only grows, run
+                     one --tree at a time to compare the memory of the trees
+
+    Run with --help for the options.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <omp.h>
+#include "moctbuild.h"
+#include "moctcount.h"
+#include "moctindex.h"
+#include "moctscan.h"
+
+#if defined(_WIN32)
+# include <windows.h>
+# include <psapi.h>
+#else
+# include <sys/resource.h>
+#endif
+
+// The build modes of createfreemoct, see tree_names
+# define NUM_TREES 4
+
+
+/*
+    What to build and query
+*/
+typedef struct bench_settings{
+    size_t num_points;
+    uint64_t seed;
+    double length;              // Of the road, metres
+    size_t num_road_points;     // Spread evenly along the road
+    size_t repeats;
+    double target_plane_width;  // The scan of the clearance scripts
+    double scanwidth;
+    double observer_height;
+    double max_height;
+    double max_side;
+    size_t min_pts;             // Also the limit of query_count_moct_par_lim
+    size_t index_every;         // Every this many frusta are also index queries
+    cull_mode cull;
+    bool trees[NUM_TREES];      // insert, bulk, linear, tight
+} bench_settings;
+
+
+static const char* tree_names[NUM_TREES] = {"insert", "bulk", "linear", "tight"};
+
+
+static void usage(void){
+    fputs(
+        "usage: bench [options]\n"
+        "\n"
+        "Builds octrees of a synthetic road corridor and times the builds and the queries,\n"
+        "writes csv to stdout (see bench.c for the columns).\n"
+        "\n"
+        "options:\n"
+        "  --points N             points in the scene, 2000000\n"
+        "  --seed S               1, the same seed always gives the same scene\n"
+        "  --length L             of the road in metres, 300\n"
+        "  --road-points N        road points scanned, 200\n"
+        "  --repeats N            the times are the best of N runs, 3\n"
+        "  --scanwidth W          10 (target plane width 0.1, so 101 frusta each way)\n"
+        "  --min-pts N            3, the limit of query_count_moct_par_lim\n"
+        "  --index-every N        every N-th frustum is also an index query, 10\n"
+        "  --tree MODE            only insert, bulk, linear or tight, can be repeated, all by default\n"
+        "  --exact                exact culling (see the readme)\n"
+        "Threads are set with OMP_NUM_THREADS.\n", stderr);
+}
+
+
+static void fail(const char* message){
+    fprintf(stderr, "bench: %s\n", message);
+    exit(EXIT_FAILURE);
+}
+
+
+static void parse_arguments(int argc, char** argv, bench_settings* set){
+    set->num_points = 2000000;
+    set->seed = 1;
+    set->length = 300;
+    set->num_road_points = 200;
+    set->repeats = 3;
+    set->target_plane_width = 0.1;
+    set->scanwidth = 10;
+    set->observer_height = 3;
+    set->max_height = 20;
+    set->max_side = 16;
+    set->min_pts = 3;
+    set->index_every = 10;
+    set->cull = CULL_PLANES;
+    bool any_tree = false;
+    for (int t = 0; t < NUM_TREES; t++){
+        set->trees[t] = false;
+    }
+
+    static const char* names[] = {
+        "--points", "--seed", "--length", "--road-points", "--repeats", "--scanwidth", "--min-pts", "--index-every"
+    };
+
+    for (int i = 1; i < argc; i++){
+        const char* arg = argv[i];
+        if (strcmp(arg, "--exact") == 0){
+            set->cull = CULL_EXACT;
+        } else if (strcmp(arg, "--tree") == 0 && i + 1 < argc){
+            const char* mode = argv[++i];
+            int which = -1;
+            for (int t = 0; t < NUM_TREES; t++){
+                if (strcmp(mode, tree_names[t]) == 0) which = t;
+            }
+            if (which < 0) fail("--tree must be insert, bulk, linear or tight");
+            set->trees[which] = true;
+            any_tree = true;
+        } else {
+            int which = -1;
+            for (int k = 0; k < (int)(sizeof(names)/sizeof(names[0])); k++){
+                if (strcmp(arg, names[k]) == 0) which = k;
+            }
+            if (which < 0 || i + 1 == argc){
+                usage();
+                exit(EXIT_FAILURE);
+            }
+            char* end = NULL;
+            double value = strtod(argv[++i], &end);
+            if (*end != '\0' || !(value > 0)){
+                fprintf(stderr, "bench: %s must be a number above 0\n", arg);
+                exit(EXIT_FAILURE);
+            }
+            switch (which){
+                case 0: set->num_points = (size_t)value; break;
+                case 1: set->seed = (uint64_t)value; break;
+                case 2: set->length = value; break;
+                case 3: set->num_road_points = (size_t)value; break;
+                case 4: set->repeats = (size_t)value; break;
+                case 5: set->scanwidth = value; break;
+                case 6: set->min_pts = (size_t)value; break;
+                default: set->index_every = (size_t)value; break;
+            }
+        }
+    }
+
+    if (!any_tree){
+        for (int t = 0; t < NUM_TREES; t++){
+            set->trees[t] = true;
+        }
+    }
+    if (set->num_points > UINT32_MAX) fail("--points must be at most 2^32-1, the bulk builds' limit");
+    if (set->repeats < 1 || set->num_road_points < 1 || set->index_every < 1) fail("counts must be at least 1");
+}
+
+
+/*
+    The process' peak resident memory so far in kB
+*/
+static size_t peak_rss_kb(void){
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+    return counters.PeakWorkingSetSize/1024;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+# if defined(__APPLE__)
+    return (size_t)usage.ru_maxrss/1024;    // Bytes on macOS
+# else
+    return (size_t)usage.ru_maxrss;
+# endif
+#endif
+}
+
+
+/*
+    A row of the csv, the fields that don't apply are given as negative and left empty
+*/
+static void print_row(const char* kernel, const char* tree, int leaf, int threads, size_t num_points, size_t num_queries,
+                      double seconds, double points_per_s, double queries_per_s, double nodes_visited, double found){
+    printf("%s,%s,%d,%d,%zu,%zu,%.6f,", kernel, tree, leaf, threads, num_points, num_queries, seconds);
+    double optional[4] = {points_per_s, queries_per_s, nodes_visited, found};
+    for (int k = 0; k < 4; k++){
+        if (optional[k] >= 0) printf("%.0f", optional[k]);
+        putchar(',');
+    }
+    printf("%zu\n", peak_rss_kb());
+    fflush(stdout);
+}
+
+
+/*
+    splitmix64, the i-th number of a stream is known without the ones before it, so the
+    points are made in parallel and still only depend on the seed
+*/
+static inline uint64_t bench_hash(uint64_t x){
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30))*0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27))*0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+
+/*
+    Uniform in [0, 1), the n-th draw of the point's stream
+*/
+static inline double bench_uniform(uint64_t stream, int n){
+    return (double)(bench_hash(stream + (uint64_t)n*0xd1b54a32d192ed03ull) >> 11)*(1./9007199254740992.);
+}
+
+
+/*
+    The road's centre line, s is the distance along x
+    It curves 20 m either way every ~940 m and climbs 2%
+*/
+static inline vec3 road_centre(double s){
+    vec3 centre = {{s, 20.*sin(s/150.), 0.02*s}};
+    return centre;
+}
+
+
+static inline vec3 road_forward(double s){
+    vec3 forward = {{1., 20./150.*cos(s/150.), 0.}};
+    double norm = sqrt(vec3_dot(forward, forward));
+    for (int j = 0; j < 3; j++){
+        forward.pos[j] /= norm;
+    }
+    return forward;
+}
+
+
+static inline vec3 road_leftward(double s){
+    vec3 forward = road_forward(s);
+    vec3 leftward = {{-forward.pos[1], forward.pos[0], 0.}};
+    return leftward;
+}
+
+
+/*
+    The surfaces of the corridor, in road coordinates: s along the road, u to the left
+    of the centre line and z above it
+*/
+typedef enum surface_kind{
+    SURFACE_FLAT = 0,   // u from u0 to u1 at height z0
+    SURFACE_WALL = 1,   // at u0, z from z0 to z1
+    SURFACE_ARCH = 2    // half circle of radius u0 (across) and z0 (up)
+} surface_kind;
+
+
+typedef struct surface{
+    surface_kind kind;
+    double s0, s1;
+    double u0, u1;
+    double z0, z1;
+    double area;
+} surface;
+
+
+# define MAX_SURFACES 256
+# define BENCH_PI 3.14159265358979323846
+
+
+static size_t add_surface(surface* surfaces, size_t num, surface_kind kind, double s0, double s1,
+                          double u0, double u1, double z0, double z1){
+    if (num == MAX_SURFACES) fail("Too many surfaces, use a shorter --length");
+    surface surf = {kind, s0, s1, u0, u1, z0, z1, 0.};
+    double along = s1 - s0;
+    if (kind == SURFACE_FLAT) surf.area = along*(u1 - u0);
+    if (kind == SURFACE_WALL) surf.area = along*(z1 - z0);
+    // Ramanujan's perimeter of an ellipse, halved
+    if (kind == SURFACE_ARCH) surf.area = along*BENCH_PI/2*(3*(u0 + z0) - sqrt((3*u0 + z0)*(u0 + 3*z0)));
+    surfaces[num] = surf;
+    return num + 1;
+}
+
+
+/*
+    Lays out the corridor, returns the number of surfaces
+    Road 14 m wide with 8 m verges, walls 4 m high beside every other 250 m, an
+    overpass (deck 12 m wide, 1 m thick, 5.5 m up) every 300 m and a 100 m tunnel
+    at 60% of the way
+*/
+static size_t corridor_surfaces(double length, surface* surfaces){
+    size_t num = 0;
+    num = add_surface(surfaces, num, SURFACE_FLAT, 0, length, -7, 7, 0, 0);
+    num = add_surface(surfaces, num, SURFACE_FLAT, 0, length, -15, -7, -0.3, 0);
+    num = add_surface(surfaces, num, SURFACE_FLAT, 0, length, 7, 15, -0.3, 0);
+
+    for (double s = 250; s < length; s += 500){
+        double end = fmin(s + 250, length);
+        num = add_surface(surfaces, num, SURFACE_WALL, s, end, -9, 0, 0, 4);
+        num = add_surface(surfaces, num, SURFACE_WALL, s, end, 9, 0, 0, 4);
+    }
+
+    for (double s = 150; s + 6 < length; s += 300){
+        num = add_surface(surfaces, num, SURFACE_FLAT, s - 6, s + 6, -25, 25, 5.5, 0);
+        num = add_surface(surfaces, num, SURFACE_FLAT, s - 6, s + 6, -25, 25, 6.5, 0);
+        // Its abutments
+        num = add_surface(surfaces, num, SURFACE_WALL, s - 6, s + 6, -16, 0, -0.3, 5.5);
+        num = add_surface(surfaces, num, SURFACE_WALL, s - 6, s + 6, 16, 0, -0.3, 5.5);
+    }
+
+    double tunnel = 0.6*length;
+    num = add_surface(surfaces, num, SURFACE_ARCH, tunnel, fmin(tunnel + 100, length), 10, 0, 7, 0);
+    return num;
+}
+
+
+/*
+    Makes the points of the scene into the x, y and z columns
+    Each surface gets points in proportion to its area, a few cm of noise is added
+    across the surfaces like a real scanner
+*/
+static void make_scene(const bench_settings* set, double* coords[3]){
+    surface surfaces[MAX_SURFACES];
+    size_t num_surfaces = corridor_surfaces(set->length, surfaces);
+    double cumulative[MAX_SURFACES];
+    double total = 0;
+    for (size_t k = 0; k < num_surfaces; k++){
+        total += surfaces[k].area;
+        cumulative[k] = total;
+    }
+
+    uint64_t seed = bench_hash(set->seed);
+    ptrdiff_t i;
+
+    #pragma omp parallel for schedule(static)
+    for (i = 0; i < (ptrdiff_t)set->num_points; i++){
+        uint64_t stream = bench_hash(seed ^ (uint64_t)i);
+        double pick = bench_uniform(stream, 0)*total;
+        size_t k = 0;
+        while (k + 1 < num_surfaces && cumulative[k] <= pick) k++;
+        surface* surf = &surfaces[k];
+
+        double s = surf->s0 + bench_uniform(stream, 1)*(surf->s1 - surf->s0);
+        double a = bench_uniform(stream, 2);
+        double noise = 0.03*(bench_uniform(stream, 3) - 0.5);
+        double u, z;
+        if (surf->kind == SURFACE_FLAT){
+            u = surf->u0 + a*(surf->u1 - surf->u0);
+            z = surf->z0 + noise;
+        } else if (surf->kind == SURFACE_WALL){
+            u = surf->u0 + noise;
+            z = surf->z0 + a*(surf->z1 - surf->z0);
+        } else {
+            u = (surf->u0 + noise)*cos(BENCH_PI*a);
+            z = (surf->z0 + noise)*sin(BENCH_PI*a);
+        }
+
+        vec3 point = vec3_add_scaled(road_centre(s), road_leftward(s), u);
+        coords[0][i] = point.pos[0];
+        coords[1][i] = point.pos[1];
+        coords[2][i] = point.pos[2] + z;
+    }
+}
+
+
+/*
+    The road points, forwards and leftwards of the scan (3 x num_road_points each)
+    The first and last 10 m are left out so every scan sees a full corridor
+*/
+static void make_road(const bench_settings* set, double* road, double* forwards, double* leftwards){
+    double margin = fmin(10, set->length/4);
+    for (size_t i = 0; i < set->num_road_points; i++){
+        double s = margin + (set->length - 2*margin)*((double)i + 0.5)/(double)set->num_road_points;
+        vec3 centre = road_centre(s);
+        vec3 forward = road_forward(s);
+        vec3 leftward = road_leftward(s);
+        for (int j = 0; j < 3; j++){
+            road[3*i+j] = centre.pos[j];
+            forwards[3*i+j] = forward.pos[j];
+            leftwards[3*i+j] = leftward.pos[j];
+        }
+    }
+}
+
+
+/*
+    Every frustum the scan of the road points makes, in the order scan_road_point
+    makes them: each road point, up, left then right, each scantile
+    Returns the frusta, num_frusta is set
+*/
+static scan_frustum* make_frusta(const scan_params* params, const double* road, const double* forwards,
+                                 const double* leftwards, size_t num_road_points, size_t* num_frusta){
+    *num_frusta = 3*params->scantiles*num_road_points;
+    scan_frustum* frusta = moct_malloc(*num_frusta*sizeof(scan_frustum));
+    const scan_direction directions[3] = {SCAN_UP, SCAN_LEFT, SCAN_RIGHT};
+    vec3 up = {{0., 0., 1.}};
+    vec3 corners[4];
+
+    size_t f = 0;
+    for (size_t i = 0; i < num_road_points; i++){
+        vec3 road_point = {{road[3*i], road[3*i+1], road[3*i+2]}};
+        vec3 forward = {{forwards[3*i], forwards[3*i+1], forwards[3*i+2]}};
+        vec3 leftward = {{leftwards[3*i], leftwards[3*i+1], leftwards[3*i+2]}};
+        vec3 flat_leftward = {{leftward.pos[0], leftward.pos[1], 0.}};
+
+        for (int d = 0; d < 3; d++){
+            for (size_t j = 0; j < params->scantiles; j++){
+                vec3 observer;
+                if (directions[d] == SCAN_UP){
+                    observer = vec3_add_scaled(road_point, up, params->observer_height);
+                    observer = vec3_add_scaled(observer, flat_leftward, params->h_offsets[j]*params->target_plane_width);
+                } else {
+                    observer = vec3_add_scaled(road_point, up, 1. + params->v_offsets[j]*params->target_plane_width);
+                }
+                scan_target_corners(observer, forward, leftward, params->target_plane_width, directions[d],
+                                    params->max_height, params->max_side, corners);
+                frustum_constraint(observer, corners, &frusta[f++].c);
+            }
+        }
+    }
+    return frusta;
+}
+
+
+/*
+    The results of running the queries once
+*/
+typedef struct query_totals{
+    double seconds;
+    size_t nodes_visited;
+    size_t found;
+} query_totals;
+
+
+/*
+    Counts every frustum one after another, like query_count_moct called in a loop
+    counts gets the count of each
+*/
+static query_totals run_count(void* tree, const bench_settings* set, scan_frustum* frusta, size_t num_frusta,
+                              uint64_t* counts){
+    query_totals totals = {0., 0, 0};
+    exact_cull exact;
+    double start = omp_get_wtime();
+    for (size_t i = 0; i < num_frusta; i++){
+        constraint* cons = &frusta[i].c;
+        cons->nodes_visited = 0;
+        constraint_cull(cons, &exact, set->cull, tree);
+        counts[i] = query_count_any(cons, tree, COUNT_NO_LIMIT);
+        totals.nodes_visited += cons->nodes_visited;
+        totals.found += counts[i];
+    }
+    totals.seconds = omp_get_wtime() - start;
+    return totals;
+}
+
+
+/*
+    Counts every frustum in parallel, like query_count_moct_par, or with a limit like
+    query_count_moct_par_lim
+    Each thread counts its own copy of a frustum, like the MEX files copy them from
+    the cell array
+*/
+static query_totals run_count_par(void* tree, const bench_settings* set, scan_frustum* frusta, size_t num_frusta,
+                                  uint64_t limit, uint64_t* counts){
+    query_totals totals = {0., 0, 0};
+    size_t nodes_visited = 0;
+    size_t found = 0;
+    double start = omp_get_wtime();
+
+    #pragma omp parallel reduction(+:nodes_visited, found)
+    {
+        scan_frustum cons;
+        exact_cull exact;
+        ptrdiff_t i;
+
+        #pragma omp for schedule(dynamic)
+        for (i = 0; i < (ptrdiff_t)num_frusta; i++){
+            cons = frusta[i];
+            cons.c.nodes_visited = 0;
+            constraint_cull(&cons.c, &exact, set->cull, tree);
+            counts[i] = query_count_any(&cons.c, tree, limit);
+            nodes_visited += cons.c.nodes_visited;
+            found += counts[i];
+        }
+    }
+    totals.seconds = omp_get_wtime() - start;
+    totals.nodes_visited = nodes_visited;
+    totals.found = found;
+    return totals;
+}
+
+
+/*
+    The indexes of every index_every-th frustum, one after another like query_index_moct
+    Each array is freed straight away, like MATLAB would free an unused result
+*/
+static query_totals run_index(void* tree, const bench_settings* set, scan_frustum* frusta, size_t num_frusta,
+                              const uint64_t* counts){
+    query_totals totals = {0., 0, 0};
+    exact_cull exact;
+    double start = omp_get_wtime();
+    for (size_t i = 0; i < num_frusta; i += set->index_every){
+        constraint* cons = &frusta[i].c;
+        cons->nodes_visited = 0;
+        constraint_cull(cons, &exact, set->cull, tree);
+        size_t* index_array;
+        size_t num_found = query_index_any(cons, tree, &index_array);
+        moct_free(index_array);
+        if (num_found != counts[i]) fail("query_index_moct found a different number of points than query_count_moct");
+        totals.nodes_visited += cons->nodes_visited;
+        totals.found += num_found;
+    }
+    totals.seconds = omp_get_wtime() - start;
+    return totals;
+}
+
+
+/*
+    The same index queries all at once, like query_index_moct_par: counted in parallel,
+    each array made at its size, then filled in parallel
+*/
+static query_totals run_index_par(void* tree, const bench_settings* set, scan_frustum* frusta, size_t num_frusta,
+                                  const uint64_t* counts){
+    query_totals totals = {0., 0, 0};
+    size_t num_index = (num_frusta + set->index_every - 1)/set->index_every;
+    size_t* found = moct_malloc(num_index*sizeof(size_t));
+    size_t** index_arrays = moct_malloc(num_index*sizeof(size_t*));
+    size_t nodes_visited = 0;
+    double start = omp_get_wtime();
+
+    for (int pass = 0; pass < 2; pass++){
+        if (pass == 1){
+            for (size_t k = 0; k < num_index; k++){
+                index_arrays[k] = moct_malloc(found[k]*sizeof(size_t));
+            }
+        }
+
+        #pragma omp parallel reduction(+:nodes_visited)
+        {
+            scan_frustum cons;
+            exact_cull exact;
+            ptrdiff_t k;
+
+            #pragma omp for schedule(dynamic)
+            for (k = 0; k < (ptrdiff_t)num_index; k++){
+                cons = frusta[k*set->index_every];
+                cons.c.nodes_visited = 0;
+                constraint_cull(&cons.c, &exact, set->cull, tree);
+                if (pass == 0){
+                    found[k] = query_count_any(&cons.c, tree, COUNT_NO_LIMIT);
+                } else {
+                    query_index_fill(&cons.c, tree, index_arrays[k]);
+                }
+                nodes_visited += cons.c.nodes_visited;
+            }
+        }
+    }
+
+    for (size_t k = 0; k < num_index; k++){
+        moct_free(index_arrays[k]);
+        if (found[k] != counts[k*set->index_every]) fail("query_index_moct_par found a different number of points than query_count_moct");
+        totals.found += found[k];
+    }
+    totals.seconds = omp_get_wtime() - start;
+    totals.nodes_visited = nodes_visited;
+    moct_free(found);
+    moct_free(index_arrays);
+    return totals;
+}
+
+
+/*
+    Builds a tree of the scene with one of the modes of createfreemoct
+*/
+static void* build_tree(int mode, vec3 point1, vec3 point2, const point_source* source, size_t num_points){
+    if (mode >= 2) return linear_tree(point1, point2, source, num_points, mode == 3);
+
+    mocttree* tree = create_tree(point1, point2);
+    if (mode == 1){
+        bulk_tree(tree, source, num_points);
+    } else {
+        for (size_t i = 0; i < num_points; i++){
+            insert_tree(tree, source_point(source, i));
+        }
+    }
+    return tree;
+}
+
+
+static void keep_best(query_totals* best, query_totals run, size_t repeat){
+    if (repeat == 0 || run.seconds < best->seconds) *best = run;
+}
+
+
+int main(int argc, char** argv){
+    bench_settings set;
+    parse_arguments(argc, argv, &set);
+    select_halfspace_kernel();
+    int threads = omp_get_max_threads();
+
+    double* coords[3];
+    for (int j = 0; j < 3; j++){
+        coords[j] = moct_malloc(set.num_points*sizeof(double));
+    }
+    make_scene(&set, coords);
+    fprintf(stderr, "bench: %zu points along %.0f m, seed %llu, %d threads, depth at most %d\n",
+            set.num_points, set.length, (unsigned long long)set.seed, threads, MOCT_MAX_DEPTH);
+
+    // The bounds of the points, expanded by 10% each way like createfreemoct
+    vec3 point1 = {{0., 0., 0.}};
+    vec3 point2 = {{1., 1., 1.}};
+    for (int j = 0; j < 3 && set.num_points > 0; j++){
+        double low = INFINITY, high = -INFINITY;
+        for (size_t i = 0; i < set.num_points; i++){
+            low = fmin(low, coords[j][i]);
+            high = fmax(high, coords[j][i]);
+        }
+        point1.pos[j] = 1.1*low - 0.1*high;
+        point2.pos[j] = 1.1*high - 0.1*low;
+    }
+    point_source source;
+    for (int j = 0; j < 3; j++){
+        source.coords[j] = coords[j];
+    }
+    source.stride = 1;
+
+    // The scan of the clearance scripts
+    size_t scantiles = (size_t)ceil(set.scanwidth/set.target_plane_width);
+    if (scantiles % 2 == 0) scantiles++;
+    size_t middlescan = (scantiles + 1)/2;
+    double* h_offsets = moct_malloc(scantiles*sizeof(double));
+    double* v_offsets = moct_malloc(scantiles*sizeof(double));
+    for (size_t j = 0; j < scantiles; j++){
+        h_offsets[j] = (double)(j + 1) - (double)middlescan;
+        v_offsets[j] = (double)(j + 1);
+    }
+    scan_params params;
+    params.target_plane_width = set.target_plane_width;
+    params.observer_height = set.observer_height;
+    params.max_height = set.max_height;
+    params.max_side = set.max_side;
+    params.min_pts = set.min_pts;
+    params.kth = 1;
+    params.scantiles = scantiles;
+    params.cull = set.cull;
+    params.h_offsets = h_offsets;
+    params.v_offsets = v_offsets;
+
+    size_t num_road_points = set.num_road_points;
+    double* road = moct_malloc(3*num_road_points*sizeof(double));
+    double* forwards = moct_malloc(3*num_road_points*sizeof(double));
+    double* leftwards = moct_malloc(3*num_road_points*sizeof(double));
+    make_road(&set, road, forwards, leftwards);
+
+    size_t num_frusta;
+    scan_frustum* frusta = make_frusta(&params, road, forwards, leftwards, num_road_points, &num_frusta);
+    size_t num_index = (num_frusta + set.index_every - 1)/set.index_every;
+
+    uint64_t* counts = moct_malloc(num_frusta*sizeof(uint64_t));
+    uint64_t* par_counts = moct_malloc(num_frusta*sizeof(uint64_t));
+    double* top = moct_malloc(3*scantiles*num_road_points*sizeof(double));
+    double* left = top + scantiles*num_road_points;
+    double* right = left + scantiles*num_road_points;
+    double* visited = moct_malloc(num_road_points*sizeof(double));
+
+    // The answers of the first tree, every other tree must agree
+    uint64_t* first_counts = NULL;
+    double* first_clearances = NULL;
+
+    puts("kernel,tree,leaf,threads,points,queries,seconds,points_per_s,queries_per_s,nodes_visited,found,peak_rss_kb");
+    for (int mode = 0; mode < NUM_TREES; mode++){
+        if (!set.trees[mode]) continue;
+        const char* name = tree_names[mode];
+        int leaf = mode >= 2 ? LINEAR_LEAF : MOCT_BUCKET;
+
+        void* tree = NULL;
+        double best = INFINITY;
+        for (size_t r = 0; r < set.repeats; r++){
+            if (tree != NULL) moct_free_tree(tree);
+            double start = omp_get_wtime();
+            tree = build_tree(mode, point1, point2, &source, set.num_points);
+            best = fmin(best, omp_get_wtime() - start);
+        }
+        // Inserting is one point at a time, the others sort in parallel
+        print_row("createfreemoct", name, leaf, mode == 0 ? 1 : threads, set.num_points, 0, best,
+                  (double)set.num_points/best, -1, -1, -1);
+
+        query_totals totals = {0., 0, 0};
+        for (size_t r = 0; r < set.repeats; r++){
+            keep_best(&totals, run_count(tree, &set, frusta, num_frusta, counts), r);
+        }
+        print_row("query_count_moct", name, leaf, 1, set.num_points, num_frusta, totals.seconds, -1,
+                  (double)num_frusta/totals.seconds, (double)totals.nodes_visited, (double)totals.found);
+
+        for (size_t r = 0; r < set.repeats; r++){
+            keep_best(&totals, run_count_par(tree, &set, frusta, num_frusta, COUNT_NO_LIMIT, par_counts), r);
+        }
+        if (memcmp(counts, par_counts, num_frusta*sizeof(uint64_t)) != 0){
+            fail("query_count_moct_par disagrees with query_count_moct");
+        }
+        print_row("query_count_moct_par", name, leaf, threads, set.num_points, num_frusta, totals.seconds, -1,
+                  (double)num_frusta/totals.seconds, (double)totals.nodes_visited, (double)totals.found);
+
+        for (size_t r = 0; r < set.repeats; r++){
+            keep_best(&totals, run_count_par(tree, &set, frusta, num_frusta, set.min_pts, par_counts), r);
+        }
+        for (size_t i = 0; i < num_frusta; i++){
+            // Stopping early still counts at least up to the limit
+            bool ok = counts[i] < set.min_pts ? par_counts[i] == counts[i] : par_counts[i] >= set.min_pts && par_counts[i] <= counts[i];
+            if (!ok) fail("query_count_moct_par_lim disagrees with query_count_moct");
+        }
+        print_row("query_count_moct_par_lim", name, leaf, threads, set.num_points, num_frusta, totals.seconds, -1,
+                  (double)num_frusta/totals.seconds, (double)totals.nodes_visited, (double)totals.found);
+
+        for (size_t r = 0; r < set.repeats; r++){
+            keep_best(&totals, run_index(tree, &set, frusta, num_frusta, counts), r);
+        }
+        print_row("query_index_moct", name, leaf, 1, set.num_points, num_index, totals.seconds, -1,
+                  (double)num_index/totals.seconds, (double)totals.nodes_visited, (double)totals.found);
+
+        for (size_t r = 0; r < set.repeats; r++){
+            keep_best(&totals, run_index_par(tree, &set, frusta, num_frusta, counts), r);
+        }
+        print_row("query_index_moct_par", name, leaf, threads, set.num_points, num_index, totals.seconds, -1,
+                  (double)num_index/totals.seconds, (double)totals.nodes_visited, (double)totals.found);
+
+        // The whole scan, the frusta of a road point walk the tree together
+        double scan_best = INFINITY;
+        for (size_t r = 0; r < set.repeats; r++){
+            double start = omp_get_wtime();
+            scan_clearances(tree, &params, road, forwards, leftwards, num_road_points, top, left, right, visited);
+            scan_best = fmin(scan_best, omp_get_wtime() - start);
+        }
+        double scan_visited = 0;
+        for (size_t i = 0; i < num_road_points; i++){
+            scan_visited += visited[i];
+        }
+        print_row("query_clearances_moct_par", name, leaf, threads, set.num_points, num_road_points, scan_best, -1,
+                  (double)num_road_points/scan_best, scan_visited, -1);
+
+        if (first_counts == NULL){
+            first_counts = moct_malloc(num_frusta*sizeof(uint64_t));
+            memcpy(first_counts, counts, num_frusta*sizeof(uint64_t));
+            first_clearances = moct_malloc(3*scantiles*num_road_points*sizeof(double));
+            memcpy(first_clearances, top, 3*scantiles*num_road_points*sizeof(double));
+        } else if (memcmp(first_counts, counts, num_frusta*sizeof(uint64_t)) != 0 ||
+                   memcmp(first_clearances, top, 3*scantiles*num_road_points*sizeof(double)) != 0){
+            fprintf(stderr, "bench: the %s tree gives different results\n", name);
+            exit(EXIT_FAILURE);
+        }
+
+        moct_free_tree(tree);
+    }
+
+    for (int j = 0; j < 3; j++){
+        moct_free(coords[j]);
+    }
+    moct_free(h_offsets);
+    moct_free(v_offsets);
+    moct_free(road);
+    moct_free(forwards);
+    moct_free(leftwards);
+    moct_free(frusta);
+    moct_free(counts);
+    moct_free(par_counts);
+    moct_free(top);
+    moct_free(visited);
+    moct_free(first_counts);
+    moct_free(first_clearances);
+    return 0;
+}
@@ -0,0 +1,535 @@
+/*
+    The clearance tool without MATLAB
+    Runs the same steps as get_clearances_octree.m on a las file, load, trajectory,
+    octree, clearances and candidates, and writes the results as csv files instead of
+    plotting them. Everything is the octree library in +octtrees (the headers), built
+    with the make file next to this.
+
+    Run without arguments for the usage.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <omp.h>
+#include <sys/stat.h>
+#include "moctbuild.h"
+#include "moctscan.h"
+#include "moctfile.h"
+#include "moctlas.h"
+#include "mocttraj.h"
+#include "moctvoxel.h"
+
+#if defined(_WIN32)
+# include <direct.h>
+# define make_folder(path) _mkdir(path)
+#else
+# define make_folder(path) mkdir(path, 0777)
+#endif
+
+
+/*
+    The variables of get_clearances_octree.m, and what to do with them
+*/
+typedef struct settings{
+    double target_plane_width;
+    double scanwidth;
+    double observer_height;
+    double max_height;
+    double max_side;
+    double min_pts;
+    double candidate_buffer;
+    double candidate_padding;
+    double sample_percent;
+    bool translate_pts;
+    double voxel_size;      // 0 keeps every point
+    bool voxel_lowest;
+    double floor_box_edge;
+    cull_mode cull;
+    bool use_saved;         // Map the octree saved next to the las file, and save it if there isn't one
+    const char* las_file;
+    const char* out_folder;
+} settings;
+
+
+static void usage(void){
+    fputs(
+        "usage: clearances [options] file.las [output folder]\n"
+        "\n"
+        "Measures the top, left and right clearances along the drive in file.las and finds\n"
+        "the candidates (bridges, tunnels, ...), like get_clearances_octree.m. Writes to the\n"
+        "output folder (default out/<file.las>):\n"
+        "  road_points.csv        distance along the road, x, y, z of each road point\n"
+        "  top_clearances.csv     a row per road point, a column per scantile\n"
+        "  left_clearances.csv    (the transpose of the matrices in the scripts)\n"
+        "  right_clearances.csv\n"
+        "  candidates.csv         candidate, first and last road point (1 based) of each run\n"
+        "\n"
+        "options (defaults are the scripts'):\n"
+        "  --target-plane-width W   0.1\n"
+        "  --scanwidth W            10\n"
+        "  --observer-height H      3\n"
+        "  --max-height H           20\n"
+        "  --max-side D             16\n"
+        "  --min-pts N              3\n"
+        "  --candidate-buffer D     10\n"
+        "  --candidate-padding D    4\n"
+        "  --sample-percent P       1 (1, 0.5, 0.25, ...)\n"
+        "  --no-translate           keep the las offsets in the points\n"
+        "  --voxel-size V           0 (every point), thin the points to one in every voxel\n"
+        "  --voxel-first            keep the first point of each voxel, not the lowest\n"
+        "  --floor-box-edge D       2\n"
+        "  --exact                  exact culling (see the readme, same results)\n"
+        "  --no-saved-octree        don't map or save file.las.moct\n"
+        "Threads are set with OMP_NUM_THREADS.\n", stderr);
+}
+
+
+static double elapsed(double start){
+    return omp_get_wtime() - start;
+}
+
+
+static void fail(const char* message){
+    fprintf(stderr, "clearances: %s\n", message);
+    exit(EXIT_FAILURE);
+}
+
+
+/*
+    Reads the arguments into the settings, exits with the usage if they're bad
+*/
+static void parse_arguments(int argc, char** argv, settings* set){
+    set->target_plane_width = 0.1;
+    set->scanwidth = 10;
+    set->observer_height = 3;
+    set->max_height = 20;
+    set->max_side = 16;
+    set->min_pts = 3;
+    set->candidate_buffer = 10;
+    set->candidate_padding = 4;
+    set->sample_percent = 1;
+    set->translate_pts = true;
+    set->voxel_size = 0;
+    set->voxel_lowest = true;
+    set->floor_box_edge = 2;
+    set->cull = CULL_PLANES;
+    set->use_saved = true;
+    set->las_file = NULL;
+    set->out_folder = NULL;
+
+    static const char* names[] = {
+        "--target-plane-width", "--scanwidth", "--observer-height", "--max-height", "--max-side",
+        "--min-pts", "--candidate-buffer", "--candidate-padding", "--sample-percent", "--floor-box-edge",
+        "--voxel-size"
+    };
+    double* values[] = {
+        &set->target_plane_width, &set->scanwidth, &set->observer_height, &set->max_height, &set->max_side,
+        &set->min_pts, &set->candidate_buffer, &set->candidate_padding, &set->sample_percent, &set->floor_box_edge,
+        &set->voxel_size
+    };
+
+    for (int i = 1; i < argc; i++){
+        const char* arg = argv[i];
+        if (strcmp(arg, "--no-translate") == 0){
+            set->translate_pts = false;
+        } else if (strcmp(arg, "--voxel-first") == 0){
+            set->voxel_lowest = false;
+        } else if (strcmp(arg, "--exact") == 0){
+            set->cull = CULL_EXACT;
+        } else if (strcmp(arg, "--no-saved-octree") == 0){
+            set->use_saved = false;
+        } else if (strncmp(arg, "--", 2) == 0){
+            int which = -1;
+            for (int k = 0; k < (int)(sizeof(names)/sizeof(names[0])); k++){
+                if (strcmp(arg, names[k]) == 0) which = k;
+            }
+            char* end = NULL;
+            if (which < 0 || i + 1 == argc) {
+                usage();
+                exit(EXIT_FAILURE);
+            }
+            *values[which] = strtod(argv[++i], &end);
+            // A voxel size of 0 keeps every point
+            if (values[which] == &set->voxel_size){
+                if (*end != '\0' || !(*values[which] >= 0)){
+                    fprintf(stderr, "clearances: %s must be a number, 0 or above\n", arg);
+                    exit(EXIT_FAILURE);
+                }
+            } else if (*end != '\0' || !(*values[which] > 0)){
+                fprintf(stderr, "clearances: %s must be a number above 0\n", arg);
+                exit(EXIT_FAILURE);
+            }
+            // A count of points, which there are at most 2^32-1 of, it would be truncated
+            if (values[which] == &set->min_pts && (*values[which] != floor(*values[which]) || *values[which] > UINT32_MAX)){
+                fprintf(stderr, "clearances: %s must be a whole number, at most 2^32-1\n", arg);
+                exit(EXIT_FAILURE);
+            }
+        } else if (set->las_file == NULL){
+            set->las_file = arg;
+        } else if (set->out_folder == NULL){
+            set->out_folder = arg;
+        } else {
+            usage();
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (set->las_file == NULL){
+        usage();
+        exit(EXIT_FAILURE);
+    }
+    if (set->sample_percent > 1){
+        fail("--sample-percent must be at most 1");
+    }
+}
+
+
+/*
+    Loads every sample_step-th point sorted by time, thinned to a point a voxel if asked,
+    like load_las_points.m
+    Returns the number of points
+*/
+static size_t load_points(const settings* set, las_header* header, las_columns* points){
+    const char* error;
+    FILE* file = las_open(set->las_file, header, &error);
+    if (file == NULL) fail(error);
+
+    uint64_t step = (uint64_t)ceil(1/set->sample_percent);
+    uint64_t num_kept = las_first_kept(header->num_points, step);
+    if (num_kept > UINT32_MAX) fail("At most 2^32-1 points can be kept, use a smaller --sample-percent");
+
+    double shift[3];
+    for (int j = 0; j < 3; j++){
+        shift[j] = set->translate_pts ? header->offset[j] : 0.;
+    }
+
+    *points = las_columns_alloc((size_t)num_kept);
+    bool ok = las_read_rows(file, header, step, shift, points);
+    fclose(file);
+    if (!ok) fail("The file has fewer points than its header says");
+
+    uint32_t* order = sort_order_doubles(points->gps_time, (size_t)num_kept);
+    if (order != NULL){
+        for (int j = 0; j < 3; j++){
+            permute_rows(points->coords[j], sizeof(double), order, (size_t)num_kept);
+        }
+        permute_rows(points->gps_time, sizeof(double), order, (size_t)num_kept);
+        permute_rows(points->scan_angle_rank, sizeof(int16_t), order, (size_t)num_kept);
+        permute_rows(points->point_source_ID, sizeof(uint16_t), order, (size_t)num_kept);
+        moct_free(order);
+    }
+
+    if (set->voxel_size > 0){
+        bool* keep = moct_malloc((size_t)num_kept*sizeof(bool));
+        const double* coords[3] = {points->coords[0], points->coords[1], points->coords[2]};
+        size_t num_thinned = voxel_keep(coords, points->scan_angle_rank, (size_t)num_kept, set->voxel_size,
+                                        set->voxel_lowest ? VOXEL_LOWEST : VOXEL_FIRST, keep);
+        if (num_thinned == SIZE_MAX) fail("The cloud spans too many voxels, use a larger --voxel-size");
+
+        // Squeezed down in place, in the same order
+        size_t k = 0;
+        for (size_t i = 0; i < (size_t)num_kept; i++){
+            if (!keep[i]) continue;
+            for (int j = 0; j < 3; j++){
+                points->coords[j][k] = points->coords[j][i];
+            }
+            points->gps_time[k] = points->gps_time[i];
+            points->scan_angle_rank[k] = points->scan_angle_rank[i];
+            points->point_source_ID[k] = points->point_source_ID[i];
+            k++;
+        }
+        moct_free(keep);
+        num_kept = num_thinned;
+    }
+    return (size_t)num_kept;
+}
+
+
+/*
+    The octree of the points, mapped from the file saved next to the las file when it
+    has the same key the scripts would give it (see mocttree.cache_key), otherwise built
+    and saved there
+    Sets mapped if the tree must be unmapped rather than freed
+*/
+static linoctree* octree_of(const settings* set, const las_header* header, const las_columns* points,
+                            size_t num_points, bool* mapped){
+    char* tree_file = moct_malloc(strlen(set->las_file) + 8);
+    sprintf(tree_file, "%s.moct", set->las_file);
+
+    // [sample_percent translate_pts], then x, y and z in turn
+    double key_settings[2] = {set->sample_percent, set->translate_pts ? 1. : 0.};
+    uint64_t key = moct_hash(key_settings, 2, MOCT_FILE_VERSION);
+    for (int j = 0; j < 3; j++){
+        key = moct_hash(points->coords[j], num_points, key);
+    }
+
+    linoctree* tree = set->use_saved ? moct_file_map(tree_file, key) : NULL;
+    *mapped = tree != NULL;
+    if (tree == NULL){
+        // The bounds of the points, expanded by 10% each way like createfreemoct
+        vec3 point1 = {{0., 0., 0.}};
+        vec3 point2 = {{1., 1., 1.}};
+        if (num_points > 0){
+            for (int j = 0; j < 3; j++){
+                double low = INFINITY, high = -INFINITY;
+                for (size_t i = 0; i < num_points; i++){
+                    low = fmin(low, points->coords[j][i]);
+                    high = fmax(high, points->coords[j][i]);
+                }
+                point1.pos[j] = 1.1*low - 0.1*high;
+                point2.pos[j] = 1.1*high - 0.1*low;
+            }
+        }
+
+        point_source source;
+        for (int j = 0; j < 3; j++){
+            source.coords[j] = points->coords[j];
+        }
+        source.stride = 1;
+        tree = linear_tree(point1, point2, &source, num_points, true);
+
+        if (set->use_saved && !moct_file_save(tree, tree_file, key)){
+            fprintf(stderr, "clearances: could not save the octree to %s\n", tree_file);
+        }
+    } else {
+        puts("Loaded the saved octree");
+    }
+    moct_free(tree_file);
+    return tree;
+}
+
+
+/*
+    Opens a file of the output folder for writing
+*/
+static FILE* open_output(const settings* set, const char* name){
+    char* path = moct_malloc(strlen(set->out_folder) + strlen(name) + 2);
+    sprintf(path, "%s/%s", set->out_folder, name);
+    FILE* file = fopen(path, "w");
+    if (file == NULL){
+        fprintf(stderr, "clearances: could not write %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    moct_free(path);
+    return file;
+}
+
+
+/*
+    Writes the clearances, scantiles x num_road_points, as a row per road point
+*/
+static void write_clearances(const settings* set, const char* name, const double* clearances,
+                             size_t scantiles, size_t num_road_points){
+    FILE* file = open_output(set, name);
+    for (size_t i = 0; i < num_road_points; i++){
+        for (size_t j = 0; j < scantiles; j++){
+            fprintf(file, j == 0 ? "%.9g" : ",%.9g", clearances[i*scantiles + j]);
+        }
+        fputc('\n', file);
+    }
+    fclose(file);
+}
+
+
+/*
+    Finds the candidates (stretches under something) from the middle top clearances and
+    writes them, the same rules as the filter section of get_clearances_octree.m
+    Returns the number of candidates
+*/
+static size_t write_candidates(const settings* set, const double* middle_top, size_t num_road_points,
+                               double point_density){
+    double avg_clear = 0.;
+    for (size_t i = 0; i < num_road_points; i++){
+        avg_clear += middle_top[i];
+    }
+    avg_clear /= (double)num_road_points;
+
+    ptrdiff_t padding = (ptrdiff_t)round(set->candidate_padding/point_density);
+    ptrdiff_t buffer_limit = (ptrdiff_t)round(set->candidate_buffer/point_density);
+
+    FILE* file = open_output(set, "candidates.csv");
+    fputs("candidate,first,last\n", file);
+
+    // Each candidate is the union of the padded stretches around its road points under
+    // the average, written as runs. A candidate ends once the clearance stays over the
+    // average for buffer_limit road points
+    size_t candidate = 1;
+    size_t num_candidates = 0;
+    ptrdiff_t run_low = 0, run_high = -1;
+    ptrdiff_t buffer = 0;
+    bool prev_state = false;
+    for (ptrdiff_t i = 0; i < (ptrdiff_t)num_road_points; i++){
+        if (middle_top[i] < avg_clear){
+            ptrdiff_t low = i - padding > 0 ? i - padding : 0;
+            ptrdiff_t high = i + padding < (ptrdiff_t)num_road_points - 1 ? i + padding : (ptrdiff_t)num_road_points - 1;
+            if (num_candidates == candidate && low <= run_high + 1){
+                run_high = high;
+            } else {
+                if (run_high >= run_low) fprintf(file, "%zu,%td,%td\n", num_candidates, run_low + 1, run_high + 1);
+                run_low = low;
+                run_high = high;
+            }
+            num_candidates = candidate;
+            prev_state = true;
+            buffer = 0;
+        } else {
+            // buffer attempts to prevent starting a new candidate prematurely
+            if (buffer == buffer_limit && prev_state){
+                candidate++;
+                buffer = 0;
+                prev_state = false;
+            }
+            buffer++;
+        }
+    }
+    if (run_high >= run_low) fprintf(file, "%zu,%td,%td\n", num_candidates, run_low + 1, run_high + 1);
+    fclose(file);
+
+    return num_candidates;
+}
+
+
+int main(int argc, char** argv){
+    settings set;
+    parse_arguments(argc, argv, &set);
+    double tstart = omp_get_wtime();
+
+    char* default_folder = NULL;
+    if (set.out_folder == NULL){
+        // out/<las file name>, like the scripts
+        const char* name = set.las_file;
+        for (const char* c = set.las_file; *c != '\0'; c++){
+            if (*c == '/' || *c == '\\') name = c + 1;
+        }
+        default_folder = moct_malloc(strlen(name) + 8);
+        sprintf(default_folder, "out/%s", name);
+        set.out_folder = default_folder;
+    }
+
+    size_t scantiles = (size_t)ceil(set.scanwidth/set.target_plane_width);
+    if (scantiles % 2 == 0) scantiles++;
+    size_t middlescan = (scantiles + 1)/2;
+
+    // measurements are calculated along a "scan line", offsets serve to create
+    // observers along this line from the initial road point
+    double* h_offsets = moct_malloc(scantiles*sizeof(double));
+    double* v_offsets = moct_malloc(scantiles*sizeof(double));
+    for (size_t j = 0; j < scantiles; j++){
+        h_offsets[j] = (double)(j + 1) - (double)middlescan;
+        v_offsets[j] = (double)(j + 1);
+    }
+    double point_density = set.target_plane_width;
+
+    puts("Loading las file");
+    double start = omp_get_wtime();
+    las_header header;
+    las_columns points;
+    size_t num_points = load_points(&set, &header, &points);
+    printf("%zu points, %.3f s\n", num_points, elapsed(start));
+
+    bool any_time = false, any_angle = false;
+    for (size_t i = 0; i < num_points; i++){
+        any_time = any_time || points.gps_time[i] != 0.;
+        any_angle = any_angle || points.scan_angle_rank[i] != 0;
+    }
+    if (!any_time) fail("No GPS time in LAS file :(, cannot be used to make a trajectory!");
+    if (!any_angle) fail("No scan angle rank in LAS file :(, cannot be used to make trajectory!");
+
+    // Only once the file is known to be usable, so a bad path leaves no empty folder
+    if (default_folder != NULL) make_folder("out");
+    make_folder(set.out_folder);
+
+    puts("Building octree");
+    start = omp_get_wtime();
+    bool mapped;
+    linoctree* tree = octree_of(&set, &header, &points, num_points, &mapped);
+    printf("%.3f s\n", elapsed(start));
+
+    puts("Constructing Trajectory and Headings");
+    start = omp_get_wtime();
+    double* road_points;
+    size_t num_road_points;
+    const char* error = traj_road_points(&points, num_points, point_density, &road_points, &num_road_points);
+    if (error != NULL) fail(error);
+
+    double* forwards = moct_malloc(3*num_road_points*sizeof(double));
+    double* upwards = moct_malloc(3*num_road_points*sizeof(double));
+    double* leftwards = moct_malloc(3*num_road_points*sizeof(double));
+    traj_forwards(road_points, num_road_points, point_density, forwards);
+    size_t num_tilted = traj_upwards(tree, road_points, num_road_points, set.floor_box_edge, upwards);
+    if (num_tilted > 0) printf("BAD ANGLES!!! at %zu road points\n", num_tilted);
+    for (size_t i = 0; i < num_road_points; i++){
+        vec3 up = {{upwards[3*i], upwards[3*i+1], upwards[3*i+2]}};
+        vec3 forward = {{forwards[3*i], forwards[3*i+1], forwards[3*i+2]}};
+        vec3 left = vec3_cross(up, forward);
+        for (int j = 0; j < 3; j++){
+            leftwards[3*i+j] = left.pos[j];
+        }
+    }
+    moct_free(upwards);
+    las_columns_free(&points);
+    printf("%zu road points, %.3f s\n", num_road_points, elapsed(start));
+
+    puts("measuring clearances");
+    start = omp_get_wtime();
+    scan_params params;
+    params.target_plane_width = set.target_plane_width;
+    params.observer_height = set.observer_height;
+    params.max_height = set.max_height;
+    params.max_side = set.max_side;
+    params.min_pts = (size_t)set.min_pts;
+    params.kth = 1;
+    params.scantiles = scantiles;
+    params.cull = set.cull;
+    params.h_offsets = h_offsets;
+    params.v_offsets = v_offsets;
+
+    double* top_clearances = moct_malloc(scantiles*num_road_points*sizeof(double));
+    double* left_clearances = moct_malloc(scantiles*num_road_points*sizeof(double));
+    double* right_clearances = moct_malloc(scantiles*num_road_points*sizeof(double));
+    select_halfspace_kernel();
+    scan_clearances(tree, &params, road_points, forwards, leftwards, num_road_points,
+                    top_clearances, left_clearances, right_clearances, NULL);
+    printf("%.3f s\n", elapsed(start));
+
+    if (mapped){
+        moct_file_unmap(tree);
+    } else {
+        moct_free_tree(tree);
+    }
+
+    puts("Filtering For Candidates");
+    start = omp_get_wtime();
+    double* middle_top = moct_malloc(num_road_points*sizeof(double));
+    for (size_t i = 0; i < num_road_points; i++){
+        middle_top[i] = top_clearances[i*scantiles + middlescan - 1];
+    }
+    size_t num_candidates = write_candidates(&set, middle_top, num_road_points, point_density);
+    moct_free(middle_top);
+
+    FILE* file = open_output(&set, "road_points.csv");
+    for (size_t i = 0; i < num_road_points; i++){
+        fprintf(file, "%.17g,%.17g,%.17g,%.17g\n", (double)i*point_density,
+                road_points[3*i], road_points[3*i+1], road_points[3*i+2]);
+    }
+    fclose(file);
+    write_clearances(&set, "top_clearances.csv", top_clearances, scantiles, num_road_points);
+    write_clearances(&set, "left_clearances.csv", left_clearances, scantiles, num_road_points);
+    write_clearances(&set, "right_clearances.csv", right_clearances, scantiles, num_road_points);
+    printf("%zu candidates, %.3f s\n", num_candidates, elapsed(start));
+
+    moct_free(top_clearances);
+    moct_free(left_clearances);
+    moct_free(right_clearances);
+    moct_free(road_points);
+    moct_free(forwards);
+    moct_free(leftwards);
+    moct_free(h_offsets);
+    moct_free(v_offsets);
+    moct_free(default_folder);
+
+    printf("Complete! %.3f s\n", elapsed(tstart));
+    return 0;
+}
@@ -6,14 +6,12 @@
 % of the scripts in lib and octrees which have been modified to suit this
 % project.
 % This version does employ the parallel computing toolbox.
+% Clearances are measured in parallel by the octree itself, so the pool is
+% not used for that section. las_octree can still be used inside parfor,
+% the workers map the one saved tree instead of copying it (see
+% mocttree.saveobj).
 %% Open the main las file
-tic
 [las_files, las_path] = uigetfile('*.las;*.laz', 'Please select the main point cloud', 'MultiSelect', 'off');
-disp('Loading las file');
-
-las_struct = extract_las_data({las_files}, las_path);
-[~,header] = LAS2DATA(strcat(las_path, las_files), 'txyzicap');
-toc
 
 %% variables
 tstart = tic;
@@ -26,7 +24,7 @@ if mod(scantiles, 2) == 0
 end
 middlescan = ceil(scantiles / 2);
 observer_height = 3;
-max_height = 20; % for whatever reason using different heights may cause issues with giftwrap, 20 seems to work, 15 had issues
+max_height = 20;
 max_side = 16;
 min_pts = 3;
 % filtering variables
@@ -35,134 +33,85 @@ candidate_padding = 4; % in whatever unit your file is in
 % cloud preprocessing
 sample_percent = 1; % A float greater than 0 and less than or equal to 1. Example, 0.25 will keep 25% of points. Supports 1, 0.5, 0.25, 0.125, etc. (Only halfings)
 translate_pts = true;
+voxel_size = 0; % 0 keeps every point, otherwise the points are thinned to one in every voxel of this edge (in las file units, ie 0.05m), see decimate_points.m
+voxel_lowest = true; % Keep the lowest point of each voxel (a top clearance rises by less than voxel_size), false keeps the first
+% drives too large for memory
+tile_length = 0; % 0 measures the whole cloud at once, otherwise the length of road (in las file units, ie 500m) measured at a time, see tiled_clearances.m
 
-%% downsample
-fn = fieldnames(las_struct);
-for k=1:numel(fn)
-    las_struct.(fn{k}) = las_struct.(fn{k})(1:ceil(1/sample_percent):end, :);
-end
-
-%% translate pts
-if translate_pts
-    las_struct.x = las_struct.x - header.x_offset;
-    las_struct.y = las_struct.y - header.y_offset;
-    las_struct.z = las_struct.z - header.z_offset;
-end
-
-%% Create octree
-% Sort by time!
-disp('Building octree');
-tic
-[~, idx] = sort(las_struct.gps_time);
-las_points = [las_struct.x(idx) las_struct.y(idx) las_struct.z(idx)];
-las_octree = octtrees.mocttree(las_points);
-toc
-
-%% Calculate road points, observers, and targets
-if las_struct.gps_time == 0
-    error("No GPS time in LAS file :(, cannot be used to make a trajectory!");
-end
-if las_struct.scan_angle_rank == 0
-    error("No scan angle rank in LAS file :(, cannot be used to make trajectory!");
-end
-disp('Constructing Trajectory and Headings');
-
-tic
 traj.point_density = target_plane_width; % Meters/feet/etc per point
 traj.floor_box_edge = 2; % Meters/feet/etc
 
-[road_points, forwards, leftwards, upwards] = camera_path_magic(las_struct, traj);
-num_road_points = numel(road_points(:,1));
-
-toc
-
-disp('Determining observers and scan targets')
-tic
-% initialize lists of targets and their associated observer points
-target_planes_right = cell(num_road_points, 4);
-target_planes_left = cell(num_road_points, 4);
-target_planes_up = cell(num_road_points, 4);
-h_observer_points = cell(1, num_road_points);
-v_observer_points = cell(1, num_road_points);
 % measurements are calculated along a "scan line", offsets serve to create
 % observers along this line from the initial road point
 h_offsets = linspace(1, scantiles, scantiles) - middlescan;
 v_offsets = linspace(1, scantiles, scantiles);
-for i = 1:num_road_points
-    % create observers for current road point
-    h_observer_points{i} = h_offsets.'*[leftwards(i,1) leftwards(i,2) 0]*target_plane_width + (road_points(i,:)+observer_height*[0 0 1]);
-    v_observer_points{i} = v_offsets.'*[0 0 1]*target_plane_width + road_points(i,:) + [0 0 1];
-    % create scan targets based on observers
-    [target_planes_right{i, 1}, target_planes_right{i, 2}, target_planes_right{i, 3}, target_planes_right{i, 4}] = ...
-                    get_target_plane_corners(v_observer_points{i}, forwards(i,:), leftwards(i,:), ...
-                                               target_plane_width, "right", max_height, max_side, scantiles);
-    [target_planes_left{i, 1}, target_planes_left{i, 2}, target_planes_left{i, 3}, target_planes_left{i, 4}] = ...
-                    get_target_plane_corners(v_observer_points{i}, forwards(i,:), leftwards(i,:), ...
-                                               target_plane_width, "left", max_height, max_side, scantiles);
-    [target_planes_up{i, 1}, target_planes_up{i, 2}, target_planes_up{i, 3}, target_planes_up{i, 4}] = ...
-                    get_target_plane_corners(h_observer_points{i}, forwards(i,:), leftwards(i,:), ...
-                                               target_plane_width, "up", max_height, max_side, scantiles);
+
+%% Load the las file
+% The points are downsampled, translated and sorted by time as they are read
+% With tiles they are read a tile at a time when measuring instead
+if tile_length == 0
+    disp('Loading las file');
+    tic
+    [las_struct, header] = load_las_points(strcat(las_path, las_files), ceil(1/sample_percent), translate_pts, voxel_size, voxel_lowest);
+    toc
+end
+
+%% Create octree
+% Built straight from the sorted columns of las_struct
+if tile_length == 0
+    disp('Building octree');
+    tic
+    % The tree is saved next to the las file, later runs on the same points
+    % and preprocessing map it instead of building it again
+    tree_file = strcat(las_path, las_files, '.moct');
+    tree_key = octtrees.mocttree.cache_key(las_struct, [sample_percent translate_pts]);
+    las_octree = octtrees.mocttree.load(tree_file, tree_key);
+    if isempty(las_octree)
+        las_octree = octtrees.mocttree(las_struct, 'tight');
+        try
+            las_octree.save(tree_file, tree_key);
+        catch err
+            warning('Could not save the octree: %s', err.message);
+        end
+    else
+        disp('Loaded the saved octree');
+    end
+    toc
+end
+
+%% Calculate road points, observers, and targets
+if tile_length == 0
+    if las_struct.gps_time == 0
+        error("No GPS time in LAS file :(, cannot be used to make a trajectory!");
+    end
+    if las_struct.scan_angle_rank == 0
+        error("No scan angle rank in LAS file :(, cannot be used to make trajectory!");
+    end
+    disp('Constructing Trajectory and Headings');
+
+    tic
+    [road_points, forwards, leftwards, upwards] = camera_path_magic(las_struct, traj, las_octree);
+    toc
 end
-toc
 
 %% measure clearances
 disp("measuring clearances")
 tic
 % clearance lists are 2d matrices where rows represent a scan line along
 % the vehicle trajectory and columns are for each roadpoint
-top_clearances = zeros(scantiles, num_road_points);
-left_clearances = zeros(scantiles, num_road_points);
-right_clearances = zeros(scantiles, num_road_points);
-parfor i = 1:num_road_points
-    for j = 1:scantiles
-        % calculate vertical clearance for the current scantile
-        target_corners = [target_planes_up{i,1}(j,:); target_planes_up{i,2}(j,:); target_planes_up{i,3}(j,:); target_planes_up{i,4}(j,:)];
-        top_constraint = get_constraint(h_observer_points{i}(j,:), target_corners);
-        top_pt_idxs = las_octree.query_planes_index(top_constraint);
-        % filter out noise
-        if length(top_pt_idxs) < min_pts
-            top_clearances(j,i) = max_height;
-        else
-            top_pts = las_points(top_pt_idxs, :);
-            if size(top_pts,1) == 1
-                top_min = top_pts;
-            else
-                top_min = min(min(top_pts,[],3));
-            end
-            % top clearance is calculated as the vertical difference
-            % between the lowest point found and the road point
-            top_z = top_min(3);
-            bot_z = h_observer_points{i}(j,3) - observer_height;
-            top_clearances(j,i) = top_z - bot_z;
-        end
-
-        % calculate left clearance for the current scantile
-        target_corners = [target_planes_left{i,1}(j,:); target_planes_left{i,2}(j,:); target_planes_left{i,3}(j,:); target_planes_left{i,4}(j,:)];
-        left_constraint = get_constraint(v_observer_points{i}(j,:), target_corners);
-        left_pt_idxs = las_octree.query_planes_index(left_constraint);
-        if length(left_pt_idxs) < min_pts
-            left_clearances(j,i) = max_side;
-        else
-            % side clearance is calculated as the distance between the
-            % observer point and the closest point found
-            left_pts = las_points(left_pt_idxs, :);
-            left_dists = vecnorm(left_pts - v_observer_points{i}(j,:), 2, 2);
-            left_clearances(j,i) = min(left_dists);
-        end
-
-        % calculate right clearance for the current scantile
-        target_corners = [target_planes_right{i,1}(j,:); target_planes_right{i,2}(j,:); target_planes_right{i,3}(j,:); target_planes_right{i,4}(j,:)];
-        right_constraint = get_constraint(v_observer_points{i}(j,:), target_corners);
-        right_pt_idxs = las_octree.query_planes_index(right_constraint);
-        if length(right_pt_idxs) < min_pts
-            right_clearances(j,i) = max_side;
-        else
-            right_pts = las_points(right_pt_idxs, :);
-            right_dists = vecnorm(right_pts - v_observer_points{i}(j,:), 2, 2);
-            right_clearances(j,i) = min(right_dists);
-        end
-    end
+% The observers, scan targets and frusta for every road point are built
+% inside the octree and the road points are measured in parallel
+if tile_length == 0
+    [top_clearances, left_clearances, right_clearances] = las_octree.query_scan_clearances( ...
+        road_points, forwards, leftwards, h_offsets, v_offsets, ...
+        target_plane_width, observer_height, max_height, max_side, min_pts);
+else
+    scan = struct('h_offsets', h_offsets, 'v_offsets', v_offsets, 'target_plane_width', target_plane_width, ...
+        'observer_height', observer_height, 'max_height', max_height, 'max_side', max_side, 'min_pts', min_pts);
+    [top_clearances, left_clearances, right_clearances, road_points] = tiled_clearances( ...
+        strcat(las_path, las_files), ceil(1/sample_percent), translate_pts, traj, scan, tile_length, voxel_size, voxel_lowest);
 end
+num_road_points = numel(road_points(:,1));
 toc
 
 %% initial plot
@@ -0,0 +1,25 @@
+function las_struct = decimate_points(las_struct, voxel_size, voxel_lowest)
+%DECIMATE_POINTS Thins the points to one in every voxel of voxel_size.
+% The voxels are a fixed grid, so overlapping parts of a cloud (tiles)
+% keep the same points. voxel_lowest keeps the lowest point of each voxel,
+% so a top clearance rises by less than a voxel, otherwise the first (by
+% time) is kept. The points straight down from the scanners (scan angle
+% rank 0) are always kept, the trajectory is made from them.
+%
+% Unlike sample_percent, dense ground near the road is thinned much more
+% than the sparse points far away. voxel_size 0 keeps every point.
+
+if voxel_size <= 0
+    return;
+end
+cloud = struct('x', double(las_struct.x), 'y', double(las_struct.y), 'z', double(las_struct.z));
+if isfield(las_struct, 'scan_angle_rank')
+    cloud.scan_angle_rank = int16(las_struct.scan_angle_rank);
+end
+keep = octtrees.voxelmoct(cloud, voxel_size, voxel_lowest);
+clear cloud
+fn = fieldnames(las_struct);
+for k = 1:numel(fn)
+    las_struct.(fn{k}) = las_struct.(fn{k})(keep, :);
+end
+end
@@ -1,4 +1,5 @@
 function constraints = get_constraint(obsvr, trgt)
-hull_points = [obsvr; trgt(1,:); trgt(2,:); trgt(3,:); trgt(4,:)];
-convex_hull = giftwrap3d_mex(hull_points);
-constraints = convert_hull_to_constraints(convex_hull, hull_points, 0);
+% Constraints (Nx4) of the pyramid from the observer to the 4 target
+% corners (in order around the target). The faces are known directly so no
+% hull is computed, see octtrees.frustum_constraints
+constraints = octtrees.frustum_constraints(obsvr(:), trgt')';
@@ -0,0 +1,51 @@
+function [las_struct, header] = load_las_points(filename, sample_step, translate_pts, voxel_size, voxel_lowest)
+%LOAD_LAS_POINTS Loads the points of a las file for the clearance scripts.
+% Keeps every sample_step-th point, subtracts the header offsets if
+% translate_pts is true, and sorts the points by gps_time.
+% voxel_size and voxel_lowest are optional, the points are then thinned to
+% one a voxel (see decimate_points.m).
+% las_struct has the x, y, z, gps_time, scan_angle_rank and point_source_ID
+% columns, header has the scale factors and offsets.
+%
+% Las files are read by octtrees.readlas, which decodes only those fields
+% straight from the file and runs anywhere the MEX files build. Compressed
+% laz files still go through las2mat (Windows only).
+
+if nargin < 4
+    voxel_size = 0;
+end
+if nargin < 5
+    voxel_lowest = true;
+end
+
+[~, ~, ext] = fileparts(filename);
+if ~strcmpi(ext, '.laz')
+    [las_struct, header] = octtrees.readlas(filename, sample_step, translate_pts);
+    las_struct = decimate_points(las_struct, voxel_size, voxel_lowest);
+    return;
+end
+
+[file_path, file_name, file_ext] = fileparts(filename);
+las_struct = extract_las_data({[file_name file_ext]}, file_path);
+[~, header] = LAS2DATA(filename, 'txyzicap');
+
+% Downsample
+fn = fieldnames(las_struct);
+for k = 1:numel(fn)
+    las_struct.(fn{k}) = las_struct.(fn{k})(1:sample_step:end, :);
+end
+
+% Translate
+if translate_pts
+    las_struct.x = las_struct.x - header.x_offset;
+    las_struct.y = las_struct.y - header.y_offset;
+    las_struct.z = las_struct.z - header.z_offset;
+end
+
+% Sort by time, the same as readlas
+[~, idx] = sort(las_struct.gps_time);
+for k = 1:numel(fn)
+    las_struct.(fn{k}) = las_struct.(fn{k})(idx, :);
+end
+las_struct = decimate_points(las_struct, voxel_size, voxel_lowest);
+end
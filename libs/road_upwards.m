@@ -0,0 +1,23 @@
+function upwards = road_upwards(road_points, cloud, traj)
+%ROAD_UPWARDS The up direction of the road at every road point
+% Fits a plane to the points in a box of traj.floor_box_edge around each
+% road point, [0 0 1] where there are too few points or the fit tilts too
+% far.
+%
+% cloud is the octree of the points (an octtrees.mocttree), every road
+% point is fitted in parallel straight from the tree without copying any
+% points (see query_upwards). It can also be a las_struct, a temporary
+% octree is then built from it.
+%
+% Only the points near the road points are used, so cloud can be any part
+% of the cloud holding them (a tile, see tiled_clearances.m)
+
+if ~isa(cloud, 'octtrees.mocttree')
+    cloud = octtrees.mocttree(cloud, 'tight');
+end
+
+[upwards, num_tilted] = cloud.query_upwards(road_points, traj.floor_box_edge);
+if num_tilted > 0
+    fprintf("BAD ANGLES!!! at %d road points\n", num_tilted); % 25 degrees tilt, sanity check.
+end
+end
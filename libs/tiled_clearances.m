@@ -0,0 +1,92 @@
+function [top_clearances, left_clearances, right_clearances, road_points] = tiled_clearances(las_file, sample_step, translate_pts, traj, scan, tile_length, voxel_size, voxel_lowest)
+%TILED_CLEARANCES Measures the clearances of a drive one tile at a time.
+% For drives whose cloud and octree don't fit in memory together. The
+% results are the same as loading the whole cloud (load_las_points),
+% making the trajectory (camera_path_magic) and measuring every road point
+% in one octree, but only one tile's points and octree are held at once.
+%
+% The trajectory is made from the points straight down from the scanners
+% (scan angle rank 0), a small part of the cloud. The road points are then
+% cut into runs of tile_length along the road, the tile of a run is the box
+% around its road points grown by as far as their scans (and the floor
+% boxes of their normals) reach, so neighbouring tiles overlap. One pass
+% over the file writes every point to the tiles it is in, then each tile
+% is read back, its octree built, its road points measured and it is freed.
+%
+% Only las files can be tiled. scan has the h_offsets, v_offsets,
+% target_plane_width, observer_height, max_height, max_side and min_pts
+% given to query_scan_clearances.
+%
+% voxel_size and voxel_lowest are optional, each tile is then thinned to a
+% point a voxel (see decimate_points.m). The voxels are a fixed grid and
+% the tiles reach a voxel further, so every voxel a scan can see is whole
+% in the tile and keeps the same point it does in the whole cloud.
+
+if nargin < 7
+    voxel_size = 0;
+end
+if nargin < 8
+    voxel_lowest = true;
+end
+
+path_struct = octtrees.readlas(las_file, sample_step, translate_pts, 0);
+if isempty(path_struct.x)
+    error("No points with a scan angle rank of 0 in LAS file :(, cannot be used to make trajectory!");
+end
+if path_struct.gps_time == 0
+    error("No GPS time in LAS file :(, cannot be used to make a trajectory!");
+end
+[road_points, forwards] = camera_path_magic(path_struct, traj);
+clear path_struct
+num_road_points = size(road_points, 1);
+
+% Furthest any point a road point's scans can see is from it, along any
+% axis: its observers, then the target plane (twice the width each way
+% in two directions) at the furthest scan distance. One more width keeps
+% rounding out of it
+width = scan.target_plane_width;
+observer_reach = max(scan.observer_height, 1 + max(abs(scan.v_offsets))*width) + max(abs(scan.h_offsets))*width;
+reach = observer_reach + 4*width + max(scan.max_height, scan.max_side);
+reach = max(reach, traj.floor_box_edge/2) + width;
+% Whole voxels, see above
+reach = reach + voxel_size;
+
+tile_points = max(1, round(tile_length/traj.point_density));
+tile_starts = 1:tile_points:num_road_points;
+num_tiles = numel(tile_starts);
+tile_low = zeros(3, num_tiles);
+tile_high = zeros(3, num_tiles);
+for k = 1:num_tiles
+    in_tile = tile_starts(k):min(tile_starts(k) + tile_points - 1, num_road_points);
+    tile_low(:, k) = min(road_points(in_tile, :), [], 1)' - reach;
+    tile_high(:, k) = max(road_points(in_tile, :), [], 1)' + reach;
+end
+
+folder = tempname;
+mkdir(folder);
+cleanup = onCleanup(@() rmdir(folder, 's'));
+fprintf('Splitting into %d tiles\n', num_tiles);
+octtrees.tilelas('split', las_file, sample_step, translate_pts, tile_low, tile_high, folder);
+
+scantiles = numel(scan.h_offsets);
+top_clearances = zeros(scantiles, num_road_points);
+left_clearances = zeros(scantiles, num_road_points);
+right_clearances = zeros(scantiles, num_road_points);
+for k = 1:num_tiles
+    tile_file = fullfile(folder, sprintf('tile%d.bin', k));
+    tile = octtrees.tilelas('read', tile_file);
+    delete(tile_file);
+    tile = decimate_points(tile, voxel_size, voxel_lowest);
+
+    in_tile = tile_starts(k):min(tile_starts(k) + tile_points - 1, num_road_points);
+    tile_octree = octtrees.mocttree(tile, 'tight');
+    clear tile
+    upwards = road_upwards(road_points(in_tile, :), tile_octree, traj);
+    leftwards = cross(upwards, forwards(in_tile, :), 2);
+    [top_clearances(:, in_tile), left_clearances(:, in_tile), right_clearances(:, in_tile)] = ...
+        tile_octree.query_scan_clearances(road_points(in_tile, :), forwards(in_tile, :), leftwards, ...
+        scan.h_offsets, scan.v_offsets, scan.target_plane_width, scan.observer_height, ...
+        scan.max_height, scan.max_side, scan.min_pts);
+    delete(tile_octree);
+end
+end